@@ -0,0 +1,88 @@
+/*
+ *  ArchiveFormat.h
+ *  Wiki2Touch/wikisrvd
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARCHIVEFORMAT_H
+#define ARCHIVEFORMAT_H
+
+/*
+ The layout of articles.bin and images.bin, shared by the readers and the archive builder. All
+ positions are 64 bit numbers from the start of the file (the same as fpos_t on the iPhone).
+
+ articles.bin: the FILEHEADER, the compressed blocks of article texts, the title table and the
+ two indexes. A title entry is the block position (8 bytes), the position of the article in the
+ uncompressed block (4 bytes), its length (4 bytes) and the zero terminated title. The indexes
+ hold the offsets of the title entries (relative to titlesPos) sorted by the lowercase titles
+ (index 0) and by the titles prepared for a search (index 1). Every block is a stream of its own
+ in the codec of the header: bzip2, or deflate (zlib format) with the preset dictionary at
+ dictionaryPos/dictionarySize. An article is read by decompressing its block up to the article
+ position.
+
+ images.bin: the IMAGEFILEHEADER, the image data, the title table and one index. An image entry
+ is the image position (8 bytes), its length (4 bytes) and the zero terminated lowercase filename.
+ */
+
+#pragma pack(push, 1)
+typedef struct
+{
+	char languageCode[2];				// 2 bytes
+	unsigned int numberOfArticles;		// 4 bytes
+	long long titlesPos;				// 8 bytes
+	long long indexPos_0;				// 8 bytes
+	long long indexPos_1;				// 8 bytes; the second one has discritcs removed or traditional chineses chars are converted to simpified chineses chars
+	unsigned char version;				// 1 byte; 0: no second index, 1: 32 bit index slots, 2: 64 bit index slots
+	unsigned char codec;				// 1 byte; version 2: how the blocks are compressed, ARCHIVE_CODEC_...
+	char imageNamespace[32];			// namespace prefix for images   (without the colon)
+	char templateNamespace[32];			// namespace prefix for template (without the colon)
+	unsigned int maxBlockSize;			// 4 bytes; version 2: uncompressed size of a block at most, only a single article can exceed it; 0: unknown
+	long long dictionaryPos;			// 8 bytes; version 2: the preset dictionary of the codec ...
+	unsigned int dictionarySize;		// 4 bytes; ... 0 if there is none
+	char reserved2[144];				// for future use
+} FILEHEADER;
+
+typedef struct
+{
+	char languageCode[2];
+	unsigned int numberOfImages;
+
+	long long titlesPos;
+	long long indexPos;
+	char reserved[10];
+} IMAGEFILEHEADER;
+#pragma pack(pop)
+
+// the size of the position information in front of a title in articles.bin
+#define SIZEOF_POSITION_INFORMATION 16
+
+// the size of the position information in front of a filename in images.bin
+#define SIZEOF_IMAGE_POSITION_INFORMATION 12
+
+// version 2 archives store the title offsets (relative to titlesPos) as 64 bit slots and start the
+// titles and both indexes at page boundaries, so they can exceed 2 GB and be mapped as they are
+#define ARCHIVE_VERSION_64 2
+
+#define ARCHIVE_PAGE_SIZE 4096
+
+// the block codecs, versions before 2 always use bzip2
+#define ARCHIVE_CODEC_BZIP2 0
+#define ARCHIVE_CODEC_DEFLATE 1
+
+#endif
@@ -0,0 +1,136 @@
+/*
+ *  ArticleReader.cpp
+ *  Wiki2Touch/wikisrvd
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include "ArticleReader.h"
+
+ArticleReader::ArticleReader(TitleIndex* titleIndex, BlockCache* blockCache, ArticleSearchResult* articleSearchResult)
+{
+	_blockCache = blockCache;
+	_block = NULL;
+
+	_codec = titleIndex->Codec();
+	_f = NULL;
+	_stream = NULL;
+	_buffer = NULL;
+
+	_length = articleSearchResult->ArticleLength();
+	_articlePos = articleSearchResult->ArticlePos();
+	_remaining = _length;
+	_error = articleSearchResult->ArticlePos()<0 || _length<0 || !_codec;
+	if ( _error )
+		return;
+
+	string fileName = titleIndex->DataFileName();
+	off_t blockPos = articleSearchResult->BlockPos();
+
+	// a block which is kept anyway is shared with the templates read while the article is parsed
+	_block = _blockCache->FindBlock(fileName, blockPos);
+	if ( !_block && titleIndex->MaxBlockSize() && _blockCache->Fits(titleIndex->MaxBlockSize()) )
+		_block = _blockCache->GetBlock(fileName, blockPos, _codec, titleIndex->MaxBlockSize());
+
+	if ( _block )
+	{
+		_error = _articlePos + _remaining>_block->size;
+		return;
+	}
+
+	_f = fopen(fileName.c_str(), "rb");
+	if ( _f && !fseeko(_f, blockPos, SEEK_SET) )
+		_stream = _codec->OpenStream(_f);
+	_buffer = (char*) malloc(ARTICLE_CHUNK_SIZE);
+
+	_error = !_stream || !_buffer;
+}
+
+ArticleReader::~ArticleReader()
+{
+	if ( _block )
+		_blockCache->Release(_block);
+
+	if ( _stream )
+		_codec->CloseStream(_stream);
+
+	if ( _f )
+		fclose(_f);
+
+	if ( _buffer )
+		free(_buffer);
+}
+
+int ArticleReader::Length()
+{
+	return _length;
+}
+
+bool ArticleReader::Error()
+{
+	return _error;
+}
+
+bool ArticleReader::Read(const char** chunk, size_t* length)
+{
+	if ( _error || !_remaining )
+		return false;
+
+	if ( _block )
+	{
+		// the whole article at once, it's in memory anyway
+		*chunk = _block->data + _articlePos;
+		*length = _remaining;
+
+		_articlePos += _remaining;
+		_remaining = 0;
+
+		return true;
+	}
+
+	// the text in front of the article is decompressed and thrown away
+	while ( _articlePos )
+	{
+		int read = _codec->ReadStream(_stream, _buffer, min(_articlePos, (size_t) ARTICLE_CHUNK_SIZE));
+		if ( read<=0 )
+		{
+			_error = true;
+			return false;
+		}
+
+		_articlePos -= read;
+	}
+
+	int read = _codec->ReadStream(_stream, _buffer, min(_remaining, (size_t) ARTICLE_CHUNK_SIZE));
+	if ( read<=0 )
+	{
+		// the block is shorter than the title table says
+		_error = true;
+		return false;
+	}
+
+	*chunk = _buffer;
+	*length = read;
+	_remaining -= read;
+
+	return true;
+}
@@ -0,0 +1,68 @@
+/*
+ *  ArticleReader.h
+ *  Wiki2Touch/wikisrvd
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARTICLEREADER_H
+#define ARTICLEREADER_H
+
+#include <stdio.h>
+
+#include "TitleIndex.h"
+#include "BlockCache.h"
+
+// the size of a piece of an article if it is decompressed while it is read
+#define ARTICLE_CHUNK_SIZE 65536
+
+/*
+ Hands out the utf-8 text of an article piece by piece. If the block of the article is in the
+ block cache (or fits into it) the pieces point into the cached block, otherwise the block is
+ decompressed while the article is read and only one piece is kept in memory at once.
+ */
+class ArticleReader
+{
+public:
+	ArticleReader(TitleIndex* titleIndex, BlockCache* blockCache, ArticleSearchResult* articleSearchResult);
+	~ArticleReader();
+
+	// the length of the article in bytes
+	int Length();
+
+	// the next piece of the article, valid until the next call; false at the end of the article
+	// or if it can't be read
+	bool Read(const char** chunk, size_t* length);
+	bool Error();
+
+private:
+	BlockCache* _blockCache;
+	CACHEDBLOCK* _block;
+
+	BlockCodec* _codec;
+	FILE*	_f;
+	void*	_stream;
+	char*	_buffer;
+
+	size_t	_articlePos;		// what is left in front of the article (in the cached block: its position)
+	size_t	_remaining;			// what is left of the article
+	int		_length;
+	bool	_error;
+};
+
+#endif
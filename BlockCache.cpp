@@ -0,0 +1,197 @@
+/*
+ *  BlockCache.cpp
+ *  Wiki2Touch/wikisrvd
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "BlockCache.h"
+
+BlockCache::BlockCache(size_t memory)
+{
+	_cache = new BLOCKCACHE(memory, BLOCK_CACHE_SHARDS, Uncache);
+}
+
+BlockCache::~BlockCache()
+{
+	delete _cache;
+}
+
+unsigned int BlockCache::Hash(const string& fileName, off_t blockPos)
+{
+	// the block positions of one archive are spread well enough, the name only has to make
+	// equal positions of two archives differ
+	unsigned long long hash = (unsigned long long) blockPos + fileName.length();
+	hash *= 0x9e3779b97f4a7c15ULL;
+
+	return (unsigned int) (hash >> 32);
+}
+
+CACHEDBLOCK* BlockCache::GetBlock(const string& fileName, off_t blockPos, BlockCodec* codec, size_t sizeHint)
+{
+	unsigned int hash = Hash(fileName, blockPos);
+	pair<string, off_t> key(fileName, blockPos);
+
+	BLOCKCACHE::SHARD* shard = _cache->Lock(hash);
+	BLOCKCACHE::ENTRY* entry = _cache->Find(shard, key);
+	if ( entry )
+	{
+		CACHEDBLOCK* block = entry->value;
+		block->references++;
+		_cache->MakeNewest(shard, entry);
+		_cache->Unlock(shard);
+
+		_cache->Count(CACHE_HITS);
+		return block;
+	}
+	_cache->Unlock(shard);
+
+	// decompress without holding the shard, other blocks of it can be served meanwhile
+	CACHEDBLOCK* block = ReadBlock(fileName, blockPos, codec, sizeHint);
+
+	_cache->Count(CACHE_MISSES);
+	if ( block )
+		_cache->Count(CACHE_OTHER, block->size);
+
+	// a block larger than the shard is handed out without being cached
+	if ( !block || !_cache->Fits(block->size) )
+		return block;
+
+	shard = _cache->Lock(hash);
+
+	// another thread may have read the same block in the meantime
+	entry = _cache->Find(shard, key);
+	if ( entry )
+	{
+		CACHEDBLOCK* cachedBlock = entry->value;
+		cachedBlock->references++;
+		_cache->MakeNewest(shard, entry);
+		_cache->Unlock(shard);
+
+		DeleteBlock(block);
+		return cachedBlock;
+	}
+
+	block->cached = true;
+	_cache->Add(shard, key, block, block->size);
+	_cache->Unlock(shard);
+
+	return block;
+}
+
+CACHEDBLOCK* BlockCache::FindBlock(const string& fileName, off_t blockPos)
+{
+	CACHEDBLOCK* block = NULL;
+
+	BLOCKCACHE::SHARD* shard = _cache->Lock(Hash(fileName, blockPos));
+	BLOCKCACHE::ENTRY* entry = _cache->Find(shard, pair<string, off_t>(fileName, blockPos));
+	if ( entry )
+	{
+		block = entry->value;
+		block->references++;
+		_cache->MakeNewest(shard, entry);
+	}
+	_cache->Unlock(shard);
+
+	if ( block )
+		_cache->Count(CACHE_HITS);
+
+	return block;
+}
+
+bool BlockCache::Fits(size_t size)
+{
+	return _cache->Fits(size);
+}
+
+void BlockCache::Release(CACHEDBLOCK* block)
+{
+	if ( !block )
+		return;
+
+	BLOCKCACHE::SHARD* shard = _cache->Lock(Hash(block->fileName, block->blockPos));
+	bool unused = --block->references==0 && !block->cached;
+	_cache->Unlock(shard);
+
+	if ( unused )
+		DeleteBlock(block);
+}
+
+string BlockCache::GetStatistics()
+{
+	long long counters[CACHE_COUNTERS];
+	int blocks;
+	size_t size;
+	_cache->GetStatistics(counters, &blocks, &size);
+
+	char buffer[256];
+	snprintf(buffer, sizeof(buffer), "blockHits:%lld\nblockMisses:%lld\nblockEvictions:%lld\nblockBytesDecompressed:%lld\nblocksCached:%d\nblockCacheSize:%lu", counters[CACHE_HITS], counters[CACHE_MISSES], counters[CACHE_EVICTIONS], counters[CACHE_OTHER], blocks, (unsigned long) size);
+
+	return string(buffer);
+}
+
+CACHEDBLOCK* BlockCache::ReadBlock(const string& fileName, off_t blockPos, BlockCodec* codec, size_t sizeHint)
+{
+	if ( !codec )
+		return NULL;
+
+	FILE* f = fopen(fileName.c_str(), "rb");
+	if ( !f )
+		return NULL;
+
+	if ( fseeko(f, blockPos, SEEK_SET) )
+	{
+		fclose(f);
+		return NULL;
+	}
+
+	char* data;
+	size_t size;
+	bool decompressed = codec->Decompress(f, sizeHint, &data, &size);
+	fclose(f);
+
+	if ( !decompressed )
+		return NULL;
+
+	CACHEDBLOCK* block = new CACHEDBLOCK;
+	block->fileName = fileName;
+	block->blockPos = blockPos;
+	block->data = data;
+	block->size = size;
+	block->references = 1;
+	block->cached = false;
+
+	return block;
+}
+
+void BlockCache::Uncache(CACHEDBLOCK** block)
+{
+	// still in use, the last release frees it
+	(*block)->cached = false;
+	if ( !(*block)->references )
+		DeleteBlock(*block);
+}
+
+void BlockCache::DeleteBlock(CACHEDBLOCK* block)
+{
+	free(block->data);
+	delete block;
+}
@@ -0,0 +1,87 @@
+/*
+ *  BlockCache.h
+ *  Wiki2Touch/wikisrvd
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BLOCKCACHE_H
+#define BLOCKCACHE_H
+
+#include <sys/types.h>
+#include <string>
+using namespace std;
+
+#include "BlockCodec.h"
+#include "ShardedCache.h"
+
+// memory for the decompressed blocks if nothing else is given
+#define DEFAULT_BLOCK_CACHE_MEMORY (8192*1024)
+
+// the cache is split so lookups of different blocks don't wait for each other
+#define BLOCK_CACHE_SHARDS 8
+
+typedef struct
+{
+	string	fileName;
+	off_t	blockPos;
+
+	char*	data;					// the decompressed block
+	size_t	size;
+
+	int		references;				// the callers which have not released the block yet
+	bool	cached;					// false if evicted (or never added), freed with the last release
+} CACHEDBLOCK;
+
+typedef ShardedCache<pair<string, off_t>, CACHEDBLOCK*> BLOCKCACHE;
+
+/*
+ Keeps the most recently used blocks of the archives decompressed. A block is returned with a
+ reference which has to be given back with Release; until then its data stays valid even if
+ the block is evicted in between.
+ */
+class BlockCache
+{
+public:
+	BlockCache(size_t memory=DEFAULT_BLOCK_CACHE_MEMORY);
+	~BlockCache();
+
+	// the block of the archive starting at blockPos, NULL if it can't be read; codec is the one
+	// of the archive, sizeHint the uncompressed size of the block at most if the archive tells it
+	CACHEDBLOCK* GetBlock(const string& fileName, off_t blockPos, BlockCodec* codec, size_t sizeHint=0);
+	void Release(CACHEDBLOCK* block);
+
+	// the block only if it is cached already, nothing is decompressed
+	CACHEDBLOCK* FindBlock(const string& fileName, off_t blockPos);
+
+	// true if a block of this size is kept
+	bool Fits(size_t size);
+
+	string GetStatistics();
+
+private:
+	BLOCKCACHE* _cache;
+
+	unsigned int Hash(const string& fileName, off_t blockPos);
+	CACHEDBLOCK* ReadBlock(const string& fileName, off_t blockPos, BlockCodec* codec, size_t sizeHint);
+
+	static void Uncache(CACHEDBLOCK** block);
+	static void DeleteBlock(CACHEDBLOCK* block);
+};
+
+#endif
@@ -0,0 +1,338 @@
+/*
+ *  BlockCodec.cpp
+ *  Wiki2Touch/wikisrvd
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <bzlib.h>
+#include <zlib.h>
+
+#include "BlockCodec.h"
+
+// a block grows in steps of this size while it is decompressed (if its size is not known)
+#define BLOCK_BUFFER_SIZE (256*1024)
+
+// the compressed data is read in pieces of this size
+#define INPUT_BUFFER_SIZE 16384
+
+// more than a zlib window can't be used
+#define MAX_DICTIONARY_SIZE 32768
+
+typedef struct
+{
+	BZFILE*	bzf;
+	bool	ended;
+} BZIP2STREAM;
+
+typedef struct
+{
+	z_stream stream;
+	FILE*	f;
+	bool	ended;
+	unsigned char input[INPUT_BUFFER_SIZE];
+} DEFLATESTREAM;
+
+BlockCodec::~BlockCodec()
+{
+}
+
+BlockCodec* BlockCodec::Create(int codec, const string& dictionary, int level)
+{
+	switch ( codec )
+	{
+		case ARCHIVE_CODEC_BZIP2:
+			return new Bzip2Codec(level ? level : 9);
+
+		case ARCHIVE_CODEC_DEFLATE:
+			return new DeflateCodec(dictionary, level ? level : 9);
+	}
+
+	return NULL;
+}
+
+BlockCodec* BlockCodec::ForArchive(int fd, const FILEHEADER* header)
+{
+	// older archives don't know the field
+	if ( header->version<ARCHIVE_VERSION_64 )
+		return Create(ARCHIVE_CODEC_BZIP2);
+
+	string dictionary;
+	if ( header->dictionarySize )
+	{
+		if ( header->dictionarySize>MAX_DICTIONARY_SIZE )
+			return NULL;
+
+		char buffer[MAX_DICTIONARY_SIZE];
+		if ( pread(fd, buffer, header->dictionarySize, header->dictionaryPos)!=(ssize_t) header->dictionarySize )
+			return NULL;
+
+		dictionary = string(buffer, header->dictionarySize);
+	}
+
+	return Create(header->codec, dictionary);
+}
+
+bool BlockCodec::Decompress(FILE* f, size_t sizeHint, char** data, size_t* size)
+{
+	void* stream = OpenStream(f);
+	if ( !stream )
+		return false;
+
+	// one more byte than the block needs, so the end of the stream is seen without growing
+	*data = NULL;
+	*size = 0;
+	size_t allocated = sizeHint ? sizeHint + 1 : BLOCK_BUFFER_SIZE;
+
+	bool error = false;
+	while ( true )
+	{
+		if ( !Grow(data, &allocated, *size) )
+		{
+			error = true;
+			break;
+		}
+
+		int read = ReadStream(stream, *data + *size, allocated - *size);
+		if ( read<=0 )
+		{
+			error = read<0;
+			break;
+		}
+
+		*size += read;
+	}
+
+	CloseStream(stream);
+
+	if ( error && *data )
+	{
+		free(*data);
+		*data = NULL;
+	}
+
+	return !error;
+}
+
+bool BlockCodec::Grow(char** data, size_t* allocated, size_t size)
+{
+	if ( *data && size<*allocated )
+		return true;
+
+	size_t newSize = *data ? *allocated + BLOCK_BUFFER_SIZE : *allocated;
+	char* grown = (char*) realloc(*data, newSize);
+	if ( !grown )
+		return false;
+
+	*data = grown;
+	*allocated = newSize;
+
+	return true;
+}
+
+Bzip2Codec::Bzip2Codec(int blockSize100k)
+{
+	_blockSize100k = blockSize100k;
+}
+
+int Bzip2Codec::Codec()
+{
+	return ARCHIVE_CODEC_BZIP2;
+}
+
+const char* Bzip2Codec::Name()
+{
+	return "bzip2";
+}
+
+bool Bzip2Codec::Compress(const char* data, size_t size, char** compressed, size_t* compressedSize)
+{
+	// the worst case according to the bzip2 documentation
+	unsigned int length = size + size/100 + 600;
+	*compressed = (char*) malloc(length);
+	if ( !*compressed )
+		return false;
+
+	if ( BZ2_bzBuffToBuffCompress(*compressed, &length, (char*) data, size, _blockSize100k, 0, 0)!=BZ_OK )
+	{
+		free(*compressed);
+		*compressed = NULL;
+		return false;
+	}
+
+	*compressedSize = length;
+	return true;
+}
+
+void* Bzip2Codec::OpenStream(FILE* f)
+{
+	int bzerror;
+	BZFILE* bzf = BZ2_bzReadOpen(&bzerror, f, 0, 0, NULL, 0);
+	if ( bzerror!=BZ_OK )
+		return NULL;
+
+	BZIP2STREAM* stream = new BZIP2STREAM;
+	stream->bzf = bzf;
+	stream->ended = false;
+
+	return stream;
+}
+
+int Bzip2Codec::ReadStream(void* stream, char* buffer, size_t size)
+{
+	BZIP2STREAM* bzip2Stream = (BZIP2STREAM*) stream;
+	if ( bzip2Stream->ended )
+		return 0;
+
+	// every block is a bzip2 stream of its own
+	int bzerror;
+	int read = BZ2_bzRead(&bzerror, bzip2Stream->bzf, buffer, size);
+	if ( bzerror==BZ_STREAM_END )
+		bzip2Stream->ended = true;
+	else if ( bzerror!=BZ_OK )
+		return -1;
+
+	return read;
+}
+
+void Bzip2Codec::CloseStream(void* stream)
+{
+	BZIP2STREAM* bzip2Stream = (BZIP2STREAM*) stream;
+
+	int bzerror;
+	BZ2_bzReadClose(&bzerror, bzip2Stream->bzf);
+
+	delete bzip2Stream;
+}
+
+DeflateCodec::DeflateCodec(const string& dictionary, int level)
+{
+	_dictionary = dictionary.length()>MAX_DICTIONARY_SIZE ? dictionary.substr(dictionary.length() - MAX_DICTIONARY_SIZE) : dictionary;
+	_level = level;
+}
+
+int DeflateCodec::Codec()
+{
+	return ARCHIVE_CODEC_DEFLATE;
+}
+
+const char* DeflateCodec::Name()
+{
+	return _dictionary.empty() ? "deflate" : "deflate+dictionary";
+}
+
+bool DeflateCodec::Compress(const char* data, size_t size, char** compressed, size_t* compressedSize)
+{
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	if ( deflateInit(&stream, _level)!=Z_OK )
+		return false;
+
+	bool error = !_dictionary.empty() && deflateSetDictionary(&stream, (const Bytef*) _dictionary.data(), _dictionary.length())!=Z_OK;
+
+	uLong length = deflateBound(&stream, size);
+	*compressed = error ? NULL : (char*) malloc(length);
+
+	if ( *compressed )
+	{
+		stream.next_in = (Bytef*) data;
+		stream.avail_in = size;
+		stream.next_out = (Bytef*) *compressed;
+		stream.avail_out = length;
+
+		error = deflate(&stream, Z_FINISH)!=Z_STREAM_END;
+		*compressedSize = stream.total_out;
+	}
+	else
+		error = true;
+
+	deflateEnd(&stream);
+
+	if ( error && *compressed )
+	{
+		free(*compressed);
+		*compressed = NULL;
+	}
+
+	return !error;
+}
+
+void* DeflateCodec::OpenStream(FILE* f)
+{
+	DEFLATESTREAM* stream = new DEFLATESTREAM;
+	memset(&stream->stream, 0, sizeof(stream->stream));
+	if ( inflateInit(&stream->stream)!=Z_OK )
+	{
+		delete stream;
+		return NULL;
+	}
+
+	stream->f = f;
+	stream->ended = false;
+
+	return stream;
+}
+
+int DeflateCodec::ReadStream(void* stream, char* buffer, size_t size)
+{
+	DEFLATESTREAM* deflateStream = (DEFLATESTREAM*) stream;
+	z_stream* zStream = &deflateStream->stream;
+
+	zStream->next_out = (Bytef*) buffer;
+	zStream->avail_out = size;
+
+	while ( !deflateStream->ended && zStream->avail_out==size )
+	{
+		// the stream ends by itself, reading over the end of the block does no harm
+		if ( !zStream->avail_in )
+		{
+			zStream->avail_in = fread(deflateStream->input, 1, sizeof(deflateStream->input), deflateStream->f);
+			zStream->next_in = deflateStream->input;
+			if ( !zStream->avail_in )
+				return -1;
+		}
+
+		int result = inflate(zStream, Z_NO_FLUSH);
+		if ( result==Z_NEED_DICT )
+		{
+			// zlib checks that it is the dictionary the block was compressed with
+			result = inflateSetDictionary(zStream, (const Bytef*) _dictionary.data(), _dictionary.length());
+			if ( result==Z_OK )
+				result = inflate(zStream, Z_NO_FLUSH);
+		}
+
+		if ( result==Z_STREAM_END )
+			deflateStream->ended = true;
+		else if ( result!=Z_OK && result!=Z_BUF_ERROR )
+			return -1;
+	}
+
+	return size - zStream->avail_out;
+}
+
+void DeflateCodec::CloseStream(void* stream)
+{
+	DEFLATESTREAM* deflateStream = (DEFLATESTREAM*) stream;
+
+	inflateEnd(&deflateStream->stream);
+
+	delete deflateStream;
+}
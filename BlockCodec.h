@@ -0,0 +1,105 @@
+/*
+ *  BlockCodec.h
+ *  Wiki2Touch/wikisrvd
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BLOCKCODEC_H
+#define BLOCKCODEC_H
+
+#include <stdio.h>
+#include <string>
+using namespace std;
+
+#include "ArchiveFormat.h"
+
+/*
+ Compresses and decompresses the blocks of an archive. A codec keeps no state between two calls,
+ so one instance can be used by any number of threads.
+ */
+class BlockCodec
+{
+public:
+	virtual ~BlockCodec();
+
+	// codec is one of ARCHIVE_CODEC_..., level the compression level (0: the default of the codec)
+	static BlockCodec* Create(int codec, const string& dictionary=string(), int level=0);
+
+	// the codec of an archive, NULL if it is unknown or the dictionary can't be read
+	static BlockCodec* ForArchive(int fd, const FILEHEADER* header);
+
+	virtual int Codec() = 0;
+	virtual const char* Name() = 0;
+
+	// the whole block at once; the result is malloc'ed
+	virtual bool Compress(const char* data, size_t size, char** compressed, size_t* compressedSize) = 0;
+
+	// reads the block starting at the current position of f piece by piece; ReadStream returns
+	// the number of bytes read, 0 at the end of the block, -1 on an error
+	virtual void* OpenStream(FILE* f) = 0;
+	virtual int ReadStream(void* stream, char* buffer, size_t size) = 0;
+	virtual void CloseStream(void* stream) = 0;
+
+	// the whole block at once; the result is malloc'ed, sizeHint is the uncompressed size at most
+	// if it is known (0 otherwise)
+	bool Decompress(FILE* f, size_t sizeHint, char** data, size_t* size);
+
+protected:
+	// makes room for at least one more byte of the decompressed block
+	static bool Grow(char** data, size_t* allocated, size_t size);
+};
+
+class Bzip2Codec : public BlockCodec
+{
+public:
+	Bzip2Codec(int blockSize100k=9);
+
+	int Codec();
+	const char* Name();
+
+	bool Compress(const char* data, size_t size, char** compressed, size_t* compressedSize);
+
+	void* OpenStream(FILE* f);
+	int ReadStream(void* stream, char* buffer, size_t size);
+	void CloseStream(void* stream);
+
+private:
+	int		_blockSize100k;
+};
+
+class DeflateCodec : public BlockCodec
+{
+public:
+	DeflateCodec(const string& dictionary, int level=9);
+
+	int Codec();
+	const char* Name();
+
+	bool Compress(const char* data, size_t size, char** compressed, size_t* compressedSize);
+
+	void* OpenStream(FILE* f);
+	int ReadStream(void* stream, char* buffer, size_t size);
+	void CloseStream(void* stream);
+
+private:
+	string	_dictionary;			// set before every block is compressed, may be empty
+	int		_level;
+};
+
+#endif
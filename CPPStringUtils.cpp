@@ -20,6 +20,11 @@
  *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdio.h>
+#include <ctype.h>
+#include <wctype.h>
+#include <algorithm>
+
 #include "CPPStringUtils.h"
 
 inline char    _to_lower(const char c)     {if (((unsigned char)c)<0x80) return tolower(c); else if (((unsigned char)c)>=0xc0 && ((unsigned char) c)<0xdf) return (unsigned char)c+0x20; else return c;};
@@ -113,7 +118,15 @@ std::string CPPStringUtils::to_utf8(const std::string source)
 std::string CPPStringUtils::to_utf8(const std::wstring source)
 {
 	string dest = string();
-	int length = source.length();
+	append_utf8(dest, source.data(), source.length());
+	
+	return dest;
+}
+
+void CPPStringUtils::append_utf8(std::string& dest, const wchar_t* source, int length)
+{
+	// mostly ascii, so this is a good guess for the size
+	dest.reserve(dest.length() + length + length/8);
 
 	for(int i=0; i<length; i++)
 	{
@@ -138,8 +151,6 @@ std::string CPPStringUtils::to_utf8(const std::wstring source)
 			dest += (0x80 | (c & 0x3f));
 		}
 	}
-	
-	return dest;
 }
 
 std::string CPPStringUtils::from_utf8(const std::string source)
@@ -196,9 +207,13 @@ std::string CPPStringUtils::from_utf8(const std::string source)
 }
 
 std::wstring CPPStringUtils::from_utf8w(const std::string source)
+{
+	return from_utf8w(source.data(), source.length());
+}
+
+std::wstring CPPStringUtils::from_utf8w(const char* source, int length)
 {
 	wstring dest = wstring();
-	int length = source.length();
 	
 	for(int i=0; i<length; i++)
 	{
@@ -557,6 +572,22 @@ std::string CPPStringUtils::tc2sc_utf8(string src)
 	return dst;
 }
 
+unsigned int CPPStringUtils::fnv_hash(const std::string& src, unsigned int hash)
+{
+	for (size_t i=0; i<src.length(); i++)
+		hash = (hash ^ (unsigned char) src[i]) * 16777619U;
+	
+	return hash;
+}
+
+unsigned int CPPStringUtils::fnv_hash(const std::wstring& src, unsigned int hash)
+{
+	for (size_t i=0; i<src.length(); i++)
+		hash = (hash ^ (unsigned int) src[i]) * 16777619U;
+	
+	return hash;
+}
+
 
 
 DBH::DBH(const wchar_t* arg)
@@ -34,8 +34,10 @@ public:
 	
 	static std::string to_utf8(const std::string source);
 	static std::string to_utf8(const std::wstring source);
+	static void append_utf8(std::string& dest, const wchar_t* source, int length);
 	static std::string from_utf8(const std::string source);
 	static std::wstring from_utf8w(const std::string source);
+	static std::wstring from_utf8w(const char* source, int length);
 	
 	static std::string to_lower(std::string src);
 	static std::wstring to_lower(std::wstring src);
@@ -51,6 +53,10 @@ public:
 	
 	static std::string exchange_diacritic_chars_utf8(string src);
 	static std::string tc2sc_utf8(string src);
+	
+	// FNV-1a; a hash of the previous parts can be passed to continue it
+	static unsigned int fnv_hash(const std::string& src, unsigned int hash = 2166136261U);
+	static unsigned int fnv_hash(const std::wstring& src, unsigned int hash = 2166136261U);
 };
 
 
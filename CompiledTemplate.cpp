@@ -0,0 +1,640 @@
+/*
+ *  CompiledTemplate.cpp
+ *  Wiki2Touch/wikisrvd
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "CompiledTemplate.h"
+#include "CPPStringUtils.h"
+
+// the params are marked in the skeleton with chars no text has
+#define TEMPLATE_MARKER 0x110000
+
+// the texts which leave the template to ExpandTemplates as it is, see CompiledTemplate()
+static const wchar_t* unsafeTexts[] = {L"<nowiki", L"<pre", L"<source", L"</nowiki", L"</pre", L"</source", L"<!--", 0x0};
+
+// the table helpers which make braces, those could pair with the text around a result
+static const wchar_t* braceHelpers[] = {L"{{((", L"{{))", L"{{(!", L"{{!)", L"<!", 0x0};
+
+// the same as WikiMarkupParser::RemoveComments; false if a comment has braces, they could be a param
+static bool RemoveComments(const wstring& text, wstring& result, bool* hasComments)
+{
+	int length = text.length();
+	int state = 0;
+
+	*hasComments = false;
+	result.reserve(length);
+
+	for (int i=0; i<length; i++)
+	{
+		wchar_t c = text[i];
+		if ( !c )
+			return false;
+
+		if ( state==0 )
+		{
+			if ( c=='<' && (i+3)<length && text[i+1]=='!' && text[i+2]=='-' && text[i+3]=='-' )
+			{
+				*hasComments = true;
+				state = 1;
+			}
+			else
+				result += c;
+		}
+		else
+		{
+			if ( c=='{' || c=='}' )
+				return false;
+
+			if ( c=='-' && (i+2)<length && text[i+1]=='-' && text[i+2]=='>' )
+			{
+				i += 2;
+				state = 0;
+			}
+		}
+	}
+
+	return true;
+}
+
+static bool StartsWith(const wstring& text, int start, int end, const wchar_t* prefix)
+{
+	while ( *prefix )
+	{
+		if ( start>=end || text[start]!=*prefix )
+			return false;
+
+		start++;
+		prefix++;
+	}
+
+	return true;
+}
+
+static bool Contains(const wstring& text, int start, int end, const wchar_t* what)
+{
+	size_t pos = text.find(what, start);
+	return pos!=wstring::npos && pos+wcslen(what)<=(size_t) end;
+}
+
+// adds a list to the end of another, the new end is returned
+static TEMPLATENODE** Append(TEMPLATENODE** last, TEMPLATENODE* nodes)
+{
+	*last = nodes;
+	while ( *last )
+		last = &(*last)->next;
+
+	return last;
+}
+
+CompiledTemplate::CompiledTemplate(const wstring& text)
+{
+	pthread_mutex_init(&_mutex, NULL);
+	_references = 1;
+
+	_text = text;
+	_nodes = CompileParams(text);
+	_calls = NULL;
+
+	// ExpandTemplates looks for the calls after the comments are gone, so this is done here too
+	wstring withoutComments;
+	bool usable = RemoveComments(text, withoutComments, &_hasComments);
+	for (int i=0; usable && unsafeTexts[i]; i++)
+		if ( withoutComments.find(unsafeTexts[i])!=wstring::npos )
+			usable = false;
+
+	if ( usable )
+	{
+		for (TEMPLATENODE* node=CompileParams(withoutComments); node; node=node->next)
+		{
+			if ( node->type==TEMPLATE_PARAM )
+			{
+				_skeleton += (wchar_t) (TEMPLATE_MARKER + _skeletonParams.size());
+				_skeletonParams.push_back(node);
+			}
+			else
+			{
+				for (size_t i=0; i<node->text.length(); i++)
+					if ( IsMarker(node->text[i]) )
+						usable = false;
+				_skeleton += node->text;
+			}
+		}
+	}
+
+	if ( usable )
+	{
+		TEMPLATENODE* calls;
+		bool hasCalls = false;
+		if ( CompileRegion(0, _skeleton.length(), &calls, &hasCalls) && hasCalls )
+			_calls = calls;
+	}
+
+	_skeleton = wstring();
+	_skeletonParams.clear();
+
+	_size = sizeof(CompiledTemplate) + _text.length()*sizeof(wchar_t);
+	for (size_t i=0; i<_allNodes.size(); i++)
+		_size += sizeof(TEMPLATENODE) + _allNodes[i]->text.length()*sizeof(wchar_t) + (_allNodes[i]->parts.size() + _allNodes[i]->params.size())*sizeof(void*);
+}
+
+CompiledTemplate::~CompiledTemplate()
+{
+	for (size_t i=0; i<_allNodes.size(); i++)
+		delete _allNodes[i];
+
+	pthread_mutex_destroy(&_mutex);
+}
+
+const wstring& CompiledTemplate::Text()
+{
+	return _text;
+}
+
+const TEMPLATENODE* CompiledTemplate::Nodes()
+{
+	return _nodes;
+}
+
+const TEMPLATENODE* CompiledTemplate::Calls()
+{
+	return _calls;
+}
+
+bool CompiledTemplate::HasComments()
+{
+	return _hasComments;
+}
+
+size_t CompiledTemplate::Size()
+{
+	return _size;
+}
+
+void CompiledTemplate::Retain()
+{
+	pthread_mutex_lock(&_mutex);
+	_references++;
+	pthread_mutex_unlock(&_mutex);
+}
+
+void CompiledTemplate::Release()
+{
+	pthread_mutex_lock(&_mutex);
+	int references = --_references;
+	pthread_mutex_unlock(&_mutex);
+
+	if ( !references )
+		delete this;
+}
+
+bool CompiledTemplate::IsPlain(const wstring& value)
+{
+	if ( value.empty() )
+		return true;
+
+	if ( value[0]=='!' || value[0]=='-' )
+		return false;
+
+	return value.find_first_of(L"{}[]|<>=")==wstring::npos;
+}
+
+bool CompiledTemplate::IsInert(const wstring& value)
+{
+	if ( value.empty() )
+		return true;
+
+	if ( value[0]=='!' || value[0]=='-' )
+		return false;
+
+	return value.find_first_of(L"{}<>")==wstring::npos;
+}
+
+bool CompiledTemplate::IsCommentSafe(const wstring& value)
+{
+	int length = value.length();
+	if ( !length )
+		return true;
+
+	if ( value[0]=='!' || value[0]=='-' || value[length-1]=='<' )
+		return false;
+
+	if ( length>1 && value[length-2]=='<' && value[length-1]=='!' )
+		return false;
+
+	return length<3 || value.compare(length-3, 3, L"<!-");
+}
+
+TEMPLATENODE* CompiledTemplate::NewNode(int type)
+{
+	TEMPLATENODE* node = new TEMPLATENODE;
+	node->type = type;
+	node->defaultValue = NULL;
+	node->plain = true;
+	node->adjacent = false;
+	node->call = NULL;
+	node->next = NULL;
+
+	_allNodes.push_back(node);
+
+	return node;
+}
+
+// splits the text like WikiMarkupParser::ExpandTemplate replaces the params, the defaults are split too
+TEMPLATENODE* CompiledTemplate::CompileParams(const wstring& text)
+{
+	TEMPLATENODE* first = NULL;
+	TEMPLATENODE** last = &first;
+
+	size_t length = text.length();
+	size_t literal = 0;
+	size_t start = 0;
+	while ( (start=text.find(L"{{{", start))!=string::npos )
+	{
+		start += 3;
+
+		while ( start<length && text[start]==L'{' )
+			start++;
+
+		size_t end = start;
+		int braketCount = 3;
+		while ( braketCount && end<length )
+		{
+			wchar_t c = text[end];
+
+			if ( c=='{' )
+				braketCount++;
+			else if ( c=='}' )
+				braketCount--;
+
+			if ( (braketCount<3) && c!=L'}' )
+				break;
+
+			end++;
+		}
+
+		if ( braketCount )
+		{
+			// left as it is, like the parser does
+			start = end;
+			continue;
+		}
+
+		if ( start-3>literal )
+		{
+			TEMPLATENODE* node = NewNode(TEMPLATE_TEXT);
+			node->text = text.substr(literal, start-3-literal);
+			last = Append(last, node);
+		}
+
+		wstring paramName = CPPStringUtils::trim(text.substr(start, end-start-3));
+		wstring alternateValue;
+
+		size_t spliterPos = paramName.find(L"|");
+		if ( spliterPos!=string::npos )
+		{
+			alternateValue = paramName.substr(spliterPos+1);
+			paramName = CPPStringUtils::trim(paramName.substr(0, spliterPos));
+		}
+
+		TEMPLATENODE* node = NewNode(TEMPLATE_PARAM);
+		node->text = paramName;
+		if ( !alternateValue.empty() )
+		{
+			node->defaultValue = CompileParams(alternateValue);
+			for (TEMPLATENODE* help=node->defaultValue; help; help=help->next)
+				if ( help->type==TEMPLATE_TEXT && !IsPlain(help->text) )
+					node->plain = false;
+		}
+		last = Append(last, node);
+
+		literal = start = end;
+	}
+
+	if ( literal<length )
+	{
+		TEMPLATENODE* node = NewNode(TEMPLATE_TEXT);
+		node->text = text.substr(literal);
+		Append(last, node);
+	}
+
+	return first;
+}
+
+// a part of the skeleton as text and params
+TEMPLATENODE* CompiledTemplate::CompileText(int start, int end)
+{
+	TEMPLATENODE* first = NULL;
+	TEMPLATENODE** last = &first;
+
+	int literal = start;
+	for (int pos=start; pos<end; pos++)
+	{
+		if ( !IsMarker(_skeleton[pos]) )
+			continue;
+
+		if ( pos>literal )
+		{
+			TEMPLATENODE* node = NewNode(TEMPLATE_TEXT);
+			node->text = _skeleton.substr(literal, pos-literal);
+			last = Append(last, node);
+		}
+
+		const TEMPLATENODE* param = _skeletonParams[_skeleton[pos]-TEMPLATE_MARKER];
+
+		TEMPLATENODE* node = NewNode(TEMPLATE_PARAM);
+		node->text = param->text;
+		node->defaultValue = param->defaultValue;
+		node->plain = param->plain;
+		node->adjacent = IsAdjacent(pos);
+		last = Append(last, node);
+
+		literal = pos + 1;
+	}
+
+	if ( end>literal )
+	{
+		TEMPLATENODE* node = NewNode(TEMPLATE_TEXT);
+		node->text = _skeleton.substr(literal, end-literal);
+		Append(last, node);
+	}
+
+	return first;
+}
+
+// looks for the calls like WikiMarkupParser::ExpandTemplates does, false if one isn't closed
+bool CompiledTemplate::CompileRegion(int start, int end, TEMPLATENODE** nodes, bool* hasCalls)
+{
+	*nodes = NULL;
+	TEMPLATENODE** last = nodes;
+
+	int literal = start;
+	int pos = start;
+	while ( pos<end )
+	{
+		if ( _skeleton[pos]!='{' || pos+1>=end || _skeleton[pos+1]!='{' )
+		{
+			pos++;
+			continue;
+		}
+
+		int callEnd = pos + 2;
+		int brakedCount = 2;
+		while ( callEnd<end )
+		{
+			if ( _skeleton[callEnd]=='{' )
+				brakedCount++;
+			else if ( _skeleton[callEnd]=='}' )
+			{
+				brakedCount--;
+				if ( !brakedCount )
+				{
+					callEnd++;
+					break;
+				}
+			}
+
+			callEnd++;
+		}
+
+		if ( brakedCount )
+			return false;
+
+		TEMPLATENODE* node = CompileCall(pos, callEnd);
+		if ( node )
+		{
+			last = Append(last, CompileText(literal, pos));
+			last = Append(last, node);
+
+			literal = callEnd;
+			*hasCalls = true;
+		}
+
+		pos = callEnd;
+	}
+
+	Append(last, CompileText(literal, end));
+
+	return true;
+}
+
+// a parser function which can be done in place, NULL if it's none or the result could mix with the text around it
+TEMPLATENODE* CompiledTemplate::CompileCall(int start, int end)
+{
+	int textStart = start + 2;
+	int textEnd = end - 2;
+
+	int type;
+	int keywordLength;
+	if ( StartsWith(_skeleton, textStart, textEnd, L"#if:") )
+	{
+		type = TEMPLATE_IF;
+		keywordLength = 4;
+	}
+	else if ( StartsWith(_skeleton, textStart, textEnd, L"#ifeq:") )
+	{
+		type = TEMPLATE_IFEQ;
+		keywordLength = 6;
+	}
+	else if ( StartsWith(_skeleton, textStart, textEnd, L"#ifexist:") )
+	{
+		type = TEMPLATE_IFEXIST;
+		keywordLength = 9;
+	}
+	else if ( StartsWith(_skeleton, textStart, textEnd, L"#switch:") )
+	{
+		type = TEMPLATE_SWITCH;
+		keywordLength = 8;
+	}
+	else
+		return NULL;
+
+	if ( start>0 && wcschr(L"</!-{}", _skeleton[start-1]) )
+		return NULL;
+
+	if ( end<(int) _skeleton.length() && (_skeleton[end]=='{' || _skeleton[end]=='}') )
+		return NULL;
+
+	if ( InsideTagName(start) )
+		return NULL;
+
+	// the pipes like WikiMarkupParser::PosOfNextParamPipe finds them
+	vector<int> pipes;
+	int openCurlyBrakets = 0;
+	int openSquareBrakets = 0;
+	for (int pos=textStart; pos<textEnd; pos++)
+	{
+		switch ( _skeleton[pos] )
+		{
+			case L'|':
+				if ( !openCurlyBrakets && !openSquareBrakets )
+					pipes.push_back(pos);
+				break;
+
+			case L'[':
+				openSquareBrakets++;
+				break;
+
+			case L']':
+				openSquareBrakets--;
+				break;
+
+			case L'{':
+				openCurlyBrakets++;
+				break;
+
+			case L'}':
+				openCurlyBrakets--;
+				break;
+		}
+	}
+	pipes.push_back(textEnd);
+
+	TEMPLATENODE* node = NewNode(type);
+	node->parts.push_back(CompileText(textStart + keywordLength, pipes[0]));
+
+	TEMPLATENODE* result;
+	switch ( type )
+	{
+		case TEMPLATE_IF:
+		case TEMPLATE_IFEXIST:
+			for (size_t i=0; i<2 && i+1<pipes.size(); i++)
+			{
+				if ( !CompileResult(pipes[i] + 1, i ? textEnd : pipes[i+1], &result) )
+					return NULL;
+				node->parts.push_back(result);
+			}
+			break;
+
+		case TEMPLATE_IFEQ:
+			if ( pipes.size()>1 )
+				node->parts.push_back(CompileText(pipes[0] + 1, pipes[1]));
+
+			for (size_t i=1; i<3 && i+1<pipes.size(); i++)
+			{
+				if ( !CompileResult(pipes[i] + 1, i==2 ? textEnd : pipes[i+1], &result) )
+					return NULL;
+				node->parts.push_back(result);
+			}
+			break;
+
+		case TEMPLATE_SWITCH:
+			for (size_t i=0; i+1<pipes.size(); i++)
+			{
+				int caseStart = pipes[i] + 1;
+				int caseEnd = pipes[i+1];
+
+				TEMPLATENODE* caseNode = NewNode(TEMPLATE_CASE);
+
+				int equalPos = caseStart;
+				while ( equalPos<caseEnd && _skeleton[equalPos]!='=' )
+					equalPos++;
+
+				if ( equalPos<caseEnd )
+				{
+					caseNode->parts.push_back(CompileText(caseStart, equalPos));
+					if ( !CompileResult(equalPos + 1, caseEnd, &result) )
+						return NULL;
+					caseNode->parts.push_back(result);
+				}
+				else
+					caseNode->parts.push_back(CompileText(caseStart, caseEnd));
+
+				node->parts.push_back(caseNode);
+			}
+			break;
+	}
+
+	node->call = CompileText(start, end);
+	CollectParams(node->call, node->params);
+
+	return node;
+}
+
+// a value of a parser function, false if it can't replace the call without changing the text around it
+bool CompiledTemplate::CompileResult(int start, int end, TEMPLATENODE** nodes)
+{
+	int depth = 0;
+	for (int pos=start; pos<end; pos++)
+	{
+		if ( _skeleton[pos]=='{' )
+			depth++;
+		else if ( _skeleton[pos]=='}' && --depth<0 )
+			return false;
+	}
+
+	if ( depth )
+		return false;
+
+	for (int i=0; braceHelpers[i]; i++)
+		if ( Contains(_skeleton, start, end, braceHelpers[i]) )
+			return false;
+
+	int last = end - 1;
+	while ( last>=start && _skeleton[last]<=0x20 )
+		last--;
+
+	if ( last>=start && (wcschr(L"</!-", _skeleton[last]) || InsideTagName(last + 1)) )
+		return false;
+
+	bool hasCalls = false;
+	return CompileRegion(start, end, nodes, &hasCalls);
+}
+
+void CompiledTemplate::CollectParams(const TEMPLATENODE* node, vector<const TEMPLATENODE*>& params)
+{
+	for (; node; node=node->next)
+	{
+		if ( node->type==TEMPLATE_PARAM )
+		{
+			params.push_back(node);
+			CollectParams(node->defaultValue, params);
+		}
+	}
+}
+
+bool CompiledTemplate::IsMarker(wchar_t c)
+{
+	return c>=TEMPLATE_MARKER;
+}
+
+// if the text in front of pos is the start of a tag name; params count as letters
+bool CompiledTemplate::InsideTagName(int pos)
+{
+	pos--;
+	while ( pos>=0 && ((_skeleton[pos]>='a' && _skeleton[pos]<='z') || (_skeleton[pos]>='A' && _skeleton[pos]<='Z') || IsMarker(_skeleton[pos])) )
+		pos--;
+
+	if ( pos<0 )
+		return false;
+
+	return _skeleton[pos]=='<' || (_skeleton[pos]=='/' && pos>0 && _skeleton[pos-1]=='<');
+}
+
+// a param which may turn into a brace, a tag or a comment with the text around it even if it's empty
+bool CompiledTemplate::IsAdjacent(int pos)
+{
+	if ( pos>0 && wcschr(L"</!-{}", _skeleton[pos-1]) )
+		return true;
+
+	if ( pos+1<(int) _skeleton.length() && (_skeleton[pos+1]=='{' || _skeleton[pos+1]=='}') )
+		return true;
+
+	return InsideTagName(pos);
+}
@@ -0,0 +1,122 @@
+/*
+ *  CompiledTemplate.h
+ *  Wiki2Touch/wikisrvd
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMPILEDTEMPLATE_H
+#define COMPILEDTEMPLATE_H
+
+#include <wchar.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+using namespace std;
+
+// the kinds of nodes
+#define TEMPLATE_TEXT		0
+#define TEMPLATE_PARAM		1
+#define TEMPLATE_IF			2
+#define TEMPLATE_IFEQ		3
+#define TEMPLATE_IFEXIST	4
+#define TEMPLATE_SWITCH		5
+#define TEMPLATE_CASE		6
+
+typedef struct tagTEMPLATENODE
+{
+	int		type;
+	wstring	text;								// text: the text, param: the name
+
+	tagTEMPLATENODE* defaultValue;				// param: used if there's no value, NULL if there's none
+	bool	plain;								// param: the default has no markup, see IsPlain
+	bool	adjacent;							// param: the text around it may turn even a plain value into markup
+
+	// #if, #ifexist: condition, true and false value; #ifeq: left, right, true and false value;
+	// #switch: phrase and the cases; case: the name and the value or only the name
+	vector<tagTEMPLATENODE*> parts;
+	vector<const tagTEMPLATENODE*> params;		// all params of a parser function, defaults included
+	tagTEMPLATENODE* call;						// the parser function as text, if it can't be done in place
+
+	tagTEMPLATENODE* next;
+} TEMPLATENODE;
+
+/*
+ A template as it is used for every call of it: the text is split into literal runs and the params,
+ so they are filled in without searching the text again. If it's safe the #if, #ifeq, #ifexist and
+ #switch calls of the template are compiled too and done in place with the values of the call.
+ Nodes() gives exactly what replacing the params in the text gives, Calls() the same with the
+ parser functions done, but only if nothing the values contain (see IsPlain and IsInert) changes
+ what the text would turn into; the parser checks that while it goes and falls back otherwise.
+ It's shared by the threads, so it's counted and freed by the last Release.
+ */
+class CompiledTemplate
+{
+public:
+	CompiledTemplate(const wstring& text);
+
+	const wstring& Text();
+	const TEMPLATENODE* Nodes();
+	const TEMPLATENODE* Calls();				// NULL if there is no parser function to do
+	bool HasComments();
+	size_t Size();
+
+	void Retain();
+	void Release();
+
+	// values with none of the chars which change how the calls are split
+	static bool IsPlain(const wstring& value);
+
+	// values which can't start or end a call or a tag
+	static bool IsInert(const wstring& value);
+
+	// values which can't start a comment with the text around them
+	static bool IsCommentSafe(const wstring& value);
+
+private:
+	~CompiledTemplate();
+
+	wstring	_text;
+	TEMPLATENODE* _nodes;
+	TEMPLATENODE* _calls;
+	bool	_hasComments;
+	size_t	_size;
+
+	vector<TEMPLATENODE*> _allNodes;			// the nodes are shared by the lists, freed at once
+
+	pthread_mutex_t _mutex;
+	int		_references;
+
+	// the text with a marker for every param, used to find the parser functions
+	wstring	_skeleton;
+	vector<TEMPLATENODE*> _skeletonParams;
+
+	TEMPLATENODE* NewNode(int type);
+	TEMPLATENODE* CompileParams(const wstring& text);
+	TEMPLATENODE* CompileText(int start, int end);
+	bool CompileRegion(int start, int end, TEMPLATENODE** nodes, bool* hasCalls);
+	TEMPLATENODE* CompileCall(int start, int end);
+	bool CompileResult(int start, int end, TEMPLATENODE** nodes);
+	void CollectParams(const TEMPLATENODE* node, vector<const TEMPLATENODE*>& params);
+
+	bool IsMarker(wchar_t c);
+	bool InsideTagName(int pos);
+	bool IsAdjacent(int pos);
+};
+
+#endif
@@ -0,0 +1,118 @@
+/*
+ *  ExpansionCache.cpp
+ *  Wiki2Touch/wikisrvd
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+
+#include "ExpansionCache.h"
+#include "CPPStringUtils.h"
+
+ExpansionCache::ExpansionCache(size_t memory)
+{
+	_cache = new EXPANSIONCACHE(memory, EXPANSION_CACHE_SHARDS);
+}
+
+ExpansionCache::~ExpansionCache()
+{
+	delete _cache;
+}
+
+unsigned int ExpansionCache::Hash(const string& languageCode, const wstring& call)
+{
+	return CPPStringUtils::fnv_hash(languageCode, CPPStringUtils::fnv_hash(call));
+}
+
+bool ExpansionCache::GetExpansion(const string& languageCode, const wstring& call, const wchar_t* pageName, wstring& text, int* dependencies)
+{
+	bool found = false;
+
+	EXPANSIONCACHE::SHARD* shard = _cache->Lock(Hash(languageCode, call));
+	EXPANSIONCACHE::ENTRY* entry = _cache->Find(shard, pair<string, wstring>(languageCode, call));
+
+	// the same call on another page has to be expanded again
+	if ( entry && (!(entry->value.dependencies & EXPANSION_DEPENDS_ON_PAGE) || entry->value.pageName==(pageName ? pageName : L"")) )
+	{
+		text = entry->value.text;
+		*dependencies = entry->value.dependencies;
+		_cache->MakeNewest(shard, entry);
+		found = true;
+	}
+	_cache->Unlock(shard);
+
+	_cache->Count(found ? CACHE_HITS : CACHE_MISSES);
+
+	return found;
+}
+
+void ExpansionCache::AddExpansion(const string& languageCode, const wstring& call, const wchar_t* pageName, const wstring& text, int dependencies)
+{
+	if ( dependencies & EXPANSION_DEPENDS_ON_TIME )
+	{
+		_cache->Count(CACHE_OTHER);
+		return;
+	}
+
+	wstring page;
+	if ( (dependencies & EXPANSION_DEPENDS_ON_PAGE) && pageName )
+		page = pageName;
+
+	size_t size = sizeof(EXPANSIONCACHE::ENTRY) + languageCode.length() + (call.length() + page.length() + text.length())*sizeof(wchar_t);
+	if ( !_cache->Fits(size) )
+		return;
+
+	pair<string, wstring> key(languageCode, call);
+
+	EXPANSIONCACHE::SHARD* shard = _cache->Lock(Hash(languageCode, call));
+
+	// one of another page is replaced, the same one may have been added by another thread
+	EXPANSIONCACHE::ENTRY* entry = _cache->Find(shard, key);
+	if ( entry )
+	{
+		if ( !(entry->value.dependencies & EXPANSION_DEPENDS_ON_PAGE) || entry->value.pageName==page )
+		{
+			_cache->Unlock(shard);
+			return;
+		}
+
+		_cache->Remove(shard, entry);
+	}
+
+	CACHEDEXPANSION cachedExpansion;
+	cachedExpansion.pageName = page;
+	cachedExpansion.text = text;
+	cachedExpansion.dependencies = dependencies;
+
+	_cache->Add(shard, key, cachedExpansion, size);
+	_cache->Unlock(shard);
+}
+
+string ExpansionCache::GetStatistics()
+{
+	long long counters[CACHE_COUNTERS];
+	int expansions;
+	size_t size;
+	_cache->GetStatistics(counters, &expansions, &size);
+
+	char buffer[256];
+	snprintf(buffer, sizeof(buffer), "expansionHits:%lld\nexpansionMisses:%lld\nexpansionEvictions:%lld\nexpansionsUncacheable:%lld\nexpansionsCached:%d\nexpansionCacheSize:%lu", counters[CACHE_HITS], counters[CACHE_MISSES], counters[CACHE_EVICTIONS], counters[CACHE_OTHER], expansions, (unsigned long) size);
+
+	return string(buffer);
+}
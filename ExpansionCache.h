@@ -0,0 +1,73 @@
+/*
+ *  ExpansionCache.h
+ *  Wiki2Touch/wikisrvd
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EXPANSIONCACHE_H
+#define EXPANSIONCACHE_H
+
+#include <string>
+using namespace std;
+
+#include "ShardedCache.h"
+
+// memory for expanded template calls if nothing else is given
+#define DEFAULT_EXPANSION_CACHE_MEMORY (2048*1024)
+
+// the cache is split so lookups of different calls don't wait for each other
+#define EXPANSION_CACHE_SHARDS 8
+
+// what an expansion used besides the call itself and the templates
+#define EXPANSION_DEPENDS_ON_PAGE	1		// PAGENAME and friends, only valid for the same page
+#define EXPANSION_DEPENDS_ON_TIME	2		// CURRENTDAY and friends, never kept
+
+typedef struct
+{
+	wstring	pageName;					// only set if it depends on the page
+	wstring	text;						// the call with all templates in it expanded
+	int		dependencies;
+} CACHEDEXPANSION;
+
+typedef ShardedCache<pair<string, wstring>, CACHEDEXPANSION> EXPANSIONCACHE;
+
+/*
+ Keeps the results of template calls, i.e. the text between {{ and }} with the template and the
+ arguments as written in the article, shared by all threads. A call which used the name of the page
+ is only found again for the same page, one which used the time is not kept at all.
+ */
+class ExpansionCache
+{
+public:
+	ExpansionCache(size_t memory=DEFAULT_EXPANSION_CACHE_MEMORY);
+	~ExpansionCache();
+
+	// dependencies gets what the found expansion used, the caller depends on that as well
+	bool GetExpansion(const string& languageCode, const wstring& call, const wchar_t* pageName, wstring& text, int* dependencies);
+	void AddExpansion(const string& languageCode, const wstring& call, const wchar_t* pageName, const wstring& text, int dependencies);
+
+	string GetStatistics();
+
+private:
+	EXPANSIONCACHE* _cache;
+
+	unsigned int Hash(const string& languageCode, const wstring& call);
+};
+
+#endif
@@ -20,26 +20,13 @@
  *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "ArchiveFormat.h"
 #include "ImageIndex.h"
 #include "CPPStringUtils.h"
 
 const char* IMAGES_DATA_NAME = "images";
 const char* IMAGES_DATA_EXTENSION = ".bin";
 
-#define SIZEOF_POSITION_INFORMATION 16
-
-#pragma pack(1)
-typedef struct 
-{
-	char languageCode[2];
-	unsigned int numberOfImages;
-	
-	fpos_t	titlesPos;
-	fpos_t	indexPos;
-	char reserved[10];
-} IMAGEFILEHEADER;
-#pragma pack (pop)
-
 ImageIndex::ImageIndex(string pathToDataFile)
 {
 	_dataFileName = pathToDataFile;
@@ -0,0 +1,283 @@
+/*
+ *  OutputBuffer.cpp
+ *  Wiki2Touch/wikisrvd
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "OutputBuffer.h"
+
+OutputBuffer::OutputBuffer()
+{
+	_chunked = false;
+	_reserved = 0;
+
+	_closedLength = 0;
+	_current = NULL;
+	_end = NULL;
+}
+
+OutputBuffer::~OutputBuffer()
+{
+	Release();
+}
+
+void OutputBuffer::SetChunked(bool chunked)
+{
+	// only before anything is written
+	if ( _chunks.empty() )
+		_chunked = chunked;
+}
+
+void OutputBuffer::Reserve(int length)
+{
+	_reserved = length;
+
+	if ( !_chunked && _chunks.size()==1 && _chunks[0].size<length )
+	{
+		Sync();
+		Grow(length - _chunks[0].length);
+	}
+}
+
+void OutputBuffer::Clear()
+{
+	if ( !_chunked && _chunks.size()==1 )
+	{
+		// the buffer is used again
+		_chunks[0].length = 0;
+		_current = _chunks[0].data;
+	}
+	else
+		Release();
+}
+
+void OutputBuffer::Append(const wchar_t* text)
+{
+	if ( text )
+		Append(text, wcslen(text));
+}
+
+void OutputBuffer::Append(const wchar_t* text, int length)
+{
+	while ( length>0 )
+	{
+		if ( _current==_end )
+			Grow(length);
+
+		int count = min(length, (int) (_end - _current));
+		wmemcpy(_current, text, count);
+
+		_current += count;
+		text += count;
+		length -= count;
+	}
+}
+
+void OutputBuffer::Insert(int position, const wchar_t* text, int length)
+{
+	if ( position>=Length() )
+	{
+		Append(text, length);
+		return;
+	}
+
+	if ( length<=0 )
+		return;
+
+	if ( !_chunked )
+	{
+		if ( _end - _current<length )
+			Grow(length);
+
+		wchar_t* data = _chunks[0].data;
+		wmemmove(data + position + length, data + position, (_current - data) - position);
+		wmemcpy(data + position, text, length);
+		_current += length;
+
+		return;
+	}
+
+	Sync();
+
+	// the text gets a chunk of its own, the one it goes into is split
+	int index = 0;
+	int offset = 0;
+	while ( offset + _chunks[index].length<=position )
+		offset += _chunks[index++].length;
+
+	OUTPUTCHUNK chunk;
+	chunk.data = (wchar_t*) malloc((length+1)*sizeof(wchar_t));
+	wmemcpy(chunk.data, text, length);
+	chunk.length = length;
+	chunk.size = length;
+	chunk.owner = true;
+
+	if ( position>offset )
+	{
+		OUTPUTCHUNK tail;
+		tail.data = _chunks[index].data + (position - offset);
+		tail.length = _chunks[index].length - (position - offset);
+		tail.size = tail.length;
+		tail.owner = false;
+
+		_chunks[index].length = position - offset;
+		_chunks[index].size = position - offset;
+
+		index++;
+		_chunks.insert(_chunks.begin() + index, tail);
+	}
+
+	_chunks.insert(_chunks.begin() + index, chunk);
+
+	OUTPUTCHUNK& last = _chunks.back();
+	_current = last.data + last.length;
+	_end = last.data + last.size;
+
+	_closedLength = 0;
+	for (size_t i=0; i<_chunks.size()-1; i++)
+		_closedLength += _chunks[i].length;
+}
+
+int OutputBuffer::Length()
+{
+	if ( _chunks.empty() )
+		return 0;
+
+	return _closedLength + (_current - _chunks.back().data);
+}
+
+const wchar_t* OutputBuffer::Text()
+{
+	if ( _chunks.empty() )
+		Grow(0);
+
+	if ( _chunks.size()>1 )
+	{
+		// join the chunks, the text isn't written anymore usually
+		int length = Length();
+		wchar_t* data = (wchar_t*) malloc((length+1)*sizeof(wchar_t));
+
+		Sync();
+		wchar_t* pos = data;
+		for (size_t i=0; i<_chunks.size(); i++)
+		{
+			wmemcpy(pos, _chunks[i].data, _chunks[i].length);
+			pos += _chunks[i].length;
+		}
+
+		Release();
+
+		OUTPUTCHUNK chunk;
+		chunk.data = data;
+		chunk.length = length;
+		chunk.size = length;
+		chunk.owner = true;
+		_chunks.push_back(chunk);
+
+		_current = data + length;
+		_end = _current;
+	}
+
+	// there is always room for it
+	*_current = 0x0;
+
+	return _chunks[0].data;
+}
+
+bool OutputBuffer::GetChunk(int index, const wchar_t** text, int* length)
+{
+	if ( index<0 || index>=(int) _chunks.size() )
+		return false;
+
+	Sync();
+	*text = _chunks[index].data;
+	*length = _chunks[index].length;
+
+	return true;
+}
+
+void OutputBuffer::Grow(int length)
+{
+	if ( _chunks.empty() )
+	{
+		OUTPUTCHUNK chunk;
+		chunk.size = max(max(length, _reserved), OUTPUT_MIN_SIZE);
+		chunk.data = (wchar_t*) malloc((chunk.size+1)*sizeof(wchar_t));
+		chunk.length = 0;
+		chunk.owner = true;
+		_chunks.push_back(chunk);
+
+		_current = chunk.data;
+		_end = chunk.data + chunk.size;
+
+		return;
+	}
+
+	Sync();
+	OUTPUTCHUNK& last = _chunks.back();
+
+	if ( !_chunked )
+	{
+		// doubling keeps the number of copies small
+		last.size = max(last.size*2, last.length + length);
+		last.data = (wchar_t*) realloc(last.data, (last.size+1)*sizeof(wchar_t));
+
+		_current = last.data + last.length;
+		_end = last.data + last.size;
+
+		return;
+	}
+
+	_closedLength += last.length;
+
+	OUTPUTCHUNK chunk;
+	chunk.size = max(max(min(last.size*2, OUTPUT_MAX_CHUNK), OUTPUT_MIN_SIZE), length);
+	chunk.data = (wchar_t*) malloc((chunk.size+1)*sizeof(wchar_t));
+	chunk.length = 0;
+	chunk.owner = true;
+	_chunks.push_back(chunk);
+
+	_current = chunk.data;
+	_end = chunk.data + chunk.size;
+}
+
+void OutputBuffer::Sync()
+{
+	if ( !_chunks.empty() )
+		_chunks.back().length = _current - _chunks.back().data;
+}
+
+void OutputBuffer::Release()
+{
+	for (size_t i=0; i<_chunks.size(); i++)
+	{
+		if ( _chunks[i].owner )
+			free(_chunks[i].data);
+	}
+	_chunks.clear();
+
+	_closedLength = 0;
+	_current = NULL;
+	_end = NULL;
+}
@@ -0,0 +1,87 @@
+/*
+ *  OutputBuffer.h
+ *  Wiki2Touch/wikisrvd
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OUTPUTBUFFER_H
+#define OUTPUTBUFFER_H
+
+#include <wchar.h>
+#include <vector>
+using namespace std;
+
+// chars allocated for the first time if nothing was reserved
+#define OUTPUT_MIN_SIZE		8192
+
+// chunks don't get larger than this, the text of a larger append gets a chunk of its own
+#define OUTPUT_MAX_CHUNK	(256*1024)
+
+typedef struct
+{
+	wchar_t* data;
+	int		length;
+	int		size;						// chars which fit, without the terminating zero
+	bool	owner;						// false if it's the end of a split chunk
+} OUTPUTCHUNK;
+
+/*
+ The html written by the parser. Usually it's one buffer which doubles its size when it's full.
+ A chunked buffer instead adds new chunks and never moves what's written; its text is joined only
+ if Text() is used, GetChunk hands out the pieces.
+ */
+class OutputBuffer
+{
+public:
+	OutputBuffer();
+	~OutputBuffer();
+
+	void SetChunked(bool chunked);
+	void Reserve(int length);
+	void Clear();
+
+	void Append(wchar_t c)
+	{
+		if ( _current==_end )
+			Grow(1);
+		*_current++ = c;
+	}
+	void Append(const wchar_t* text);
+	void Append(const wchar_t* text, int length);
+	void Insert(int position, const wchar_t* text, int length);
+
+	int Length();
+	const wchar_t* Text();
+	bool GetChunk(int index, const wchar_t** text, int* length);
+
+private:
+	bool	_chunked;
+	int		_reserved;
+
+	vector<OUTPUTCHUNK> _chunks;
+	int		_closedLength;				// the chars in all chunks but the last one
+	wchar_t* _current;					// where the next char goes in the last chunk
+	wchar_t* _end;
+
+	void Grow(int length);
+	void Sync();
+	void Release();
+};
+
+#endif
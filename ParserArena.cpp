@@ -0,0 +1,185 @@
+/*
+ *  ParserArena.cpp
+ *  Wiki2Touch/wikisrvd
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include "ParserArena.h"
+
+pthread_mutex_t ParserArena::_statisticsMutex = PTHREAD_MUTEX_INITIALIZER;
+long long ParserArena::_renders = 0;
+long long ParserArena::_totalAllocations = 0;
+long long ParserArena::_totalHeapAllocations = 0;
+long long ParserArena::_totalBytes = 0;
+long long ParserArena::_totalBlocks = 0;
+
+ParserArena::ParserArena()
+{
+	_current = NULL;
+	_end = NULL;
+	_last = NULL;
+
+	_allocations = 0;
+	_heapAllocations = 0;
+	_bytes = 0;
+}
+
+ParserArena::~ParserArena()
+{
+	for (size_t i=0; i<_blocks.size(); i++)
+		free(_blocks[i]);
+
+	pthread_mutex_lock(&_statisticsMutex);
+	_renders++;
+	_totalAllocations += _allocations;
+	_totalHeapAllocations += _heapAllocations;
+	_totalBytes += _bytes;
+	_totalBlocks += _blocks.size();
+	pthread_mutex_unlock(&_statisticsMutex);
+}
+
+void* ParserArena::Alloc(size_t size)
+{
+	if ( size>ARENA_LARGE_ALLOCATION )
+	{
+		_heapAllocations++;
+		return malloc(size);
+	}
+
+	// everything stays aligned for pointers and doubles
+	size = (size + 7) & ~((size_t) 7);
+
+	if ( !_current || (size_t) (_end - _current)<size )
+	{
+		_current = (char*) malloc(ARENA_BLOCK_SIZE);
+		_end = _current + ARENA_BLOCK_SIZE;
+		_blocks.insert(upper_bound(_blocks.begin(), _blocks.end(), _current), _current);
+	}
+
+	_last = _current;
+	_current += size;
+
+	_allocations++;
+	_bytes += size;
+
+	return _last;
+}
+
+wchar_t* ParserArena::Strdup(const wchar_t* src)
+{
+	if ( !src )
+		return NULL;
+
+	int length = wcslen(src);
+	wchar_t* dst = (wchar_t*) Alloc((length+1) * sizeof(wchar_t));
+	wmemcpy(dst, src, length+1);
+
+	return dst;
+}
+
+wchar_t* ParserArena::Strndup(const wchar_t* src, int count)
+{
+	if ( !src )
+		return NULL;
+
+	int length = 0;
+	while ( length<count && src[length] )
+		length++;
+
+	wchar_t* dst = (wchar_t*) Alloc((length+1) * sizeof(wchar_t));
+	wmemcpy(dst, src, length);
+	dst[length] = 0x0;
+
+	return dst;
+}
+
+wchar_t** ParserArena::Split(const wchar_t* src, wchar_t splitChar)
+{
+	if ( !src )
+		return NULL;
+
+	int count = 1;
+	int length = wcslen(src);
+	for (int i=0; i<length; i++)
+	{
+		if ( src[i]==splitChar )
+			count++;
+	}
+
+	// the list is followed by the parts
+	wchar_t** list = (wchar_t**) Alloc((count+1)*sizeof(wchar_t*) + (length+1)*sizeof(wchar_t));
+	wchar_t* dst = (wchar_t*) (list + count + 1);
+	wmemcpy(dst, src, length+1);
+
+	list[0] = dst;
+	int part = 1;
+	for (int i=0; i<length; i++)
+	{
+		if ( dst[i]==splitChar )
+		{
+			dst[i] = 0x0;
+			list[part++] = dst + i + 1;
+		}
+	}
+	list[count] = NULL;
+
+	return list;
+}
+
+void ParserArena::Free(const void* p)
+{
+	if ( !p )
+		return;
+
+	if ( p==_last )
+	{
+		// scratch which is freed right away, like a line while it's parsed
+		_current = _last;
+		_last = NULL;
+	}
+	else if ( !Owns(p) )
+		free((void*) p);
+}
+
+bool ParserArena::Owns(const void* p)
+{
+	// the last block starting in front of p
+	vector<char*>::iterator i = upper_bound(_blocks.begin(), _blocks.end(), (char*) p);
+	if ( i==_blocks.begin() )
+		return false;
+
+	i--;
+	return (char*) p<*i + ARENA_BLOCK_SIZE;
+}
+
+string ParserArena::GetStatistics()
+{
+	char buffer[256];
+
+	pthread_mutex_lock(&_statisticsMutex);
+	snprintf(buffer, sizeof(buffer), "parserRenders:%lld\narenaAllocations:%lld\narenaHeapAllocations:%lld\narenaBytes:%lld\narenaBlocks:%lld", _renders, _totalAllocations, _totalHeapAllocations, _totalBytes, _totalBlocks);
+	pthread_mutex_unlock(&_statisticsMutex);
+
+	return string(buffer);
+}
@@ -0,0 +1,80 @@
+/*
+ *  ParserArena.h
+ *  Wiki2Touch/wikisrvd
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PARSERARENA_H
+#define PARSERARENA_H
+
+#include <wchar.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+using namespace std;
+
+// the size of the blocks the small allocations are taken from
+#define ARENA_BLOCK_SIZE		(64*1024)
+
+// anything larger (mostly copies of the whole text) comes from the heap and is freed at once
+#define ARENA_LARGE_ALLOCATION	(16*1024)
+
+/*
+ The scratch memory of one render, shared by the parser of the article and all the parsers it
+ starts for parts of it. Allocations are cut from blocks which are only freed when the arena
+ goes, only the newest allocation is reused if it's freed again. Free takes any pointer: other
+ memory of the arena is left alone, everything else is freed, so it doesn't matter where a string
+ came from. The result of Split is one allocation, like a string.
+ */
+class ParserArena
+{
+public:
+	ParserArena();
+	~ParserArena();
+
+	void* Alloc(size_t size);
+	wchar_t* Strdup(const wchar_t* src);
+	wchar_t* Strndup(const wchar_t* src, int count);
+	wchar_t** Split(const wchar_t* src, wchar_t splitChar);
+	void Free(const void* p);
+
+	// counters of all the arenas which are gone
+	static string GetStatistics();
+
+private:
+	vector<char*> _blocks;				// sorted by address
+	char*	_current;
+	char*	_end;
+	char*	_last;						// the newest allocation, it's given back if it's freed first
+
+	long long _allocations;
+	long long _heapAllocations;
+	long long _bytes;
+
+	bool Owns(const void* p);
+
+	static pthread_mutex_t _statisticsMutex;
+	static long long _renders;
+	static long long _totalAllocations;
+	static long long _totalHeapAllocations;
+	static long long _totalBytes;
+	static long long _totalBlocks;
+};
+
+#endif
@@ -52,6 +52,13 @@ typedef struct tagIMAGEINDEX
 	tagIMAGEINDEX* next;
 } IMAGEINDEX;
 
+typedef struct tagTEMPLATEPACK
+{
+	string	languageCode;
+	TemplatePack* templatePack;
+	tagTEMPLATEPACK* next;
+} TEMPLATEPACK;
+
 Settings::Settings()
 {
 	_debug = false;
@@ -63,12 +70,24 @@ Settings::Settings()
 	_port = 8082;
 	_path = "~/Media/Wikipedia";
 	_webContentPath = "";
+	_titleIndexMemory = DEFAULT_FENCE_MEMORY;
+	_titleFilterMemory = DEFAULT_FILTER_MEMORY;
+	_blockCacheMemory = DEFAULT_BLOCK_CACHE_MEMORY;
+	_templateCacheMemory = DEFAULT_TEMPLATE_CACHE_MEMORY;
+	_expansionCacheMemory = DEFAULT_EXPANSION_CACHE_MEMORY;
+	_templateFiles = true;
+	_writeIndexFiles = false;
 	
 	// this is the default language
 	_defaultLanguageCode = "en";
 	
 	_languageConfigs = NULL;
 	_titleIndexes = NULL;
+	_templatePacks = NULL;
+	pthread_mutex_init(&_templatePacksMutex, NULL);
+	_blockCache = NULL;
+	_templateCache = NULL;
+	_expansionCache = NULL;
 }
 
 Settings::~Settings()
@@ -94,6 +113,25 @@ Settings::~Settings()
 		
 		delete(titleIndex);
 	}
+	
+	while ( _templatePacks )
+	{
+		TEMPLATEPACK* templatePack = (TEMPLATEPACK*) _templatePacks;
+		_templatePacks = templatePack->next;
+		
+		delete(templatePack->templatePack);
+		delete(templatePack);
+	}
+	pthread_mutex_destroy(&_templatePacksMutex);
+	
+	if ( _blockCache )
+		delete(_blockCache);
+	
+	if ( _templateCache )
+		delete(_templateCache);
+	
+	if ( _expansionCache )
+		delete(_expansionCache);
 }
 
 bool Settings::Init(int argc, char *argv[])
@@ -138,6 +176,94 @@ bool Settings::Init(int argc, char *argv[])
 				_defaultLanguageCode = argv[i];
 			}
 		}
+		else if ( !strcmp(argv[i], "-m") ) 
+		{
+			if ( i<argc-1 )
+			{			
+				i++;
+				
+				// kilobytes kept in memory per title index, 0 turns the fences off
+				int kilobytes = atoi(argv[i]);
+				if ( kilobytes<0 ) 
+				{
+					printf("illegal index memory: %i\r\n", kilobytes);
+					return false;
+				}
+				_titleIndexMemory = (size_t) kilobytes * 1024;
+			}
+		}
+		else if ( !strcmp(argv[i], "-f") ) 
+		{
+			if ( i<argc-1 )
+			{			
+				i++;
+				
+				// kilobytes for a title filter built at startup, 0 turns it off (if there is no index file)
+				int kilobytes = atoi(argv[i]);
+				if ( kilobytes<0 ) 
+				{
+					printf("illegal filter memory: %i\r\n", kilobytes);
+					return false;
+				}
+				_titleFilterMemory = (size_t) kilobytes * 1024;
+			}
+		}
+		else if ( !strcmp(argv[i], "-c") ) 
+		{
+			if ( i<argc-1 )
+			{			
+				i++;
+				
+				// kilobytes for the decompressed blocks of the archives, 0 turns the cache off
+				int kilobytes = atoi(argv[i]);
+				if ( kilobytes<0 ) 
+				{
+					printf("illegal block cache memory: %i\r\n", kilobytes);
+					return false;
+				}
+				_blockCacheMemory = (size_t) kilobytes * 1024;
+			}
+		}
+		else if ( !strcmp(argv[i], "-n") ) 
+		{
+			if ( i<argc-1 )
+			{			
+				i++;
+				
+				// kilobytes for the templates, 0 turns the cache in memory off
+				int kilobytes = atoi(argv[i]);
+				if ( kilobytes<0 ) 
+				{
+					printf("illegal template cache memory: %i\r\n", kilobytes);
+					return false;
+				}
+				_templateCacheMemory = (size_t) kilobytes * 1024;
+			}
+		}
+		else if ( !strcmp(argv[i], "-e") ) 
+		{
+			if ( i<argc-1 )
+			{			
+				i++;
+				
+				// kilobytes for expanded template calls, 0 turns the cache off
+				int kilobytes = atoi(argv[i]);
+				if ( kilobytes<0 ) 
+				{
+					printf("illegal expansion cache memory: %i\r\n", kilobytes);
+					return false;
+				}
+				_expansionCacheMemory = (size_t) kilobytes * 1024;
+			}
+		}
+		else if ( !strcmp(argv[i], "-w") || !strcmp(argv[i], "-w+") ) 
+			_templateFiles = true;
+		else if ( !strcmp(argv[i], "-w-") ) 
+			_templateFiles = false;
+		else if ( !strcmp(argv[i], "-x") || !strcmp(argv[i], "-x+") ) 
+			_writeIndexFiles = true;
+		else if ( !strcmp(argv[i], "-x-") ) 
+			_writeIndexFiles = false;
 		else if ( !strcmp(argv[i], "-t") || !strcmp(argv[i], "-t+") ) 
 			_expandTemplates = true;
 		else if ( !strcmp(argv[i], "-t-") ) 
@@ -152,6 +278,11 @@ bool Settings::Init(int argc, char *argv[])
 		i++;
 	}
 
+	// shared by all threads, so it has to exist before the first request
+	_blockCache = new BlockCache(_blockCacheMemory);
+	_templateCache = new TemplateCache(_templateCacheMemory);
+	_expansionCache = new ExpansionCache(_expansionCacheMemory);
+
 	if ( _path.empty() )
 		_path = string("~/Media/Wikipedia");
 
@@ -214,10 +345,6 @@ bool Settings::Init(int argc, char *argv[])
 					}
 					else
 						_installedLanguages += string(",") + string(dirbuf->d_name);
-					
-					// create the cache dir (anyway, either it is existing or not)
-					string cache = _path + dirbuf->d_name + "/cache"; 
-					mkdir(cache.c_str(), S_IRWXU | S_IRWXG | S_IRWXO);
 				}
 			}
 		}
@@ -265,6 +392,36 @@ bool Settings::Debug()
 	return _debug;
 }
 
+size_t Settings::TitleIndexMemory()
+{
+	return _titleIndexMemory;
+}
+
+size_t Settings::TitleFilterMemory()
+{
+	return _titleFilterMemory;
+}
+
+size_t Settings::BlockCacheMemory()
+{
+	return _blockCacheMemory;
+}
+
+size_t Settings::TemplateCacheMemory()
+{
+	return _templateCacheMemory;
+}
+
+size_t Settings::ExpansionCacheMemory()
+{
+	return _expansionCacheMemory;
+}
+
+bool Settings::TemplateFiles()
+{
+	return _templateFiles;
+}
+
 bool Settings::ExpandTemplates()
 {
 	return _expandTemplates;
@@ -362,9 +519,9 @@ TitleIndex* Settings::GetTitleIndex(string languageCode)
 	
 	// our "special" database is located here
 	if ( languageCode=="xx" )
-		titleIndex->titleIndex = new TitleIndex(_basePath + languageCode);
+		titleIndex->titleIndex = new TitleIndex(_basePath + languageCode, _titleIndexMemory, _titleFilterMemory);
 	else
-		titleIndex->titleIndex = new TitleIndex(Path() + languageCode);
+		titleIndex->titleIndex = new TitleIndex(Path() + languageCode, _titleIndexMemory, _titleFilterMemory);
 	
 	titleIndex->next = (TITLEINDEX*) _titleIndexes;
 	
@@ -373,6 +530,22 @@ TitleIndex* Settings::GetTitleIndex(string languageCode)
 	return titleIndex->titleIndex;
 }
 
+void Settings::WriteIndexFiles()
+{
+	// creates the missing index files before the server accepts requests, writing one reads all
+	// titles and would stall the first request of a language
+	if ( !_writeIndexFiles )
+		return;
+	
+	vector<string> languageCodes = LanguageCodes();
+	for (size_t i=0; i<languageCodes.size(); i++)
+	{
+		TitleIndex* titleIndex = GetTitleIndex(languageCodes[i]);
+		if ( titleIndex->NumberOfArticles()>0 && !titleIndex->HasIndexFile() )
+			titleIndex->WriteIndexFile();
+	}
+}
+
 ImageIndex* Settings::GetImageIndex(string languageCode)
 {
 	CPPStringUtils::to_lower(languageCode);
@@ -402,4 +575,93 @@ ImageIndex* Settings::GetImageIndex(string languageCode)
 	return imageIndex->imageIndex;
 }
 
+BlockCache* Settings::GetBlockCache()
+{
+	return _blockCache;
+}
+
+TemplateCache* Settings::GetTemplateCache()
+{
+	return _templateCache;
+}
+
+ExpansionCache* Settings::GetExpansionCache()
+{
+	return _expansionCache;
+}
+
+TemplatePack* Settings::GetTemplatePack(string languageCode)
+{
+	CPPStringUtils::to_lower(languageCode);
+	
+	// opened by the first template of a request, maybe by several threads at once
+	pthread_mutex_lock(&_templatePacksMutex);
+	
+	TEMPLATEPACK* templatePack = (TEMPLATEPACK*) _templatePacks;
+	while ( templatePack && templatePack->languageCode!=languageCode)
+		templatePack = templatePack->next;
+	
+	if ( !templatePack )
+	{
+		templatePack = new TEMPLATEPACK;
+		
+		templatePack->languageCode = languageCode;
+		templatePack->templatePack = new TemplatePack(Path() + languageCode + "/" + TEMPLATE_PACK_FILE_NAME);
+		
+		templatePack->next = (TEMPLATEPACK*) _templatePacks;
+		
+		_templatePacks = templatePack;
+	}
+	
+	pthread_mutex_unlock(&_templatePacksMutex);
+	
+	return templatePack->templatePack;
+}
+
+void Settings::OpenTemplatePacks()
+{
+	// enlarges the crowded template packs before the server accepts requests, a compaction rewrites
+	// the whole pack and would hold up every request which needs a template meanwhile
+	if ( !_templateFiles )
+		return;
+	
+	vector<string> languageCodes = LanguageCodes();
+	for (size_t i=0; i<languageCodes.size(); i++)
+	{
+		// a missing pack is created by the first template
+		string fileName = Path() + languageCodes[i] + "/" + TEMPLATE_PACK_FILE_NAME;
+		
+		struct stat statbuf;
+		if ( stat(fileName.c_str(), &statbuf) )
+			continue;
+		
+		TemplatePack* templatePack = new TemplatePack(fileName);
+		bool crowded = templatePack->Crowded();
+		delete templatePack;
+		
+		if ( crowded )
+			TemplatePack::Compact(fileName);
+		
+		GetTemplatePack(languageCodes[i]);
+	}
+}
+
+vector<string> Settings::LanguageCodes()
+{
+	vector<string> languageCodes;
+	
+	size_t pos = 0;
+	while ( pos<_installedLanguages.length() )
+	{
+		size_t nextPos = _installedLanguages.find(",", pos);
+		if ( nextPos==string::npos )
+			nextPos = _installedLanguages.length();
+		
+		languageCodes.push_back(_installedLanguages.substr(pos, nextPos - pos));
+		
+		pos = nextPos + 1;
+	}
+	
+	return languageCodes;
+}
 
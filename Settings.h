@@ -25,11 +25,17 @@
 
 #include <sys/types.h>
 #include <arpa/inet.h>
+#include <pthread.h>
 #include <string>
+#include <vector>
 
 #include "ConfigFile.h"
 #include "TitleIndex.h"
 #include "ImageIndex.h"
+#include "BlockCache.h"
+#include "TemplateCache.h"
+#include "ExpansionCache.h"
+#include "TemplatePack.h"
 
 using namespace std;
 
@@ -44,6 +50,12 @@ public:
 	bool Verbose();
 	bool Debug();
 	bool ExpandTemplates();
+	size_t TitleIndexMemory();
+	size_t TitleFilterMemory();
+	size_t BlockCacheMemory();
+	size_t TemplateCacheMemory();
+	size_t ExpansionCacheMemory();
+	bool TemplateFiles();
 	
 	in_addr_t Addr();
 	int Port();
@@ -59,7 +71,13 @@ public:
 	
 	ConfigFile* LanguageConfig(string languageCode);
 	TitleIndex* GetTitleIndex(string languageCode);
+	void WriteIndexFiles();
 	ImageIndex* GetImageIndex(string languageCode);
+	BlockCache* GetBlockCache();
+	TemplateCache* GetTemplateCache();
+	ExpansionCache* GetExpansionCache();
+	TemplatePack* GetTemplatePack(string languageCode);
+	void OpenTemplatePacks();
 	
 private:
 	bool _verbose;
@@ -73,10 +91,30 @@ private:
 	string _installedLanguages;
 	string _basePath;
 	string _webContentPath;
+	size_t _titleIndexMemory;
+	size_t _titleFilterMemory;
+	size_t _blockCacheMemory;
+	size_t _templateCacheMemory;
+	size_t _expansionCacheMemory;
+	bool _templateFiles;
+	bool _writeIndexFiles;
 	
 	void* _languageConfigs;
 	void* _titleIndexes;
 	void* _imageIndexes;
+	void* _templatePacks;
+	pthread_mutex_t _templatePacksMutex;
+	
+	// the decompressed blocks of all archives
+	BlockCache* _blockCache;
+	
+	// the templates of all languages
+	TemplateCache* _templateCache;
+	
+	// the expanded template calls of all languages
+	ExpansionCache* _expansionCache;
+	
+	vector<string> LanguageCodes();
 };
 
 extern Settings settings;
@@ -0,0 +1,251 @@
+/*
+ *  ShardedCache.h
+ *  Wiki2Touch/wikisrvd
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SHARDEDCACHE_H
+#define SHARDEDCACHE_H
+
+#include <pthread.h>
+#include <map>
+using namespace std;
+
+// the counters of a cache; the last one is left to the cache using it
+#define CACHE_HITS			0
+#define CACHE_MISSES		1
+#define CACHE_EVICTIONS		2
+#define CACHE_OTHER			3
+#define CACHE_COUNTERS		4
+
+/*
+ The memory cache behind the block, template and expansion caches: the entries are split into
+ shards so lookups of different keys don't wait for each other, each shard drops its least
+ recently used entries when it holds more bytes than its part of the memory. The caller computes
+ the hash of a key, locks its shard and does the lookups and changes before it unlocks it again.
+ The release function is called for every value which leaves the cache, with the shard locked.
+ */
+template <class Key, class Value>
+class ShardedCache
+{
+public:
+	typedef struct tagENTRY
+	{
+		Key		key;
+		Value	value;
+		size_t	size;					// the memory charged for it
+
+		tagENTRY* newer;				// the lru list of the shard
+		tagENTRY* older;
+	} ENTRY;
+
+	typedef struct
+	{
+		pthread_mutex_t mutex;
+		map<Key, ENTRY*> entries;
+		ENTRY*	newest;
+		ENTRY*	oldest;
+		size_t	size;
+	} SHARD;
+
+	typedef void (*ReleaseFunction)(Value* value);
+
+	ShardedCache(size_t memory, int numberOfShards, ReleaseFunction release=NULL)
+	{
+		_numberOfShards = numberOfShards;
+		_shardMemory = memory / numberOfShards;
+		_release = release;
+
+		_shards = new SHARD[numberOfShards];
+		for (int i=0; i<numberOfShards; i++)
+		{
+			pthread_mutex_init(&_shards[i].mutex, NULL);
+			_shards[i].newest = NULL;
+			_shards[i].oldest = NULL;
+			_shards[i].size = 0;
+		}
+
+		pthread_mutex_init(&_statisticsMutex, NULL);
+		for (int i=0; i<CACHE_COUNTERS; i++)
+			_counters[i] = 0;
+	}
+
+	~ShardedCache()
+	{
+		for (int i=0; i<_numberOfShards; i++)
+		{
+			while ( _shards[i].oldest )
+				Remove(&_shards[i], _shards[i].oldest);
+
+			pthread_mutex_destroy(&_shards[i].mutex);
+		}
+		delete[] _shards;
+
+		pthread_mutex_destroy(&_statisticsMutex);
+	}
+
+	// true if an entry of this size is kept
+	bool Fits(size_t size)
+	{
+		return size<=_shardMemory;
+	}
+
+	SHARD* Lock(unsigned int hash)
+	{
+		SHARD* shard = &_shards[hash % _numberOfShards];
+		pthread_mutex_lock(&shard->mutex);
+
+		return shard;
+	}
+
+	void Unlock(SHARD* shard)
+	{
+		pthread_mutex_unlock(&shard->mutex);
+	}
+
+	// NULL if it's not there; it doesn't count as used before MakeNewest
+	ENTRY* Find(SHARD* shard, const Key& key)
+	{
+		typename map<Key, ENTRY*>::iterator i = shard->entries.find(key);
+		if ( i==shard->entries.end() )
+			return NULL;
+
+		return i->second;
+	}
+
+	// the key must not be in the cache yet, older entries may be evicted for it
+	void Add(SHARD* shard, const Key& key, const Value& value, size_t size)
+	{
+		ENTRY* entry = new ENTRY;
+		entry->key = key;
+		entry->value = value;
+		entry->size = size;
+		entry->newer = NULL;
+		entry->older = NULL;
+
+		shard->entries[key] = entry;
+		shard->size += size;
+		MakeNewest(shard, entry);
+
+		Evict(shard);
+	}
+
+	// charges more memory for an entry, it may be evicted right away
+	void Grow(SHARD* shard, ENTRY* entry, size_t size)
+	{
+		entry->size += size;
+		shard->size += size;
+
+		Evict(shard);
+	}
+
+	void Remove(SHARD* shard, ENTRY* entry)
+	{
+		Unlink(shard, entry);
+		shard->entries.erase(entry->key);
+		shard->size -= entry->size;
+
+		if ( _release )
+			_release(&entry->value);
+
+		delete entry;
+	}
+
+	void MakeNewest(SHARD* shard, ENTRY* entry)
+	{
+		if ( shard->newest==entry )
+			return;
+
+		Unlink(shard, entry);
+
+		entry->older = shard->newest;
+		if ( shard->newest )
+			shard->newest->newer = entry;
+		shard->newest = entry;
+
+		if ( !shard->oldest )
+			shard->oldest = entry;
+	}
+
+	void Count(int counter, long long count=1)
+	{
+		pthread_mutex_lock(&_statisticsMutex);
+		_counters[counter] += count;
+		pthread_mutex_unlock(&_statisticsMutex);
+	}
+
+	void GetStatistics(long long counters[CACHE_COUNTERS], int* entries, size_t* size)
+	{
+		*entries = 0;
+		*size = 0;
+		for (int i=0; i<_numberOfShards; i++)
+		{
+			pthread_mutex_lock(&_shards[i].mutex);
+			*entries += _shards[i].entries.size();
+			*size += _shards[i].size;
+			pthread_mutex_unlock(&_shards[i].mutex);
+		}
+
+		pthread_mutex_lock(&_statisticsMutex);
+		for (int i=0; i<CACHE_COUNTERS; i++)
+			counters[i] = _counters[i];
+		pthread_mutex_unlock(&_statisticsMutex);
+	}
+
+private:
+	int		_numberOfShards;
+	size_t	_shardMemory;
+	SHARD*	_shards;
+	ReleaseFunction _release;
+
+	pthread_mutex_t _statisticsMutex;
+	long long _counters[CACHE_COUNTERS];
+
+	void Unlink(SHARD* shard, ENTRY* entry)
+	{
+		if ( entry->newer )
+			entry->newer->older = entry->older;
+		else if ( shard->newest==entry )
+			shard->newest = entry->older;
+
+		if ( entry->older )
+			entry->older->newer = entry->newer;
+		else if ( shard->oldest==entry )
+			shard->oldest = entry->newer;
+
+		entry->newer = NULL;
+		entry->older = NULL;
+	}
+
+	void Evict(SHARD* shard)
+	{
+		int evictions = 0;
+
+		while ( shard->size>_shardMemory && shard->oldest )
+		{
+			Remove(shard, shard->oldest);
+			evictions++;
+		}
+
+		if ( evictions )
+			Count(CACHE_EVICTIONS, evictions);
+	}
+};
+
+#endif
@@ -0,0 +1,155 @@
+/*
+ *  TemplateCache.cpp
+ *  Wiki2Touch/wikisrvd
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+
+#include "TemplateCache.h"
+#include "CPPStringUtils.h"
+
+TemplateCache::TemplateCache(size_t memory)
+{
+	_cache = new TEMPLATECACHE(memory, TEMPLATE_CACHE_SHARDS, ReleaseTemplate);
+}
+
+TemplateCache::~TemplateCache()
+{
+	delete _cache;
+}
+
+unsigned int TemplateCache::Hash(const string& languageCode, const string& name)
+{
+	return CPPStringUtils::fnv_hash(languageCode, CPPStringUtils::fnv_hash(name));
+}
+
+bool TemplateCache::GetTemplate(const string& languageCode, const string& name, wstring& text)
+{
+	bool found = false;
+
+	TEMPLATECACHE::SHARD* shard = _cache->Lock(Hash(languageCode, name));
+	TEMPLATECACHE::ENTRY* entry = _cache->Find(shard, pair<string, string>(languageCode, name));
+	if ( entry )
+	{
+		text = entry->value.text;
+		_cache->MakeNewest(shard, entry);
+		found = true;
+	}
+	_cache->Unlock(shard);
+
+	_cache->Count(found ? CACHE_HITS : CACHE_MISSES);
+
+	return found;
+}
+
+void TemplateCache::AddTemplate(const string& languageCode, const string& name, const wstring& text)
+{
+	size_t size = sizeof(TEMPLATECACHE::ENTRY) + languageCode.length() + name.length() + text.length()*sizeof(wchar_t);
+	if ( !_cache->Fits(size) )
+		return;
+
+	pair<string, string> key(languageCode, name);
+
+	TEMPLATECACHE::SHARD* shard = _cache->Lock(Hash(languageCode, name));
+
+	// another thread may have added it in the meantime, it's the same text
+	if ( !_cache->Find(shard, key) )
+	{
+		CACHEDTEMPLATE cachedTemplate;
+		cachedTemplate.text = text;
+		cachedTemplate.compiled = NULL;
+
+		_cache->Add(shard, key, cachedTemplate, size);
+	}
+
+	_cache->Unlock(shard);
+}
+
+CompiledTemplate* TemplateCache::GetCompiledTemplate(const string& languageCode, const string& name)
+{
+	CompiledTemplate* compiledTemplate = NULL;
+	wstring text;
+	bool found = false;
+
+	TEMPLATECACHE::SHARD* shard = _cache->Lock(Hash(languageCode, name));
+	TEMPLATECACHE::ENTRY* entry = _cache->Find(shard, pair<string, string>(languageCode, name));
+	if ( entry )
+	{
+		compiledTemplate = entry->value.compiled;
+		if ( compiledTemplate )
+			compiledTemplate->Retain();
+		else
+			text = entry->value.text;
+
+		_cache->MakeNewest(shard, entry);
+		found = true;
+	}
+	_cache->Unlock(shard);
+
+	// a miss is counted when the text is looked for
+	if ( !found )
+		return NULL;
+
+	_cache->Count(CACHE_HITS);
+
+	if ( !compiledTemplate )
+	{
+		// compiled without the lock, another thread may do the same in the meantime
+		compiledTemplate = new CompiledTemplate(text);
+		SetCompiledTemplate(languageCode, name, compiledTemplate);
+	}
+
+	return compiledTemplate;
+}
+
+void TemplateCache::SetCompiledTemplate(const string& languageCode, const string& name, CompiledTemplate* compiledTemplate)
+{
+	TEMPLATECACHE::SHARD* shard = _cache->Lock(Hash(languageCode, name));
+	TEMPLATECACHE::ENTRY* entry = _cache->Find(shard, pair<string, string>(languageCode, name));
+	if ( entry && !entry->value.compiled )
+	{
+		compiledTemplate->Retain();
+		entry->value.compiled = compiledTemplate;
+		_cache->Grow(shard, entry, compiledTemplate->Size());
+	}
+	_cache->Unlock(shard);
+
+	_cache->Count(CACHE_OTHER);
+}
+
+string TemplateCache::GetStatistics()
+{
+	long long counters[CACHE_COUNTERS];
+	int templates;
+	size_t size;
+	_cache->GetStatistics(counters, &templates, &size);
+
+	char buffer[320];
+	snprintf(buffer, sizeof(buffer), "templateHits:%lld\ntemplateMisses:%lld\ntemplateEvictions:%lld\ntemplateCompilations:%lld\ntemplatesCached:%d\ntemplateCacheSize:%lu", counters[CACHE_HITS], counters[CACHE_MISSES], counters[CACHE_EVICTIONS], counters[CACHE_OTHER], templates, (unsigned long) size);
+
+	return string(buffer);
+}
+
+void TemplateCache::ReleaseTemplate(CACHEDTEMPLATE* cachedTemplate)
+{
+	// a parser may still use the compiled template, it goes with its last release
+	if ( cachedTemplate->compiled )
+		cachedTemplate->compiled->Release();
+}
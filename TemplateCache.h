@@ -0,0 +1,74 @@
+/*
+ *  TemplateCache.h
+ *  Wiki2Touch/wikisrvd
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TEMPLATECACHE_H
+#define TEMPLATECACHE_H
+
+#include <string>
+using namespace std;
+
+#include "CompiledTemplate.h"
+#include "ShardedCache.h"
+
+// memory for the text of templates if nothing else is given
+#define DEFAULT_TEMPLATE_CACHE_MEMORY (4096*1024)
+
+// the cache is split so lookups of different templates don't wait for each other
+#define TEMPLATE_CACHE_SHARDS 8
+
+typedef struct
+{
+	wstring	text;					// what is included, noinclude and onlyinclude are handled already
+	CompiledTemplate* compiled;		// made the first time it's expanded
+} CACHEDTEMPLATE;
+
+typedef ShardedCache<pair<string, string>, CACHEDTEMPLATE> TEMPLATECACHE;
+
+/*
+ Keeps the most recently used templates of all languages in memory, shared by all threads. The
+ name is the normalized one (see WikiMarkupGetter::GetTemplate), the text is copied in and out.
+ The compiled form is kept with the text and charged to the cache, it lives as long as it's used.
+ */
+class TemplateCache
+{
+public:
+	TemplateCache(size_t memory=DEFAULT_TEMPLATE_CACHE_MEMORY);
+	~TemplateCache();
+
+	bool GetTemplate(const string& languageCode, const string& name, wstring& text);
+	void AddTemplate(const string& languageCode, const string& name, const wstring& text);
+
+	// the compiled form of a cached template, NULL if it isn't cached; it has to be released
+	CompiledTemplate* GetCompiledTemplate(const string& languageCode, const string& name);
+	void SetCompiledTemplate(const string& languageCode, const string& name, CompiledTemplate* compiledTemplate);
+
+	string GetStatistics();
+
+private:
+	TEMPLATECACHE* _cache;
+
+	unsigned int Hash(const string& languageCode, const string& name);
+
+	static void ReleaseTemplate(CACHEDTEMPLATE* cachedTemplate);
+};
+
+#endif
@@ -0,0 +1,420 @@
+/*
+ *  TemplatePack.cpp
+ *  Wiki2Touch/wikisrvd
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+
+#include "TemplatePack.h"
+#include "CPPStringUtils.h"
+
+#define TEMPLATE_PACK_VERSION 1
+#define TEMPLATE_PACK_BYTE_ORDER 0x01020304
+
+// the smallest table, a power of two like every other size of it
+#define TEMPLATE_PACK_MIN_SLOTS 16384
+
+// the mapping is larger than the file, so appended templates are seen without mapping it again
+#define TEMPLATE_PACK_MAP_RESERVE (1024*1024)
+
+#pragma pack(1)
+typedef struct
+{
+	char magic[4];						// "W2TP"
+	unsigned int version;				// 4 bytes
+	unsigned int byteOrder;				// 4 bytes; TEMPLATE_PACK_BYTE_ORDER as written by the creating machine
+	unsigned int numberOfSlots;			// 4 bytes
+} TEMPLATEPACKHEADER;
+
+// the table follows the header
+typedef struct
+{
+	unsigned int hash;					// 4 bytes; of the name
+	unsigned int nameLength;			// 4 bytes
+	long long recordPos;				// 8 bytes; 0 if the slot is empty
+} TEMPLATEPACKSLOT;
+
+// the records follow the table, each is followed by the name and the text (utf-8, no terminating zeros)
+typedef struct
+{
+	unsigned int nameLength;			// 4 bytes
+	unsigned int textLength;			// 4 bytes
+} TEMPLATEPACKRECORD;
+#pragma pack()
+
+static off_t DataPos(unsigned int numberOfSlots)
+{
+	return sizeof(TEMPLATEPACKHEADER) + (off_t) numberOfSlots*sizeof(TEMPLATEPACKSLOT);
+}
+
+static bool WriteEmptyPack(int fd, unsigned int numberOfSlots)
+{
+	TEMPLATEPACKHEADER header;
+	memcpy(header.magic, "W2TP", 4);
+	header.version = TEMPLATE_PACK_VERSION;
+	header.byteOrder = TEMPLATE_PACK_BYTE_ORDER;
+	header.numberOfSlots = numberOfSlots;
+
+	// the empty slots are the zeros of the truncated file
+	return !ftruncate(fd, 0) && !ftruncate(fd, DataPos(numberOfSlots)) && pwrite(fd, &header, sizeof(header), 0)==sizeof(header);
+}
+
+static bool ReadHeader(int fd, TEMPLATEPACKHEADER* header, off_t* fileSize)
+{
+	struct stat statbuf;
+	if ( fstat(fd, &statbuf) || pread(fd, header, sizeof(TEMPLATEPACKHEADER), 0)!=sizeof(TEMPLATEPACKHEADER) )
+		return false;
+
+	*fileSize = statbuf.st_size;
+
+	return !memcmp(header->magic, "W2TP", 4) && header->version==TEMPLATE_PACK_VERSION && header->byteOrder==TEMPLATE_PACK_BYTE_ORDER &&
+		header->numberOfSlots>=TEMPLATE_PACK_MIN_SLOTS && !(header->numberOfSlots & (header->numberOfSlots-1)) && DataPos(header->numberOfSlots)<=*fileSize;
+}
+
+TemplatePack::TemplatePack(const string& fileName)
+{
+	_fileName = fileName;
+	_fd = -1;
+	pthread_mutex_init(&_mutex, NULL);
+
+	_mapping = NULL;
+	_mappingSize = 0;
+
+	_fileSize = 0;
+	_numberOfSlots = 0;
+	_numberOfTemplates = 0;
+
+	Open();
+}
+
+TemplatePack::~TemplatePack()
+{
+	Close();
+	pthread_mutex_destroy(&_mutex);
+}
+
+bool TemplatePack::Open()
+{
+	_fd = open(_fileName.c_str(), O_RDWR | O_CREAT, 0644);
+	if ( _fd<0 )
+		return false;
+
+	TEMPLATEPACKHEADER header;
+	if ( !ReadHeader(_fd, &header, &_fileSize) )
+	{
+		// it's only a cache, so it's started again
+		header.numberOfSlots = TEMPLATE_PACK_MIN_SLOTS;
+		_fileSize = DataPos(header.numberOfSlots);
+
+		if ( !WriteEmptyPack(_fd, header.numberOfSlots) )
+		{
+			Close();
+			return false;
+		}
+	}
+
+	_numberOfSlots = header.numberOfSlots;
+	if ( !Map() )
+	{
+		Close();
+		return false;
+	}
+
+	const TEMPLATEPACKSLOT* slots = (const TEMPLATEPACKSLOT*) (_mapping + sizeof(TEMPLATEPACKHEADER));
+	_numberOfTemplates = 0;
+	for (unsigned int i=0; i<_numberOfSlots; i++)
+		if ( slots[i].recordPos )
+			_numberOfTemplates++;
+
+	return true;
+}
+
+void TemplatePack::Close()
+{
+	if ( _mapping )
+		munmap((void*) _mapping, _mappingSize);
+	_mapping = NULL;
+	_mappingSize = 0;
+
+	for (size_t i=0; i<_oldMappings.size(); i++)
+		munmap(_oldMappings[i].first, _oldMappings[i].second);
+	_oldMappings.clear();
+
+	if ( _fd>=0 )
+		close(_fd);
+	_fd = -1;
+
+	_numberOfTemplates = 0;
+}
+
+bool TemplatePack::Map()
+{
+	size_t size = (size_t) _fileSize + TEMPLATE_PACK_MAP_RESERVE;
+	if ( (off_t) size<_fileSize )
+		return false;
+
+	void* mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, _fd, 0);
+	if ( mapping==MAP_FAILED )
+		return false;
+
+	if ( _mapping )
+		_oldMappings.push_back(pair<void*, size_t>((void*) _mapping, _mappingSize));
+
+	_mapping = (const char*) mapping;
+	_mappingSize = size;
+
+	return true;
+}
+
+unsigned int TemplatePack::Hash(const string& name)
+{
+	return CPPStringUtils::fnv_hash(name);
+}
+
+const char* TemplatePack::Record(long long recordPos, unsigned int* nameLength, unsigned int* textLength)
+{
+	if ( recordPos<DataPos(_numberOfSlots) || recordPos + (long long) sizeof(TEMPLATEPACKRECORD)>_fileSize )
+		return NULL;
+
+	// appended after the file was mapped and beyond the reserve
+	if ( recordPos + sizeof(TEMPLATEPACKRECORD)>_mappingSize && !Map() )
+		return NULL;
+
+	TEMPLATEPACKRECORD record;
+	memcpy(&record, _mapping + recordPos, sizeof(record));
+
+	long long end = recordPos + sizeof(record) + (long long) record.nameLength + record.textLength;
+	if ( end>_fileSize || (end>(long long) _mappingSize && !Map()) )
+		return NULL;
+
+	*nameLength = record.nameLength;
+	*textLength = record.textLength;
+
+	return _mapping + recordPos + sizeof(record);
+}
+
+int TemplatePack::FindSlot(const string& name, unsigned int hash, const char** record, unsigned int* textLength)
+{
+	*record = NULL;
+
+	unsigned int mask = _numberOfSlots - 1;
+	unsigned int i = hash & mask;
+
+	for (unsigned int probes=0; probes<_numberOfSlots; probes++, i=(i+1) & mask)
+	{
+		// the slots are written with pwrite, the mapping shows them
+		const TEMPLATEPACKSLOT* slot = (const TEMPLATEPACKSLOT*) (_mapping + sizeof(TEMPLATEPACKHEADER)) + i;
+		if ( !slot->recordPos )
+			return i;
+
+		if ( slot->hash!=hash || slot->nameLength!=name.length() )
+			continue;
+
+		unsigned int nameLength;
+		const char* data = Record(slot->recordPos, &nameLength, textLength);
+		if ( data && nameLength==name.length() && !memcmp(data, name.data(), nameLength) )
+		{
+			*record = data;
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+bool TemplatePack::FindTemplate(const string& name, const char** text, size_t* length)
+{
+	const char* record = NULL;
+	unsigned int textLength = 0;
+
+	pthread_mutex_lock(&_mutex);
+	if ( _mapping )
+		FindSlot(name, Hash(name), &record, &textLength);
+	pthread_mutex_unlock(&_mutex);
+
+	if ( record )
+	{
+		*text = record + name.length();
+		*length = textLength;
+	}
+
+	return record!=NULL;
+}
+
+bool TemplatePack::AddTemplate(const string& name, const string& text)
+{
+	pthread_mutex_lock(&_mutex);
+
+	if ( !_mapping )
+	{
+		pthread_mutex_unlock(&_mutex);
+		return false;
+	}
+
+	unsigned int hash = Hash(name);
+	const char* oldRecord;
+	unsigned int oldTextLength;
+	int i = FindSlot(name, hash, &oldRecord, &oldTextLength);
+	bool found = oldRecord!=NULL;
+
+	// a new template isn't added if that fills more than three quarters, only a compaction helps
+	if ( i<0 || (!found && ((unsigned int) _numberOfTemplates + 1)*4>_numberOfSlots*3) )
+	{
+		pthread_mutex_unlock(&_mutex);
+		return false;
+	}
+
+	TEMPLATEPACKRECORD record;
+	record.nameLength = name.length();
+	record.textLength = text.length();
+
+	string data = string((const char*) &record, sizeof(record)) + name + text;
+
+	TEMPLATEPACKSLOT slot;
+	slot.hash = hash;
+	slot.nameLength = record.nameLength;
+	slot.recordPos = _fileSize;
+
+	// the record first, a slot never points to something which isn't written completely
+	bool written = pwrite(_fd, data.data(), data.length(), _fileSize)==(ssize_t) data.length() &&
+		pwrite(_fd, &slot, sizeof(slot), sizeof(TEMPLATEPACKHEADER) + (off_t) i*sizeof(slot))==sizeof(slot);
+
+	if ( written )
+	{
+		_fileSize += data.length();
+		if ( !found )
+			_numberOfTemplates++;
+	}
+
+	pthread_mutex_unlock(&_mutex);
+
+	return written;
+}
+
+int TemplatePack::NumberOfTemplates()
+{
+	return _numberOfTemplates;
+}
+
+bool TemplatePack::Crowded()
+{
+	// a table filled more than half is slow to probe
+	return (unsigned int) _numberOfTemplates*2>_numberOfSlots;
+}
+
+bool TemplatePack::Compact(const string& fileName, int* numberOfTemplates)
+{
+	// the latest record of every template, in the order of the file
+	vector<long long> recordPositions;
+
+	int fd = open(fileName.c_str(), O_RDONLY);
+
+	TEMPLATEPACKHEADER header;
+	off_t fileSize = 0;
+	const char* mapping = (const char*) MAP_FAILED;
+
+	if ( fd>=0 && ReadHeader(fd, &header, &fileSize) && (off_t) (size_t) fileSize==fileSize )
+		mapping = (const char*) mmap(NULL, (size_t) fileSize, PROT_READ, MAP_SHARED, fd, 0);
+
+	if ( mapping!=MAP_FAILED )
+	{
+		const TEMPLATEPACKSLOT* slots = (const TEMPLATEPACKSLOT*) (mapping + sizeof(TEMPLATEPACKHEADER));
+		for (unsigned int i=0; i<header.numberOfSlots; i++)
+			if ( slots[i].recordPos )
+				recordPositions.push_back(slots[i].recordPos);
+
+		sort(recordPositions.begin(), recordPositions.end());
+	}
+
+	unsigned int numberOfSlots = TEMPLATE_PACK_MIN_SLOTS;
+	while ( numberOfSlots<recordPositions.size()*4 )
+		numberOfSlots *= 2;
+
+	string tempFileName = fileName + ".tmp";
+	int out = open(tempFileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+	bool error = out<0 || !WriteEmptyPack(out, numberOfSlots);
+
+	vector<TEMPLATEPACKSLOT> slots(numberOfSlots);
+	memset(&slots[0], 0, numberOfSlots*sizeof(TEMPLATEPACKSLOT));
+
+	off_t pos = DataPos(numberOfSlots);
+	int templates = 0;
+
+	for (size_t i=0; !error && i<recordPositions.size(); i++)
+	{
+		long long recordPos = recordPositions[i];
+		if ( recordPos<DataPos(header.numberOfSlots) || recordPos + (long long) sizeof(TEMPLATEPACKRECORD)>fileSize )
+			continue;
+
+		TEMPLATEPACKRECORD record;
+		memcpy(&record, mapping + recordPos, sizeof(record));
+
+		long long size = sizeof(record) + (long long) record.nameLength + record.textLength;
+		if ( recordPos + size>fileSize )
+			continue;
+
+		if ( pwrite(out, mapping + recordPos, (size_t) size, pos)!=(ssize_t) size )
+		{
+			error = true;
+			break;
+		}
+
+		unsigned int hash = Hash(string(mapping + recordPos + sizeof(record), record.nameLength));
+		unsigned int j = hash & (numberOfSlots-1);
+		while ( slots[j].recordPos )
+			j = (j+1) & (numberOfSlots-1);
+
+		slots[j].hash = hash;
+		slots[j].nameLength = record.nameLength;
+		slots[j].recordPos = pos;
+
+		pos += size;
+		templates++;
+	}
+
+	if ( !error )
+		error = pwrite(out, &slots[0], numberOfSlots*sizeof(TEMPLATEPACKSLOT), sizeof(TEMPLATEPACKHEADER))!=(ssize_t) (numberOfSlots*sizeof(TEMPLATEPACKSLOT)) || fsync(out);
+
+	if ( mapping!=MAP_FAILED )
+		munmap((void*) mapping, (size_t) fileSize);
+	if ( fd>=0 )
+		close(fd);
+	if ( out>=0 )
+		close(out);
+
+	if ( error || rename(tempFileName.c_str(), fileName.c_str()) )
+	{
+		unlink(tempFileName.c_str());
+		return false;
+	}
+
+	if ( numberOfTemplates )
+		*numberOfTemplates = templates;
+
+	return true;
+}
@@ -0,0 +1,86 @@
+/*
+ *  TemplatePack.h
+ *  Wiki2Touch/wikisrvd
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TEMPLATEPACK_H
+#define TEMPLATEPACK_H
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+using namespace std;
+
+// the name of the pack in the directory of a language
+#define TEMPLATE_PACK_FILE_NAME "templates.pack"
+
+/*
+ The templates of one language which were read from the archive once, kept on disk across
+ restarts. New texts are appended to the file, an open addressing hash table in front of them
+ finds them. The file is mapped, so a lookup doesn't read anything; the mappings stay valid until
+ the pack is deleted. If the table gets too full it is enlarged by Compact, when the server
+ starts (see Settings::OpenTemplatePacks) or by wikibuild -T.
+ */
+class TemplatePack
+{
+public:
+	TemplatePack(const string& fileName);
+	~TemplatePack();
+
+	// the utf-8 text of the template, a view into the file
+	bool FindTemplate(const string& name, const char** text, size_t* length);
+
+	// false if it can't be written or the table is full
+	bool AddTemplate(const string& name, const string& text);
+
+	int NumberOfTemplates();
+
+	// true if the table should be enlarged by a compaction
+	bool Crowded();
+
+	// rewrites the pack with only the latest text of every template and a table with room for
+	// as many templates again
+	static bool Compact(const string& fileName, int* numberOfTemplates=NULL);
+
+private:
+	string	_fileName;
+	int		_fd;
+	pthread_mutex_t _mutex;
+
+	const char* _mapping;
+	size_t	_mappingSize;
+	vector<pair<void*, size_t> > _oldMappings;	// views into them may still be in use
+
+	off_t	_fileSize;
+	unsigned int _numberOfSlots;
+	int		_numberOfTemplates;
+
+	bool Open();
+	void Close();
+	bool Map();
+	const char* Record(long long recordPos, unsigned int* nameLength, unsigned int* textLength);
+	// the record (name and text) if the name is in the table, otherwise the free slot for it
+	int FindSlot(const string& name, unsigned int hash, const char** record, unsigned int* textLength);
+
+	static unsigned int Hash(const string& name);
+};
+
+#endif
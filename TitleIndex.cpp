@@ -20,31 +20,173 @@
  *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+
+#include <algorithm>
+
+#include "ArchiveFormat.h"
 #include "TitleIndex.h"
 #include "CPPStringUtils.h"
 
 const char* ARTICLES_DATA_NAME = "articles";
 const char* ARTICLES_DATA_EXTENSION = ".bin";
+const char* INDEX_FILE_EXTENSION = ".idx";
+
+// the fences get at least this close, a smaller stride doesn't save a noticeable number of probes
+#define MIN_FENCE_STRIDE 16
+
+// windows larger than this are searched probe by probe instead of being read at once
+#define MAX_WINDOW_SIZE 4096
 
-#define SIZEOF_POSITION_INFORMATION 16
+// a batch lookup gallops from one title to the next if they are (expected to be) closer than this
+#define GALLOP_DISTANCE 64
+
+// the number of prefix ranges kept for the next keystroke of a suggestion search
+#define SUGGESTION_RANGES 16
 
 #pragma pack(1)
-typedef struct 
+// the optional index file next to the data file holds precomputed data for the lookups,
+// it's only used if it was created for exactly this data file
+typedef struct
 {
-	char languageCode[2];				// 2 bytes
+	char magic[4];						// "W2TI"
+	unsigned int version;				// 4 bytes
 	unsigned int numberOfArticles;		// 4 bytes
-	fpos_t	titlesPos;					// 8 bytes
-	fpos_t	indexPos_0;					// 8 bytes
-	fpos_t	indexPos_1;					// 8 bytes; the second one has discritcs removed or traditional chineses chars are converted to simpified chineses chars
-	unsigned char version;				// 1 byte
-	char reserved1[1];					// 1 byte
-	char imageNamespace[32];			// namespace prefix for images   (without the colon)
-	char templateNamespace[32];			// namespace prefix for template (without the colon)
-	char reserved2[160];				// for future use
-} FILEHEADER;
+	unsigned int numberOfSections;		// 4 bytes
+	long long dataFileSize;				// 8 bytes; size of the data file the index file belongs to
+	long long indexPos_0;				// 8 bytes
+	long long indexPos_1;				// 8 bytes
+	unsigned int byteOrder;				// 4 bytes; INDEX_FILE_BYTE_ORDER as written by the creating machine
+	char reserved[20];					// for future use
+} INDEXFILEHEADER;
+
+typedef struct
+{
+	unsigned int type;					// 4 bytes
+	unsigned int reserved;				// 4 bytes
+	long long pos;						// 8 bytes; from the start of the index file
+	long long size;						// 8 bytes
+} INDEXFILESECTION;
 #pragma pack(pop)
 
-TitleIndex::TitleIndex(string pathToDataFile)
+#define INDEX_FILE_VERSION 2
+#define INDEX_FILE_BYTE_ORDER 0x01020304
+
+// the normalized titles in index order: (numberOfArticles+1) offsets followed by the keys
+#define SECTION_KEYS_0 1
+#define SECTION_KEYS_1 2
+
+// the first 8 bytes of each key as a big endian number (zero padded), stored as numberOfArticles integers
+#define SECTION_PREFIXES_0 3
+#define SECTION_PREFIXES_1 4
+
+// a bloom filter of the keys of index 0: a FILTERHEADER followed by the blocks
+#define SECTION_FILTER 5
+
+typedef struct
+{
+	unsigned int numberOfBlocks;
+	unsigned int reserved;
+} FILTERHEADER;
+
+// the filter consists of blocks of 512 bits (one cache line), all bits of a key are in the same block
+#define FILTER_BLOCK_WORDS 8
+#define FILTER_HASHES 7
+#define FILTER_BITS_PER_KEY 10
+
+// a jump table over the first two bytes of the keys: JUMP_TABLE_SIZE+1 integers, entry n is the first
+// title of the index whose two leading bytes (zero padded) aren't less than n
+#define SECTION_JUMPS_0 6
+#define SECTION_JUMPS_1 7
+
+#define JUMP_TABLE_SIZE 65536
+
+// the numbers of the titles in index 0 without a namespace (the real articles), one integer each
+#define SECTION_ARTICLES 8
+
+static inline unsigned long long KeyPrefix(const char* key, size_t length)
+{
+	// compares like the first 8 bytes of the key do
+	unsigned long long prefix = 0;
+	for (size_t i=0; i<8; i++)
+		prefix = (prefix << 8) | (i<length ? (unsigned char) key[i] : 0);
+	
+	return prefix;
+}
+
+static inline unsigned long long FilterHash(const char* key, size_t length)
+{
+	// FNV-1a, mixed with the finalizer of MurmurHash3 so all bits are usable
+	unsigned long long hash = 0xcbf29ce484222325ULL;
+	for (size_t i=0; i<length; i++)
+		hash = (hash ^ (unsigned char) key[i]) * 0x100000001b3ULL;
+	
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	hash ^= hash >> 33;
+	
+	return hash;
+}
+
+static inline const unsigned long long* FilterBlock(const unsigned long long* filter, unsigned int numberOfBlocks, unsigned long long hash)
+{
+	return filter + (((hash >> 32) * numberOfBlocks) >> 32) * FILTER_BLOCK_WORDS;
+}
+
+static inline void FilterAdd(unsigned long long* filter, unsigned int numberOfBlocks, unsigned long long hash)
+{
+	unsigned long long* block = (unsigned long long*) FilterBlock(filter, numberOfBlocks, hash);
+	
+	// the bits inside of the block are taken from a second hash, 9 bits each
+	unsigned long long bits = hash * 0x9e3779b97f4a7c15ULL;
+	for (int i=0; i<FILTER_HASHES; i++, bits >>= 9)
+		block[(bits >> 6) & 7] |= 1ULL << (bits & 63);
+}
+
+static inline bool FilterTest(const unsigned long long* filter, unsigned int numberOfBlocks, unsigned long long hash)
+{
+	const unsigned long long* block = FilterBlock(filter, numberOfBlocks, hash);
+	
+	unsigned long long bits = hash * 0x9e3779b97f4a7c15ULL;
+	for (int i=0; i<FILTER_HASHES; i++, bits >>= 9)
+		if ( !(block[(bits >> 6) & 7] & (1ULL << (bits & 63))) )
+			return false;
+	
+	return true;
+}
+
+static inline int LowerBound(const unsigned long long* values, int count, unsigned long long value)
+{
+	// the first position with values[position]>=value; without branches in the loop the
+	// compiler uses a conditional move and the prefetches of both possible next probes hide the misses
+	if ( count<=0 )
+		return 0;
+	
+	const unsigned long long* base = values;
+	while ( count>1 )
+	{
+		int half = count >> 1;
+		count -= half;
+		
+		__builtin_prefetch(base + (count >> 1));
+		__builtin_prefetch(base + half + (count >> 1));
+		
+		base = (base[half]<value) ? base + half : base;
+	}
+	
+	return (base - values) + (*base<value);
+}
+
+TitleIndex::TitleIndex(string pathToDataFile, size_t fenceMemory, size_t filterMemory)
 {
 	_imageNamespace = "";
 	_templateNamespace = "";
@@ -58,15 +200,49 @@ TitleIndex::TitleIndex(string pathToDataFile)
 	
 	_numberOfArticles = -1;
 	
+	_titlesPos = 0;
 	_indexPos_0 = 0;
 	_indexPos_1 = 0;
+	_slotSize = sizeof(int);
+	_maxBlockSize = 0;
+	_codec = NULL;
+	
+	_mapping = NULL;
+	_mappingSize = 0;
+	_mappingPos = 0;
+	
+	memset(_fences, 0, sizeof(_fences));
+	
+	_dataFileSize = 0;
+	
+	_indexFile = NULL;
+	_indexFileSize = 0;
+	_keyOffsets[0] = _keyOffsets[1] = NULL;
+	_keys[0] = _keys[1] = NULL;
+	_keyPrefixes[0] = _keyPrefixes[1] = NULL;
+	_keyJumps[0] = _keyJumps[1] = NULL;
+	
+	_filter = NULL;
+	_filterBlocks = 0;
+	_filterAllocated = false;
+	
+	_articles = NULL;
+	_numberOfMainArticles = -1;
+	pthread_mutex_init(&_articlesMutex, NULL);
+	
+	pthread_mutex_init(&_suggestionMutex, NULL);
+	_suggestionRangesUsed = 0;
+	_lookups = 0;
+	_probes = 0;
+	_probesSaved = 0;
+	_filterRejects = 0;
 
 	_imageNamespace = "";
 	_templateNamespace = "";
 		
 	// get the number of articles; this also checks if the files exists
-	FILE* f = fopen(_dataFileName.c_str(), "rb");
-	if ( !f )
+	_fd = open(_dataFileName.c_str(), O_RDONLY);
+	if ( _fd<0 )
 	{
 		// second try
 		_dataFileName = "";
@@ -84,10 +260,10 @@ TitleIndex::TitleIndex(string pathToDataFile)
 		}
 		
 		if ( _dataFileName!="" )
-			f = fopen(_dataFileName.c_str(), "rb");
+			_fd = open(_dataFileName.c_str(), O_RDONLY);
 	}
 	
-	if ( f )
+	if ( _fd>=0 )
 	{
 		int error = 0;
 
@@ -95,7 +271,7 @@ TitleIndex::TitleIndex(string pathToDataFile)
 		
 		// if the old, short fileheader is used this will read over the end of the header
 		// no problem, if the file is less than 256 it's unuseable anyway
-		if ( fread(&fileheader, sizeof(FILEHEADER), 1, f)!=1 )
+		if ( pread(_fd, &fileheader, sizeof(FILEHEADER), 0)!=sizeof(FILEHEADER) )
 			error = 1;
 		
 		if ( !error ) 
@@ -106,52 +282,842 @@ TitleIndex::TitleIndex(string pathToDataFile)
 			
 			isChinese = (tolower(fileheader.languageCode[0])=='z') && (tolower(fileheader.languageCode[1])=='h'); 
 			
-			if ( fileheader.version==1 )
+			if ( fileheader.version>ARCHIVE_VERSION_64 )
+			{
+				// made by a newer builder, the layout is unknown
+				_numberOfArticles = -1;
+				error = 1;
+			}
+			else if ( fileheader.version>=1 )
 			{
 				_indexPos_1 = fileheader.indexPos_1;
 				_imageNamespace = string(fileheader.imageNamespace);
 				_templateNamespace = string(fileheader.templateNamespace);
+				
+				if ( fileheader.version==ARCHIVE_VERSION_64 )
+				{
+					_slotSize = sizeof(long long);
+					_maxBlockSize = fileheader.maxBlockSize;
+				}
+			}
+			
+			if ( !error )
+			{
+				_codec = BlockCodec::ForArchive(_fd, &fileheader);
+				if ( !_codec )
+				{
+					// compressed in a way we don't know
+					_numberOfArticles = -1;
+					error = 1;
+				}
 			}
+			
+			struct stat statbuf;
+			if ( fstat(_fd, &statbuf)==0 )
+				_dataFileSize = statbuf.st_size;
+			
+			MapIndexes();
+			LoadIndexFile();
+			
+			// the memory is shared by both indexes
+			if ( _indexPos_1 )
+			{
+				BuildFences(0, fenceMemory/2);
+				BuildFences(1, fenceMemory/2);
+			}
+			else
+				BuildFences(0, fenceMemory);
+			
+			if ( !_filter )
+				BuildFilter(filterMemory);
 		}
 		
-		fclose(f);
+		// the descriptor is kept only if the indexes have to be read with pread
+		if ( error || _mapping )
+		{
+			close(_fd);
+			_fd = -1;
+		}
 	}
 }
 
 TitleIndex::~TitleIndex()
 {
+	DeleteFences(0);
+	DeleteFences(1);
+	
+	pthread_mutex_destroy(&_suggestionMutex);
+	pthread_mutex_destroy(&_articlesMutex);
+	
+	UnloadIndexFile();
+	DeleteFilter();
+	
+	if ( _mapping )
+		munmap((void*) _mapping, _mappingSize);
+	
+	if ( _fd>=0 )
+		close(_fd);
+	
+	if ( _codec )
+		delete _codec;
 }
 
-ArticleSearchResult* TitleIndex::FindArticle(string title, bool multiple)
+void TitleIndex::MapIndexes()
 {
-	if ( _numberOfArticles<=0  )
+	// the title table and the indexes are located behind the article blocks; only this part
+	// is mapped so even huge archives fit into the address space
+	off_t start = _titlesPos;
+	if ( _indexPos_0 && _indexPos_0<start )
+		start = _indexPos_0;
+	if ( _indexPos_1 && _indexPos_1<start )
+		start = _indexPos_1;
+	
+	start -= start % sysconf(_SC_PAGESIZE);
+	if ( start<0 || start>=_dataFileSize )
+		return;
+	
+	off_t size = _dataFileSize - start;
+	if ( (off_t) (size_t) size!=size )
+		return;
+	
+	void* mapping = mmap(NULL, (size_t) size, PROT_READ, MAP_SHARED, _fd, start);
+	if ( mapping==MAP_FAILED )
+	{
+		// no problem, pread is used instead
+		return;
+	}
+	
+	// every probe of a binary search hits another page, read ahead is useless
+	madvise(mapping, (size_t) size, MADV_RANDOM);
+	
+	_mapping = (const unsigned char*) mapping;
+	_mappingSize = (size_t) size;
+	_mappingPos = start;
+}
+
+inline const unsigned char* TitleIndex::Mapped(off_t pos, size_t size)
+{
+	if ( !_mapping || pos<_mappingPos || (pos + (off_t) size)>(_mappingPos + (off_t) _mappingSize) )
 		return NULL;
+	
+	return _mapping + (pos - _mappingPos);
+}
 
-	FILE* f = fopen(_dataFileName.c_str(), "rb");
-	if ( !f )
+string TitleIndex::IndexFileName()
+{
+	return _dataFileName.substr(0, _dataFileName.length() - strlen(ARTICLES_DATA_EXTENSION)) + INDEX_FILE_EXTENSION;
+}
+
+bool TitleIndex::HasIndexFile()
+{
+	return _indexFile!=NULL;
+}
+
+void TitleIndex::LoadIndexFile()
+{
+	if ( _numberOfArticles<=0 )
+		return;
+	
+	int fd = open(IndexFileName().c_str(), O_RDONLY);
+	if ( fd<0 )
+		return;
+	
+	struct stat statbuf;
+	void* mapping = MAP_FAILED;
+	
+	if ( fstat(fd, &statbuf)==0 && statbuf.st_size>=(off_t) sizeof(INDEXFILEHEADER) && (off_t) (size_t) statbuf.st_size==statbuf.st_size )
+		mapping = mmap(NULL, (size_t) statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	
+	if ( mapping==MAP_FAILED )
+		return;
+	
+	madvise(mapping, (size_t) statbuf.st_size, MADV_RANDOM);
+	
+	// only use it if it was made for this data file
+	INDEXFILEHEADER* header = (INDEXFILEHEADER*) mapping;
+	if ( memcmp(header->magic, "W2TI", 4) || header->version!=INDEX_FILE_VERSION || header->byteOrder!=INDEX_FILE_BYTE_ORDER || header->numberOfArticles!=(unsigned int) _numberOfArticles ||
+		 header->dataFileSize!=_dataFileSize || header->indexPos_0!=_indexPos_0 || header->indexPos_1!=_indexPos_1 ||
+		 sizeof(INDEXFILEHEADER) + (size_t) header->numberOfSections*sizeof(INDEXFILESECTION)>(size_t) statbuf.st_size )
+	{
+		munmap(mapping, (size_t) statbuf.st_size);
+		return;
+	}
+	
+	_indexFile = (const unsigned char*) mapping;
+	_indexFileSize = (size_t) statbuf.st_size;
+	
+	for (int indexNo=0; indexNo<2; indexNo++)
+	{
+		size_t size;
+		const unsigned char* section = IndexFileSection(SECTION_KEYS_0 + indexNo, &size);
+		
+		size_t offsetsSize = ((size_t) _numberOfArticles + 1)*sizeof(unsigned int);
+		if ( !section || size<offsetsSize )
+			continue;
+		
+		const unsigned int* keyOffsets = (const unsigned int*) section;
+		if ( keyOffsets[_numberOfArticles]>size - offsetsSize )
+			continue;
+		
+		_keyOffsets[indexNo] = keyOffsets;
+		_keys[indexNo] = (const char*) section + offsetsSize;
+		
+		// the prefixes are useless without the keys
+		section = IndexFileSection(SECTION_PREFIXES_0 + indexNo, &size);
+		if ( section && size==(size_t) _numberOfArticles*sizeof(unsigned long long) )
+			_keyPrefixes[indexNo] = (const unsigned long long*) section;
+		
+		section = IndexFileSection(SECTION_JUMPS_0 + indexNo, &size);
+		if ( _keyPrefixes[indexNo] && section && size==(JUMP_TABLE_SIZE + 1)*sizeof(unsigned int) )
+			_keyJumps[indexNo] = (const unsigned int*) section;
+	}
+	
+	size_t size;
+	const unsigned char* section = IndexFileSection(SECTION_ARTICLES, &size);
+	if ( section && (size % sizeof(unsigned int))==0 && size<=(size_t) _numberOfArticles*sizeof(unsigned int) )
+	{
+		_articles = (const unsigned int*) section;
+		_numberOfMainArticles = size/sizeof(unsigned int);
+		_mainArticles.clear();
+	}
+	
+	section = IndexFileSection(SECTION_FILTER, &size);
+	if ( section && size>=sizeof(FILTERHEADER) )
+	{
+		const FILTERHEADER* filterHeader = (const FILTERHEADER*) section;
+		if ( filterHeader->numberOfBlocks && size==sizeof(FILTERHEADER) + (size_t) filterHeader->numberOfBlocks*FILTER_BLOCK_WORDS*sizeof(unsigned long long) )
+		{
+			DeleteFilter();
+			
+			_filter = (const unsigned long long*) (section + sizeof(FILTERHEADER));
+			_filterBlocks = filterHeader->numberOfBlocks;
+		}
+	}
+}
+
+void TitleIndex::UnloadIndexFile()
+{
+	if ( _indexFile )
+		munmap((void*) _indexFile, _indexFileSize);
+	
+	_indexFile = NULL;
+	_indexFileSize = 0;
+	_keyOffsets[0] = _keyOffsets[1] = NULL;
+	_keys[0] = _keys[1] = NULL;
+	_keyPrefixes[0] = _keyPrefixes[1] = NULL;
+	_keyJumps[0] = _keyJumps[1] = NULL;
+	
+	if ( _articles && _mainArticles.empty() )
+	{
+		_articles = NULL;
+		_numberOfMainArticles = -1;
+	}
+	
+	// a filter located in the index file is gone too
+	if ( !_filterAllocated )
+	{
+		_filter = NULL;
+		_filterBlocks = 0;
+	}
+}
+
+const unsigned char* TitleIndex::IndexFileSection(unsigned int type, size_t* size)
+{
+	if ( !_indexFile )
 		return NULL;
+	
+	INDEXFILEHEADER* header = (INDEXFILEHEADER*) _indexFile;
+	INDEXFILESECTION* sections = (INDEXFILESECTION*) (_indexFile + sizeof(INDEXFILEHEADER));
+	
+	for (unsigned int i=0; i<header->numberOfSections; i++)
+	{
+		if ( sections[i].type!=type )
+			continue;
+		
+		// the sections are aligned to 8 bytes so they can be accessed in place
+		if ( sections[i].pos<0 || sections[i].size<0 || (sections[i].pos & 7) || sections[i].pos + sections[i].size>(long long) _indexFileSize )
+			return NULL;
+		
+		*size = (size_t) sections[i].size;
+		return _indexFile + sections[i].pos;
+	}
+	
+	return NULL;
+}
+
+bool TitleIndex::WriteIndexFile()
+{
+	// this has to be done before the instance is used by other threads
+	if ( _numberOfArticles<=0 )
+		return false;
+	
+	vector<INDEXFILESECTION> sections;
+	
+	INDEXFILESECTION section;
+	memset(&section, 0, sizeof(section));
+	
+	section.type = SECTION_KEYS_0;
+	sections.push_back(section);
+	section.type = SECTION_PREFIXES_0;
+	sections.push_back(section);
+	section.type = SECTION_JUMPS_0;
+	sections.push_back(section);
+	section.type = SECTION_FILTER;
+	sections.push_back(section);
+	section.type = SECTION_ARTICLES;
+	sections.push_back(section);
+	if ( _indexPos_1 )
+	{
+		section.type = SECTION_KEYS_1;
+		sections.push_back(section);
+		section.type = SECTION_PREFIXES_1;
+		sections.push_back(section);
+		section.type = SECTION_JUMPS_1;
+		sections.push_back(section);
+	}
+	
+	INDEXFILEHEADER header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "W2TI", 4);
+	header.version = INDEX_FILE_VERSION;
+	header.numberOfArticles = _numberOfArticles;
+	header.numberOfSections = sections.size();
+	header.dataFileSize = _dataFileSize;
+	header.indexPos_0 = _indexPos_0;
+	header.indexPos_1 = _indexPos_1;
+	header.byteOrder = INDEX_FILE_BYTE_ORDER;
+	
+	// the prefixes and the filter are filled while the keys are written
+	vector<unsigned long long> keyPrefixes;
+	
+	FILTERHEADER filterHeader;
+	memset(&filterHeader, 0, sizeof(filterHeader));
+	filterHeader.numberOfBlocks = ((long long) _numberOfArticles*FILTER_BITS_PER_KEY + 511)/512;
+	
+	vector<unsigned long long> filter(filterHeader.numberOfBlocks*FILTER_BLOCK_WORDS);
+	vector<unsigned int> articles;
+	
+	// written to a temporary file first, so nobody ever sees a half written index file
+	string indexFileName = IndexFileName();
+	string tempFileName = indexFileName + ".tmp";
+	
+	FILE* f = fopen(tempFileName.c_str(), "wb");
+	if ( !f )
+		return false;
+	
+	bool error = fwrite(&header, sizeof(header), 1, f)!=1 || fwrite(&sections[0], sizeof(INDEXFILESECTION), sections.size(), f)!=sections.size();
+	
+	for (size_t i=0; !error && i<sections.size(); i++)
+	{
+		// align the section
+		static const char padding[8] = { 0 };
+		off_t pos = ftello(f);
+		if ( pos & 7 )
+			fwrite(padding, 1, 8 - (pos & 7), f);
+		
+		sections[i].pos = ftello(f);
+		
+		switch ( sections[i].type )
+		{
+			case SECTION_KEYS_0:
+			case SECTION_KEYS_1:
+				sections[i].size = WriteKeySection(f, sections[i].type - SECTION_KEYS_0, &keyPrefixes, sections[i].type==SECTION_KEYS_0 ? &filter : NULL, filterHeader.numberOfBlocks, sections[i].type==SECTION_KEYS_0 ? &articles : NULL);
+				break;
+				
+			case SECTION_ARTICLES:
+				sections[i].size = -1;
+				if ( articles.empty() || fwrite(&articles[0], sizeof(unsigned int), articles.size(), f)==articles.size() )
+					sections[i].size = articles.size()*sizeof(unsigned int);
+				break;
+				
+			case SECTION_FILTER:
+				sections[i].size = -1;
+				if ( fwrite(&filterHeader, sizeof(filterHeader), 1, f)==1 && fwrite(&filter[0], sizeof(unsigned long long), filter.size(), f)==filter.size() )
+					sections[i].size = sizeof(filterHeader) + filter.size()*sizeof(unsigned long long);
+				break;
+				
+			case SECTION_PREFIXES_0:
+			case SECTION_PREFIXES_1:
+				sections[i].size = -1;
+				if ( fwrite(&keyPrefixes[0], sizeof(unsigned long long), keyPrefixes.size(), f)==keyPrefixes.size() )
+					sections[i].size = keyPrefixes.size()*sizeof(unsigned long long);
+				break;
+				
+			case SECTION_JUMPS_0:
+			case SECTION_JUMPS_1:
+			{
+				// taken from the prefixes of the keys written last
+				vector<unsigned int> keyJumps(JUMP_TABLE_SIZE + 1);
+				unsigned int index = 0;
+				for (unsigned int jump=0; jump<=JUMP_TABLE_SIZE; jump++)
+				{
+					while ( index<keyPrefixes.size() && (keyPrefixes[index] >> 48)<jump )
+						index++;
+					keyJumps[jump] = index;
+				}
+				
+				sections[i].size = -1;
+				if ( fwrite(&keyJumps[0], sizeof(unsigned int), keyJumps.size(), f)==keyJumps.size() )
+					sections[i].size = keyJumps.size()*sizeof(unsigned int);
+				break;
+			}
+		}
+		
+		error = sections[i].size<0;
+	}
+	
+	if ( !error )
+		error = fseeko(f, sizeof(header), SEEK_SET) || fwrite(&sections[0], sizeof(INDEXFILESECTION), sections.size(), f)!=sections.size();
+	
+	if ( fclose(f) )
+		error = true;
+	
+	if ( error || rename(tempFileName.c_str(), indexFileName.c_str()) )
+	{
+		unlink(tempFileName.c_str());
+		return false;
+	}
+	
+	UnloadIndexFile();
+	LoadIndexFile();
+	
+	return HasIndexFile();
+}
+
+long long TitleIndex::WriteKeySection(FILE* f, int indexNo, vector<unsigned long long>* keyPrefixes, vector<unsigned long long>* filter, unsigned int numberOfBlocks, vector<unsigned int>* articles)
+{
+	vector<unsigned int> keyOffsets(_numberOfArticles + 1);
+	keyPrefixes->resize(_numberOfArticles);
+	
+	// the offsets are written again when all keys are known
+	off_t start = ftello(f);
+	if ( fwrite(&keyOffsets[0], sizeof(unsigned int), keyOffsets.size(), f)!=keyOffsets.size() )
+		return -1;
+	
+	unsigned int length = 0;
+	for (int i=0; i<_numberOfArticles; i++)
+	{
+		string key = NormalizedTitle(GetTitle(i, indexNo), indexNo);
+		if ( key.length()>0xffffffff - length )
+			return -1;
+		
+		keyOffsets[i] = length;
+		(*keyPrefixes)[i] = KeyPrefix(key.c_str(), key.length());
+		if ( filter )
+			FilterAdd(&(*filter)[0], numberOfBlocks, FilterHash(key.c_str(), key.length()));
+		if ( articles && key.find(":")==string::npos )
+			articles->push_back(i);
+		
+		if ( fwrite(key.c_str(), 1, key.length(), f)!=key.length() )
+			return -1;
+		
+		length += key.length();
+	}
+	keyOffsets[_numberOfArticles] = length;
+	
+	off_t end = ftello(f);
+	if ( fseeko(f, start, SEEK_SET) || fwrite(&keyOffsets[0], sizeof(unsigned int), keyOffsets.size(), f)!=keyOffsets.size() || fseeko(f, end, SEEK_SET) )
+		return -1;
+	
+	return end - start;
+}
+
+static inline int GallopBound(const unsigned long long* values, int count, unsigned long long value)
+{
+	// like LowerBound, but cheap if the result is close to the start
+	int lBound = 0;
+	int uBound = 1;
+	while ( uBound<=count && values[uBound-1]<value )
+	{
+		lBound = uBound;
+		uBound <<= 1;
+	}
+	
+	return lBound + LowerBound(values + lBound, min(uBound, count) - lBound, value);
+}
+
+bool TitleIndex::PrefixRange(int indexNo, const string& key, int* lBound, int* uBound)
+{
+	// the part of the index where the titles start with the same 8 bytes as key
+	const unsigned long long* keyPrefixes = _keyPrefixes[indexNo];
+	if ( !keyPrefixes )
+		return false;
+	
+	unsigned long long prefix = KeyPrefix(key.c_str(), key.length());
+	
+	const unsigned int* keyJumps = _keyJumps[indexNo];
+	if ( keyJumps )
+	{
+		// the two leading bytes select the part of the index to search, so a short key costs
+		// (nearly) nothing, no matter how many titles start with it
+		unsigned int jump = (unsigned int) (prefix >> 48);
+		*lBound = keyJumps[jump] + LowerBound(keyPrefixes + keyJumps[jump], keyJumps[jump + 1] - keyJumps[jump], prefix);
+	}
+	else
+		*lBound = LowerBound(keyPrefixes, _numberOfArticles, prefix);
+	if ( prefix==0xffffffffffffffffULL )
+		*uBound = _numberOfArticles;
+	else
+		*uBound = *lBound + GallopBound(keyPrefixes + *lBound, _numberOfArticles - *lBound, prefix + 1);
+	
+	return true;
+}
+
+int TitleIndex::LowerBoundKey(TITLEWINDOW* window, int lBound, int uBound, const string& key, bool upper, int* probes)
+{
+	// binary search for the first title of [lBound, uBound) which isn't less (upper: greater) than key
+	while ( lBound<uBound )
+	{
+		int index = (lBound + uBound) >> 1;
+		
+		int result = CompareKey(window, index, key, false);
+		(*probes)++;
+		
+		if ( result>0 || (upper && result==0) )
+			lBound = index + 1;
+		else
+			uBound = index;
+	}
+	
+	return lBound;
+}
+
+int TitleIndex::GallopKey(TITLEWINDOW* window, int lBound, const string& key, bool upper, int* probes)
+{
+	// like LowerBoundKey for [lBound, numberOfArticles), but cheap if the result is close to lBound
+	int start = lBound;
+	int uBound = lBound + 1;
+	while ( uBound<=_numberOfArticles )
+	{
+		int result = CompareKey(window, uBound-1, key, false);
+		(*probes)++;
+		
+		if ( result<0 || (!upper && result==0) )
+			return LowerBoundKey(window, lBound, uBound-1, key, upper, probes);
+		
+		lBound = uBound;
+		uBound = start + ((uBound - start) << 1);
+	}
+	
+	return LowerBoundKey(window, lBound, _numberOfArticles, key, upper, probes);
+}
+
+bool TitleIndex::StoredKey(int indexNo, int index, const char** key, size_t* length)
+{
+	const unsigned int* keyOffsets = _keyOffsets[indexNo];
+	if ( !keyOffsets || index<0 || index>=_numberOfArticles )
+		return false;
+	
+	*key = _keys[indexNo] + keyOffsets[index];
+	*length = keyOffsets[index+1] - keyOffsets[index];
+	
+	return true;
+}
+
+string TitleIndex::Key(int index, int indexNo)
+{
+	const char* key;
+	size_t length;
+	
+	if ( StoredKey(indexNo, index, &key, &length) )
+		return string(key, length);
+	
+	return NormalizedTitle(GetTitle(index, indexNo), indexNo);
+}
+
+int TitleIndex::CompareKey(TITLEWINDOW* window, int index, const string& key, bool prefix)
+{
+	// compares key with the normalized title at index like string::compare does; if prefix is set only
+	// the beginning of the title is used
+	const char* titleKey;
+	size_t length;
+	string title;
+	
+	if ( !StoredKey(window->indexNo, index, &titleKey, &length) )
+	{
+		title = NormalizedTitle(WindowTitle(window, index), window->indexNo);
+		titleKey = title.c_str();
+		length = title.length();
+	}
+	
+	if ( prefix && length>key.length() )
+		length = key.length();
+	
+	int result = memcmp(key.c_str(), titleKey, min(length, key.length()));
+	if ( result )
+		return result;
+	
+	if ( key.length()<length )
+		return -1;
+	
+	return key.length()>length;
+}
+
+void TitleIndex::BuildFilter(size_t memory)
+{
+	if ( _numberOfArticles<=0 )
+		return;
+	
+	// less bits per title if the memory is short, below 4 bits the filter is useless
+	unsigned int numberOfBlocks = 0;
+	for (int bitsPerKey=FILTER_BITS_PER_KEY; bitsPerKey>=4 && !numberOfBlocks; bitsPerKey--)
+	{
+		long long blocks = ((long long) _numberOfArticles*bitsPerKey + 511)/512;
+		if ( (size_t) blocks*FILTER_BLOCK_WORDS*sizeof(unsigned long long)<=memory )
+			numberOfBlocks = blocks;
+	}
+	
+	if ( !numberOfBlocks )
+		return;
+	
+	unsigned long long* filter = (unsigned long long*) calloc(numberOfBlocks*FILTER_BLOCK_WORDS, sizeof(unsigned long long));
+	if ( !filter )
+		return;
+	
+	for (int i=0; i<_numberOfArticles; i++)
+	{
+		string key = Key(i, 0);
+		FilterAdd(filter, numberOfBlocks, FilterHash(key.c_str(), key.length()));
+	}
+	
+	_filter = filter;
+	_filterBlocks = numberOfBlocks;
+	_filterAllocated = true;
+}
+
+void TitleIndex::DeleteFilter()
+{
+	if ( _filter && _filterAllocated )
+		free((void*) _filter);
+	
+	_filter = NULL;
+	_filterBlocks = 0;
+	_filterAllocated = false;
+}
+
+bool TitleIndex::MayExist(const string& key)
+{
+	// false if there is no title with this (normalized) key for sure
+	if ( !_filter )
+		return true;
+	
+	return FilterTest(_filter, _filterBlocks, FilterHash(key.c_str(), key.length()));
+}
+
+void TitleIndex::BuildFences(int indexNo, size_t memory)
+{
+	FENCES* fences = &_fences[indexNo];
+	
+	if ( _numberOfArticles<=0 || !memory )
+		return;
+	
+	// guess the stride assuming 32 bytes per fence, take a larger one if the titles are longer
+	int stride = MIN_FENCE_STRIDE;
+	while ( stride<_numberOfArticles && ((size_t) (_numberOfArticles/stride + 1) * 32)>memory )
+		stride <<= 1;
+	
+	while ( stride<_numberOfArticles )
+	{
+		int count = (_numberOfArticles + stride - 1) / stride;
+		
+		fences->keyPos = (int*) malloc(count * sizeof(int));
+		fences->keys = (char*) malloc(memory);
+		if ( !fences->keyPos || !fences->keys )
+			break;
+		
+		size_t used = count * sizeof(int);
+		size_t keysLength = 0;
+		
+		int i;
+		for (i=0; i<count; i++)
+		{
+			string key = Key(i*stride, indexNo);
+			
+			used += key.length() + 1;
+			if ( used>memory )
+				break;
+			
+			fences->keyPos[i] = keysLength;
+			memcpy(fences->keys + keysLength, key.c_str(), key.length() + 1);
+			keysLength += key.length() + 1;
+		}
+		
+		if ( i==count )
+		{
+			fences->keys = (char*) realloc(fences->keys, keysLength);
+			fences->stride = stride;
+			fences->count = count;
+			
+			return;
+		}
+		
+		// doesn't fit, try it with half the number of fences
+		DeleteFences(indexNo);
+		stride <<= 1;
+	}
+	
+	DeleteFences(indexNo);
+}
+
+void TitleIndex::DeleteFences(int indexNo)
+{
+	FENCES* fences = &_fences[indexNo];
+	
+	if ( fences->keys )
+		free(fences->keys);
+	if ( fences->keyPos )
+		free(fences->keyPos);
+	
+	memset(fences, 0, sizeof(FENCES));
+}
+
+static int SearchDepth(int count)
+{
+	// the number of probes of a binary search over count entries (worst case)
+	int depth = 0;
+	while ( count>0 )
+	{
+		depth++;
+		count >>= 1;
+	}
+	
+	return depth;
+}
+
+int TitleIndex::OpenWindow(string key, TITLEWINDOW* window)
+{
+	// limits a search for key to the entries between two fences and reads their index entries;
+	// returns the number of probes saved by this
+	FENCES* fences = &_fences[window->indexNo];
+	
+	window->first = 0;
+	window->count = 0;
+	window->titlePos.clear();
+	
+	if ( !fences->count )
+		return 0;
+	
+	// the first fence behind the key
+	int lBound = 0;
+	int uBound = fences->count;
+	while ( lBound<uBound )
+	{
+		int index = (lBound + uBound) >> 1;
+		
+		if ( strcmp(fences->keys + fences->keyPos[index], key.c_str())<=0 )
+			lBound = index + 1;
+		else
+			uBound = index;
+	}
+	
+	// the window includes both fences so the search always ends next to the key
+	int first = 0;
+	if ( lBound>0 )
+		first = (lBound - 1) * fences->stride;
+	
+	int last = lBound * fences->stride;
+	if ( last>_numberOfArticles-1 )
+		last = _numberOfArticles - 1;
+	
+	window->first = first;
+	window->count = last - first + 1;
+	window->titlePos.resize(window->count);
+	
+	if ( _keyOffsets[window->indexNo] || window->titlePos.size()>MAX_WINDOW_SIZE || !ReadTitlePositions(window->indexNo, first, window->titlePos.size(), &window->titlePos[0]) )
+	{
+		// the titles are read one by one
+		window->titlePos.clear();
+	}
+	
+	return SearchDepth(_numberOfArticles) - SearchDepth(window->count);
+}
 
-	int indexNo = 0;
+string TitleIndex::WindowTitle(TITLEWINDOW* window, int index)
+{
+	if ( index>=window->first && index<(window->first + (int) window->titlePos.size()) )
+		return ReadTitle(window->titlePos[index - window->first], NULL);
+	
+	return GetTitle(index, window->indexNo);
+}
+
+void TitleIndex::AddStatistics(int probes, int probesSaved, int lookups, int filterRejects)
+{
+	// called by every lookup of every thread, a lock would make them wait for each other
+	if ( lookups )
+		__sync_fetch_and_add(&_lookups, lookups);
+	if ( filterRejects )
+		__sync_fetch_and_add(&_filterRejects, filterRejects);
+	if ( probes )
+		__sync_fetch_and_add(&_probes, probes);
+	if ( probesSaved )
+		__sync_fetch_and_add(&_probesSaved, probesSaved);
+}
+
+string TitleIndex::GetStatistics()
+{
+	char buffer[256];
+	
+	snprintf(buffer, sizeof(buffer), "lookups:%ld\nprobes:%ld\nprobesSaved:%ld\nfilterRejects:%ld\nfences:%d,%d\nfenceStride:%d,%d\nfilterBlocks:%u", _lookups, _probes, _probesSaved, _filterRejects, _fences[0].count, _fences[1].count, _fences[0].stride, _fences[1].stride, _filterBlocks);
+	
+	return string(buffer);
+}
+
+bool TitleIndex::FindRange(string lowercaseTitle, int* startIndex, int* endIndex)
+{
+	if ( !MayExist(lowercaseTitle) )
+	{
+		AddStatistics(0, SearchDepth(_numberOfArticles), 1, 1);
+		return false;
+	}
+	
+	TITLEWINDOW window;
+	window.indexNo = 0;
+	window.first = 0;
+	window.count = 0;
+	
+	if ( PrefixRange(window.indexNo, lowercaseTitle, startIndex, endIndex) )
+	{
+		// a shorter title can only match if the prefixes are equal, a longer one has to be
+		// searched within the titles with the same prefix
+		int probes = 0;
+		if ( lowercaseTitle.length()>=8 )
+		{
+			*startIndex = LowerBoundKey(&window, *startIndex, *endIndex, lowercaseTitle, false, &probes);
+			*endIndex = LowerBoundKey(&window, *startIndex, *endIndex, lowercaseTitle, true, &probes);
+		}
+		
+		AddStatistics(probes, max(SearchDepth(_numberOfArticles) - probes, 0));
+		
+		(*endIndex)--;
+		return *startIndex<=*endIndex;
+	}
+	
+	int probesSaved = OpenWindow(lowercaseTitle, &window);
+	int probes = 0;
 	
-	string lowercaseTitle = CPPStringUtils::to_lower_utf8(title);
 	int foundAt = -1;
 	int lBound = 0;
 	int uBound = _numberOfArticles - 1;
 	int index = 0;	
+	
+	if ( window.count )
+	{
+		lBound = window.first;
+		uBound = window.first + window.count - 1;
+	}
 
 	while ( lBound<=uBound )
 	{	
 		index = (lBound + uBound) >> 1;
 		
-		// get the title at the specific index
-		string titleAtIndex = GetTitle(f, index, indexNo);
-		
-		// make it lowercase and skip the prefix
-		titleAtIndex = CPPStringUtils::to_lower_utf8(titleAtIndex);
+		// compare with the lowercase title at the specific index
+		int result = CompareKey(&window, index, lowercaseTitle, false);
+		probes++;
 		
-		if ( lowercaseTitle<titleAtIndex )
+		if ( result<0 )
 			uBound = index - 1;
-		else if ( lowercaseTitle>titleAtIndex )
+		else if ( result>0 )
 			lBound = ++index;
 		else
 		{
@@ -160,98 +1126,259 @@ ArticleSearchResult* TitleIndex::FindArticle(string title, bool multiple)
 		}
 	}
 	
-	if ( foundAt<0 )
+	if ( foundAt<0 )
+	{
+		AddStatistics(probes, probesSaved);
+		return false;
+	}
+	
+	// check if there are more than one articles with the same lowercase name
+	*startIndex = foundAt;
+	while ( *startIndex>0 )
+	{
+		probes++;
+		if ( CompareKey(&window, *startIndex-1, lowercaseTitle, false) )
+			break;
+			
+		(*startIndex)--;
+	}
+
+	*endIndex = foundAt;
+	while ( *endIndex<(_numberOfArticles-1) )
+	{
+		probes++;
+		if ( CompareKey(&window, *endIndex+1, lowercaseTitle, false) )
+			break;
+		
+		(*endIndex)++;
+	}
+	
+	AddStatistics(probes, probesSaved);
+	
+	return true;
+}
+
+bool TitleIndex::FindArticle(string title, ArticleSearchResult& result)
+{
+	if ( _numberOfArticles<=0  )
+		return false;
+	
+	int startIndex;
+	int endIndex;
+	if ( !FindRange(CPPStringUtils::to_lower_utf8(title), &startIndex, &endIndex) )
+		return false;
+	
+	ARTICLEPOSITION position;
+	
+	// return a result only if we have a direct hit (case is taken into account)
+	if ( startIndex!=endIndex )
+	{
+		// check if one matches 100%
+		for(int i=startIndex; i<=endIndex; i++)
+		{		
+			string titleInArchive = GetTitle(i, 0, &position);
+			if ( title==titleInArchive )
+			{
+				result = ArticleSearchResult(title, titleInArchive, position.blockPos, position.articlePos, position.articleLength);
+				return true;
+			}
+		}
+		
+		// nope, multiple matches
+		return false;
+	}
+	
+	// return the one and only result
+	string titleInArchive = GetTitle(startIndex, 0, &position);
+	result = ArticleSearchResult(title, titleInArchive, position.blockPos, position.articlePos, position.articleLength);
+	
+	return true;
+}
+
+int TitleIndex::FindArticles(string title, vector<ArticleSearchResult>& results)
+{
+	results.clear();
+	
+	if ( _numberOfArticles<=0  )
+		return 0;
+	
+	int startIndex;
+	int endIndex;
+	if ( !FindRange(CPPStringUtils::to_lower_utf8(title), &startIndex, &endIndex) )
+		return 0;
+	
+	ARTICLEPOSITION position;
+	for(int i=startIndex; i<=endIndex; i++)
 	{
-		fclose(f);
+		string titleInArchive = GetTitle(i, 0, &position);
 		
-		return NULL;
+		if ( title==titleInArchive )
+		{
+			// 100% match
+			results.clear();
+			results.push_back(ArticleSearchResult(title, titleInArchive, position.blockPos, position.articlePos, position.articleLength));
+			
+			return 1;
+		}
+		
+		// collect the results
+		results.push_back(ArticleSearchResult(title, titleInArchive, position.blockPos, position.articlePos, position.articleLength));
 	}
 	
-	// check if there are more than one articles with the same lowercase name
-	int startIndex = foundAt;
-	while ( startIndex>0 )
-	{
-		string titleAtIndex = GetTitle(f, startIndex-1, indexNo);
-		titleAtIndex = CPPStringUtils::to_lower_utf8(titleAtIndex);
+	return results.size();
+}
+
+bool TitleIndex::ArticleExists(string title)
+{
+	// case is ignored, there is at least a list of articles to choose from
+	if ( _numberOfArticles<=0 )
+		return false;
 	
-		if ( lowercaseTitle!=titleAtIndex )
-			break;
-			
-		startIndex--;
-	}
+	int startIndex;
+	int endIndex;
+	return FindRange(CPPStringUtils::to_lower_utf8(title), &startIndex, &endIndex);
+}
 
-	int endIndex = foundAt;
-	while ( endIndex<(_numberOfArticles-1) )
+int TitleIndex::ResolveTitles(const vector<string>& titles, vector<int>& matches)
+{
+	matches.assign(titles.size(), 0);
+	
+	if ( _numberOfArticles<=0 || titles.empty() )
+		return 0;
+	
+	// normalize and sort the titles once, so the index can be swept from front to back
+	vector< pair<string, int> > keys(titles.size());
+	for (size_t i=0; i<titles.size(); i++)
 	{
-		string titleAtIndex = GetTitle(f, endIndex+1, indexNo);
-		titleAtIndex = CPPStringUtils::to_lower_utf8(titleAtIndex);
-		
-		if ( lowercaseTitle!=titleAtIndex )
-			break;
-		
-		endIndex++;
+		keys[i].first = CPPStringUtils::to_lower_utf8(titles[i]);
+		keys[i].second = i;
 	}
+	sort(keys.begin(), keys.end());
 	
-	if ( !multiple )
+	TITLEWINDOW window;
+	window.indexNo = 0;
+	window.first = 0;
+	window.count = 0;
+	
+	const unsigned long long* keyPrefixes = _keyPrefixes[window.indexNo];
+	
+	int probes = 0;
+	int found = 0;
+	int lookups = 0;
+	int filterRejects = 0;
+	
+	// every key starts its search behind the titles of the previous one
+	int lBound = 0;
+	for (size_t i=0; i<keys.size(); i++)
 	{
-		// return a result only if we have a direct hit (case is taken into account)
+		const string& key = keys[i].first;
 		
-		if ( startIndex!=endIndex )
+		if ( i>0 && key==keys[i-1].first )
 		{
-			// check if one matches 100%
-			for(int i=startIndex; i<=endIndex; i++)
-			{		
-				string titleInArchive = GetTitle(f, i, indexNo);
-				if ( title==titleInArchive )
-				{					
-					fclose(f);
-					
-					return new ArticleSearchResult(title, titleInArchive, _lastBlockPos, _lastArticlePos, _lastArticleLength);
-				}
-			}
-		
-			// nope, multiple matches
-			fclose(f);
-
-			return NULL;
+			matches[keys[i].second] = matches[keys[i-1].second];
+			if ( matches[keys[i].second] )
+				found++;
+			
+			continue;
 		}
-		else
+		lookups++;
+		
+		if ( !MayExist(key) )
 		{
-			// return the one and only result
-			string titleInArchive = GetTitle(f, foundAt, indexNo);		
-			fclose(f);
-
-			return new ArticleSearchResult(title, titleInArchive, _lastBlockPos, _lastArticlePos, _lastArticleLength);
+			filterRejects++;
+			continue;
 		}
-	}
-	else
-	{
-		ArticleSearchResult* result = NULL;
-		for(int i=startIndex; i<=endIndex; i++)
+		
+		// galloping only pays if the titles are close to each other, otherwise every step is a cache miss
+		// (or a disk read) and a normal search of the remaining part is cheaper
+		bool close = (_numberOfArticles - lBound)/(int) (keys.size() - i)<GALLOP_DISTANCE;
+		
+		int start;
+		int end;
+		if ( keyPrefixes )
 		{
-			string titleInArchive = GetTitle(f, i, indexNo);
+			unsigned long long prefix = KeyPrefix(key.c_str(), key.length());
 			
-			if ( title==titleInArchive )
+			if ( close )
+				start = lBound + GallopBound(keyPrefixes + lBound, _numberOfArticles - lBound, prefix);
+			else
+				start = lBound + LowerBound(keyPrefixes + lBound, _numberOfArticles - lBound, prefix);
+			
+			end = _numberOfArticles;
+			if ( prefix!=0xffffffffffffffffULL )
+				end = start + GallopBound(keyPrefixes + start, _numberOfArticles - start, prefix + 1);
+			
+			if ( key.length()>=8 )
 			{
-				// 100% match
-				DeleteSearchResult(result);
-				
-				fclose(f);
+				start = LowerBoundKey(&window, start, end, key, false, &probes);
+				end = LowerBoundKey(&window, start, end, key, true, &probes);
+			}
+		}
+		else if ( !close && _fences[window.indexNo].count )
+		{
+			OpenWindow(key, &window);
+			
+			start = LowerBoundKey(&window, max(lBound, window.first), window.first + window.count, key, false, &probes);
 
-				return new ArticleSearchResult(title, titleInArchive, _lastBlockPos, _lastArticlePos, _lastArticleLength);
+			// the window starts at a fence equal to the key; titles equal to it can be in front of it
+			if ( start==window.first )
+			{
+				while ( start>lBound && !CompareKey(&window, start-1, key, false) )
+				{
+					start--;
+					probes++;
+				}
 			}
 
-			// collect the results
-			if ( !result )
-				result = new ArticleSearchResult(title, titleInArchive, _lastBlockPos, _lastArticlePos, _lastArticleLength);
-			else
-				result->Next = new ArticleSearchResult(title, titleInArchive, _lastBlockPos, _lastArticlePos, _lastArticleLength);
+			end = GallopKey(&window, start, key, true, &probes);
+		}
+		else
+		{
+			start = GallopKey(&window, lBound, key, false, &probes);
+			end = GallopKey(&window, start, key, true, &probes);
 		}
 		
-		fclose(f);
+		matches[keys[i].second] = end - start;
+		if ( end>start )
+			found++;
 		
-		return result;
+		lBound = end;
+	}
+	
+	AddStatistics(probes, max(lookups*SearchDepth(_numberOfArticles) - probes, 0), lookups, filterRejects);
+	
+	return found;
+}
+
+ArticleSearchResult* TitleIndex::FindArticle(string title, bool multiple)
+{
+	if ( !multiple )
+	{
+		ArticleSearchResult result;
+		if ( !FindArticle(title, result) )
+			return NULL;
+		
+		return new ArticleSearchResult(result);
+	}
+	
+	vector<ArticleSearchResult> results;
+	FindArticles(title, results);
+	
+	// build the linked list in the order of the index
+	ArticleSearchResult* first = NULL;
+	ArticleSearchResult* last = NULL;
+	for (size_t i=0; i<results.size(); i++)
+	{
+		ArticleSearchResult* result = new ArticleSearchResult(results[i]);
+		if ( last )
+			last->Next = result;
+		else
+			first = result;
+		
+		last = result;
 	}
+	
+	return first;
 }
 
 void TitleIndex::DeleteSearchResult(ArticleSearchResult* articleSearchResult)
@@ -275,6 +1402,106 @@ int TitleIndex::NumberOfArticles()
 	return _numberOfArticles;
 }
 
+bool TitleIndex::SuggestionRange(const string& key, int* lBound, int* uBound)
+{
+	// the range of the longest phrase searched lately the key starts with (the titles of the
+	// key can only be in there)
+	bool found = false;
+	size_t length = 0;
+	
+	pthread_mutex_lock(&_suggestionMutex);
+	
+	for (size_t i=0; i<_suggestionRanges.size(); i++)
+	{
+		SUGGESTIONRANGE* range = &_suggestionRanges[i];
+		if ( range->key.length()<length || range->key.length()>key.length() || key.compare(0, range->key.length(), range->key) )
+			continue;
+		
+		*lBound = range->first;
+		*uBound = range->last;
+		length = range->key.length();
+		found = true;
+		
+		range->used = ++_suggestionRangesUsed;
+	}
+	
+	pthread_mutex_unlock(&_suggestionMutex);
+	
+	return found;
+}
+
+void TitleIndex::AddSuggestionRange(const string& key, int lBound, int uBound)
+{
+	pthread_mutex_lock(&_suggestionMutex);
+	
+	// replaces the same key or the one used least recently
+	int slot = -1;
+	for (size_t i=0; i<_suggestionRanges.size(); i++)
+	{
+		if ( _suggestionRanges[i].key==key )
+		{
+			slot = i;
+			break;
+		}
+		
+		if ( slot<0 || _suggestionRanges[i].used<_suggestionRanges[slot].used )
+			slot = i;
+	}
+	
+	if ( _suggestionRanges.size()<SUGGESTION_RANGES && (slot<0 || _suggestionRanges[slot].key!=key) )
+	{
+		slot = _suggestionRanges.size();
+		_suggestionRanges.resize(slot + 1);
+	}
+	
+	SUGGESTIONRANGE* range = &_suggestionRanges[slot];
+	range->key = key;
+	range->first = lBound;
+	range->last = uBound;
+	range->used = ++_suggestionRangesUsed;
+	
+	pthread_mutex_unlock(&_suggestionMutex);
+}
+
+int TitleIndex::PrefixEnd(TITLEWINDOW* window, int lBound, int uBound, const string& key, int* probes)
+{
+	// the first title of [lBound, uBound) behind the ones starting with key (all titles in front of
+	// lBound have to start with key); galloping, so a short run of titles is cheap
+	int start = lBound;
+	int step = 1;
+	while ( lBound<uBound )
+	{
+		int index = min(start + step - 1, uBound - 1);
+		
+		int result = CompareKey(window, index, key, true);
+		(*probes)++;
+		
+		if ( result<0 )
+		{
+			uBound = index;
+			break;
+		}
+		
+		lBound = index + 1;
+		step <<= 1;
+	}
+	
+	while ( lBound<uBound )
+	{
+		int index = (lBound + uBound) >> 1;
+		
+		int result = CompareKey(window, index, key, true);
+		(*probes)++;
+		
+		if ( result<0 )
+			uBound = index;
+		else
+			lBound = index + 1;
+	}
+	
+	return lBound;
+}
+
 string TitleIndex::GetSuggestions(string phrase, int maxSuggestions)
 {
 	string suggestions = string();
@@ -289,129 +1516,108 @@ string TitleIndex::GetSuggestions(string phrase, int maxSuggestions)
 	
 	string lowercasePhrase = PrepareSearchPhrase(phrase);
 	
-	int phraseLength = lowercasePhrase.length();
-	if ( phraseLength==0 )
+	if ( lowercasePhrase.empty() )
 		return suggestions;
 	
-	FILE* f = fopen(_dataFileName.c_str(), "rb");
-	if ( !f )
-		return suggestions;
-		
+	TITLEWINDOW window;
+	window.indexNo = indexNo;
+	window.first = 0;
+	window.count = 0;
+	
 	int foundAt = -1;
-	int lBound = 0;
-	int uBound = _numberOfArticles - 1;
-	int index = 0;	
-	string titleAtIndex;
+	int lBound;
+	int uBound;
 	
-	while ( lBound<=uBound )
-	{	
-		index = (lBound + uBound) >> 1;
+	// while typing every phrase extends the one before, its titles are in the range of that one
+	int rangeEnd = _numberOfArticles;
+	if ( SuggestionRange(lowercasePhrase, &lBound, &rangeEnd) )
+	{
+		int probes = 0;
+		lBound = LowerBoundKey(&window, lBound, rangeEnd, lowercasePhrase, false, &probes);
+		
+		AddStatistics(probes, max(SearchDepth(_numberOfArticles) - probes, 0));
+		
+		if ( lBound>=rangeEnd || CompareKey(&window, lBound, lowercasePhrase, true) )
+		{
+			AddSuggestionRange(lowercasePhrase, lBound, lBound);
+			return suggestions;
+		}
 		
-		// get the title at the specific index
-		titleAtIndex = GetTitle(f, index, indexNo);
+		foundAt = lBound;
+	}
+	else if ( PrefixRange(indexNo, lowercasePhrase, &lBound, &uBound) )
+	{
+		// all titles in front of lBound are less than the phrase; if the phrase is longer than the
+		// prefix the titles with the same prefix have to be searched
+		int probes = 0;
+		if ( lowercasePhrase.length()>=8 )
+			lBound = LowerBoundKey(&window, lBound, uBound, lowercasePhrase, false, &probes);
 		
-		titleAtIndex = PrepareSearchPhrase(titleAtIndex);
+		AddStatistics(probes, max(SearchDepth(_numberOfArticles) - probes, 0));
 		
-		if ( lowercasePhrase<titleAtIndex )
-			uBound = index - 1;
-		else if ( lowercasePhrase>titleAtIndex )
-			lBound = index + 1;
-		else
+		// the first title not less than the phrase is the only candidate
+		if ( lBound>=_numberOfArticles || CompareKey(&window, lBound, lowercasePhrase, true) )
 		{
-			foundAt = index;
-			break;
+			AddSuggestionRange(lowercasePhrase, lBound, lBound);
+			return suggestions;
 		}
+		
+		foundAt = lBound;
 	}
-	
-	if ( foundAt<0 )
+	else
 	{
-		if ( titleAtIndex.length()>phraseLength )
-			titleAtIndex = titleAtIndex.substr(0, phraseLength);
+		int probesSaved = OpenWindow(lowercasePhrase, &window);
+		int probes = 0;
 		
-		if ( lowercasePhrase>titleAtIndex )
+		lBound = 0;
+		uBound = _numberOfArticles;
+		if ( window.count )
 		{
-			// last one?
-			if ( index==_numberOfArticles-1) 
-			{
-				fclose(f);
-				return suggestions;
-			}
-			
-			// no
-			index++;
-			titleAtIndex = GetTitle(f, index, indexNo);
-			
-			titleAtIndex = PrepareSearchPhrase(titleAtIndex);
-						
-			if ( titleAtIndex.length()>phraseLength )
-				titleAtIndex = titleAtIndex.substr(0, phraseLength);
-			
-			if ( lowercasePhrase!=titleAtIndex )
-			{
-				// still not starting with the phrase?
-				fclose(f);
-				return suggestions;
-			}
+			lBound = window.first;
+			uBound = window.first + window.count;
 		}
-		else if ( lowercasePhrase<titleAtIndex )
+		
+		// the titles starting with the phrase follow each other, the first of them is the first title
+		// not less than the phrase; no need to walk back to it
+		lBound = LowerBoundKey(&window, lBound, uBound, lowercasePhrase, false, &probes);
+		
+		// the window starts at a fence equal to the phrase; titles equal to it can be in front of it
+		if ( window.count && lBound==window.first )
 		{
-			// first one?
-			if ( index==0 ) 
-			{
-				fclose(f);
-				return suggestions;
-			}
-			
-			// no
-			index--;
-			titleAtIndex = GetTitle(f, index, indexNo);
-			titleAtIndex = PrepareSearchPhrase(titleAtIndex);
-			
-			if ( titleAtIndex.length()>phraseLength )
-				titleAtIndex = titleAtIndex.substr(0, phraseLength);
-			
-			if ( lowercasePhrase!=titleAtIndex )
+			while ( lBound>0 && !CompareKey(&window, lBound-1, lowercasePhrase, false) )
 			{
-				// still not starting with the phrase?
-				fclose(f);
-				return suggestions;
+				lBound--;
+				probes++;
 			}
 		}
 		
-		foundAt = index;
-	}
-	
-	// go to the first article which starts with the phrase
-	int startIndex = foundAt;
-	while ( startIndex>0 )
-	{
-		string titleAtIndex = GetTitle(f, startIndex-1, indexNo);
-		titleAtIndex = PrepareSearchPhrase(titleAtIndex);
-		
-		if ( titleAtIndex.length()>phraseLength )
-			titleAtIndex = titleAtIndex.substr(0, phraseLength);
+		AddStatistics(probes, probesSaved);
 		
-		if ( lowercasePhrase!=titleAtIndex )
-			break;
+		if ( lBound>=_numberOfArticles || CompareKey(&window, lBound, lowercasePhrase, true) )
+		{
+			AddSuggestionRange(lowercasePhrase, lBound, lBound);
+			return suggestions;
+		}
 		
-		startIndex--;
+		foundAt = lBound;
 	}
 	
+	// remember where the titles of the phrase end for the next keystroke
+	int probes = 0;
+	AddSuggestionRange(lowercasePhrase, foundAt, PrefixEnd(&window, foundAt + 1, rangeEnd, lowercasePhrase, &probes));
+	AddStatistics(probes, 0, 0);
+	
+	// stream the titles from the first one starting with the phrase
+	int startIndex = foundAt;
 	int results = 0;
 	while ( startIndex<(_numberOfArticles-1) && results<maxSuggestions )
 	{
-		string suggestion = GetTitle(f, startIndex, indexNo);
-		titleAtIndex = PrepareSearchPhrase(suggestion);
-		
-		if ( titleAtIndex.length()>phraseLength )
-			titleAtIndex = titleAtIndex.substr(0, phraseLength);
-			
-		if ( lowercasePhrase!=titleAtIndex )
+		if ( CompareKey(&window, startIndex, lowercasePhrase, true) )
 			break;
 
 		if ( !suggestions.empty() )
 			suggestions += "\n";
-		suggestions += suggestion;
+		suggestions += WindowTitle(&window, startIndex);
 		
 		startIndex++;
 		results++;
@@ -422,19 +1628,11 @@ string TitleIndex::GetSuggestions(string phrase, int maxSuggestions)
 		// check if the next would also meet
 		startIndex++;
 		
-		string suggestion = GetTitle(f, startIndex, indexNo);
-		titleAtIndex = PrepareSearchPhrase(suggestion);
-		
-		if ( titleAtIndex.length()>phraseLength )
-			titleAtIndex = titleAtIndex.substr(0, phraseLength);
-
 		// yes, add an empty line at the end of the list
-		if ( lowercasePhrase==titleAtIndex )
+		if ( !CompareKey(&window, startIndex, lowercasePhrase, true) )
 			suggestions += "\n";
 	}
 
-	fclose(f);
-
 	return suggestions;
 }
 
@@ -443,25 +1641,45 @@ string TitleIndex::GetRandomArticleTitle()
 	if ( _numberOfArticles<=0 )
 		return string();
 	
-	FILE* f = fopen(_dataFileName.c_str(), "rb");
-	if ( !f )
+	pthread_mutex_lock(&_articlesMutex);
+	
+	// without an index file the table is made when it's needed first
+	if ( _numberOfMainArticles<0 )
+		BuildMainArticles();
+	
+	int numberOfMainArticles = _numberOfMainArticles;
+	const unsigned int* articles = _articles;
+	
+	pthread_mutex_unlock(&_articlesMutex);
+	
+	if ( numberOfMainArticles<=0 )
 		return string();
 	
-	int j = 20;
-	while ( j-- )
+	int i = (int) ((double) random() / ((double) RAND_MAX + 1) * numberOfMainArticles);
+	return GetTitle(articles[i], 0);
+}
+
+void TitleIndex::BuildMainArticles()
+{
+	_mainArticles.clear();
+	for (int i=0; i<_numberOfArticles; i++)
 	{
-		int i = (int) ((double) random() / RAND_MAX * _numberOfArticles);
-		string result = GetTitle(f, i, 0);
-		
-		if ( result.find(":")==string::npos )
-		{
-			fclose(f);
-			return result;
-		}
+		if ( Key(i, 0).find(":")==string::npos )
+			_mainArticles.push_back(i);
 	}
 	
-	fclose(f);
-	return string();
+	_articles = _mainArticles.empty() ? NULL : &_mainArticles[0];
+	_numberOfMainArticles = _mainArticles.size();
+}
+
+size_t TitleIndex::MaxBlockSize()
+{
+	return _maxBlockSize;
+}
+
+BlockCodec* TitleIndex::Codec()
+{
+	return _codec;
 }
 
 string TitleIndex::ImageNamespace()
@@ -474,46 +1692,144 @@ string TitleIndex::TemplateNamespace()
 	return _templateNamespace;
 }
 
-string TitleIndex::GetTitle(FILE* f, int articleNumber, int indexNo)
+bool TitleIndex::ReadTitlePositions(int indexNo, int first, int count, long long* titlePos)
 {
-	_lastBlockPos = 0;
-	_lastArticlePos = 0;
-	_lastArticleLength = 0;					  
-						  
-	if ( !f || articleNumber<0 || articleNumber>=_numberOfArticles  )
-		return string();
-	
-	int indexPos = _indexPos_0;
+	off_t indexPos = _indexPos_0;
 	if ( indexNo==1 && _indexPos_1 )
 		indexPos = _indexPos_1;
 	
-	int error = fseeko(f, indexPos + articleNumber*sizeof(int), SEEK_SET);
-	if ( error )
-		return string();
-
-	int titlePos;
-	size_t read = fread(&titlePos, sizeof(int), 1, f);
+	indexPos += (off_t) first*_slotSize;
+	size_t size = count*_slotSize;
+	
+	if ( _mapping )
+	{
+		const unsigned char* slots = Mapped(indexPos, size);
+		if ( !slots )
+			return false;
+		
+		memcpy(titlePos, slots, size);
+	}
+	// pread doesn't touch the file offset, so concurrent lookups don't disturb each other
+	else if ( _fd<0 || pread(_fd, titlePos, size, indexPos)!=(ssize_t) size )
+		return false;
+	
+	if ( _slotSize==sizeof(unsigned int) )
+	{
+		// widen the 32 bit slots in place, from the back so none is overwritten before it's read
+		for (int i=count-1; i>=0; i--)
+		{
+			unsigned int slot;
+			memcpy(&slot, (const char*) titlePos + i*sizeof(unsigned int), sizeof(slot));
+			titlePos[i] = slot;
+		}
+	}
+	
+	return true;
+}
 
-	if ( !read )
+string TitleIndex::ReadTitle(long long titlePos, ARTICLEPOSITION* position)
+{
+	if ( position )
+	{
+		position->blockPos = 0;
+		position->articlePos = 0;
+		position->articleLength = 0;
+	}
+	
+	if ( _mapping )
+	{
+		// everything is read in place, no seeks and no reads
+		const unsigned char* entry = Mapped(_titlesPos + titlePos, SIZEOF_POSITION_INFORMATION);
+		if ( !entry )
+			return string();
+		
+		if ( position )
+		{
+			memcpy(&position->blockPos, entry, sizeof(position->blockPos));
+			memcpy(&position->articlePos, entry + sizeof(position->blockPos), sizeof(position->articlePos));
+			memcpy(&position->articleLength, entry + sizeof(position->blockPos) + sizeof(position->articlePos), sizeof(position->articleLength));
+		}
+		
+		const char* title = (const char*) entry + SIZEOF_POSITION_INFORMATION;
+		const char* end = (const char*) _mapping + _mappingSize;
+		
+		const char* stop = (const char*) memchr(title, 0, end - title);
+		if ( !stop )
+			stop = end;
+		
+		return string(title, stop - title);
+	}
+	
+	if ( _fd<0 )
 		return string();
-
-	error = fseeko(f, _titlesPos + titlePos, SEEK_SET);
-	if ( error )
+	
+	// usually the position information and the title are read at once
+	char buffer[SIZEOF_POSITION_INFORMATION + 256];
+	off_t entryPos = _titlesPos + titlePos;
+	
+	ssize_t read = pread(_fd, buffer, sizeof(buffer), entryPos);
+	if ( read<SIZEOF_POSITION_INFORMATION )
 		return string();
 	
-	// store the article location and size for use in the future
-	fread(&_lastBlockPos, sizeof(_lastBlockPos), 1, f);
-	fread(&_lastArticlePos, sizeof(_lastArticlePos), 1, f);
-	fread(&_lastArticleLength, sizeof(_lastArticleLength), 1, f);
+	if ( position )
+	{
+		memcpy(&position->blockPos, buffer, sizeof(position->blockPos));
+		memcpy(&position->articlePos, buffer + sizeof(position->blockPos), sizeof(position->articlePos));
+		memcpy(&position->articleLength, buffer + sizeof(position->blockPos) + sizeof(position->articlePos), sizeof(position->articleLength));
+	}
 	
 	string result;
-	unsigned char c = 0;
-	while ( !feof(f) && (c=fgetc(f)) )
-		result += c;
+	const char* title = buffer + SIZEOF_POSITION_INFORMATION;
+	int length = read - SIZEOF_POSITION_INFORMATION;
+	
+	while ( true )
+	{
+		const char* stop = (const char*) memchr(title, 0, length);
+		if ( stop )
+		{
+			result.append(title, stop - title);
+			break;
+		}
+		
+		// a very long title, get the rest
+		result.append(title, length);
+		entryPos += read;
+		
+		read = pread(_fd, buffer, sizeof(buffer), entryPos);
+		if ( read<=0 )
+			break;
+		
+		title = buffer;
+		length = read;
+	}
 	
 	return result;
 }
 
+string TitleIndex::GetTitle(int articleNumber, int indexNo, ARTICLEPOSITION* position)
+{
+	long long titlePos;
+	
+	if ( articleNumber<0 || articleNumber>=_numberOfArticles || !ReadTitlePositions(indexNo, articleNumber, 1, &titlePos) )
+	{
+		if ( position )
+			memset(position, 0, sizeof(ARTICLEPOSITION));
+		
+		return string();
+	}
+	
+	return ReadTitle(titlePos, position);
+}
+
+string TitleIndex::NormalizedTitle(string title, int indexNo)
+{
+	// the form the titles are sorted by in the index
+	if ( indexNo==0 )
+		return CPPStringUtils::to_lower_utf8(title);
+	
+	return PrepareSearchPhrase(title);
+}
+
 string TitleIndex::PrepareSearchPhrase(string phrase)
 {
 	string lowercasePhrase = CPPStringUtils::to_lower_utf8(phrase);
@@ -533,7 +1849,16 @@ string TitleIndex::PrepareSearchPhrase(string phrase)
 
 /* search result class */
 
-ArticleSearchResult::ArticleSearchResult(string title, string titleInArchive, fpos_t blockPos, int articlePos, int articleLength)
+ArticleSearchResult::ArticleSearchResult()
+{
+	Next = NULL;
+	
+	_blockPos = 0;
+	_articlePos = 0;
+	_articleLength = 0;
+}
+
+ArticleSearchResult::ArticleSearchResult(string title, string titleInArchive, off_t blockPos, int articlePos, int articleLength)
 {
 	Next = NULL;
 	
@@ -556,7 +1881,7 @@ string ArticleSearchResult::TitleInArchive()
 }
 									
 
-fpos_t ArticleSearchResult::BlockPos()
+off_t ArticleSearchResult::BlockPos()
 {
 	return _blockPos;
 }
@@ -23,18 +23,31 @@
 #ifndef TITLEINDEX_H
 #define TITLEINDEX_H
 
+#include <stdio.h>
+#include <sys/types.h>
+#include <pthread.h>
 #include <string>
+#include <vector>
 using namespace std;
 
+#include "BlockCodec.h"
+
+// memory used for the fences of both indexes if nothing else is given
+#define DEFAULT_FENCE_MEMORY (512*1024)
+
+// memory for the title filter if it has to be built at startup (not part of the index file)
+#define DEFAULT_FILTER_MEMORY (4096*1024)
+
 class ArticleSearchResult
 {
 public:
-	ArticleSearchResult(string title, string titleInArchive, fpos_t blockPos, int articlePos, int articleLength);
+	ArticleSearchResult();
+	ArticleSearchResult(string title, string titleInArchive, off_t blockPos, int articlePos, int articleLength);
 	
 	string Title();
 	string TitleInArchive();
 	
-	fpos_t BlockPos();
+	off_t BlockPos();
 	int ArticlePos();
 	int ArticleLength();
 	
@@ -43,17 +56,66 @@ public:
 private:
 	string _title;
 	string _titleInArchive;
-	fpos_t _blockPos;
+	off_t _blockPos;
 	int _articlePos;
 	int _articleLength;
 };
 
+typedef struct
+{
+	off_t	blockPos;
+	int		articlePos;
+	int		articleLength;
+} ARTICLEPOSITION;
+
+typedef struct
+{
+	int		stride;			// every stride-th normalized title of the index is kept in memory
+	int		count;
+	char*	keys;			// the titles, zero terminated, one after another
+	int*	keyPos;			// start of each title in keys
+} FENCES;
+
+typedef struct
+{
+	string	key;			// a normalized phrase searched for suggestions
+	int		first;			// the titles starting with it
+	int		last;			// (exclusive)
+	long long used;
+} SUGGESTIONRANGE;
+
+typedef struct
+{
+	int		indexNo;
+	int		first;			// the part of the index a binary search is limited to
+	int		count;
+	vector<long long> titlePos;	// the index entries of this part, read at once
+} TITLEWINDOW;
+
+/*
+ One instance can be used by any number of threads. The indexes, fences and filter are only read
+ after the constructor (from the mapping or with pread), so the lookups need no lock. What is
+ shared between the calls is locked on its own: the prefix ranges of the last suggestion searches
+ by _suggestionMutex, the table of main namespace titles (built by the first random title) by
+ _articlesMutex. The statistics are added to atomically. WriteIndexFile replaces the index file
+ in use, so it must not run while other threads use the instance.
+ */
 class TitleIndex
 {
 public:
-	TitleIndex(string pathToDataFile);
+	TitleIndex(string pathToDataFile, size_t fenceMemory=DEFAULT_FENCE_MEMORY, size_t filterMemory=DEFAULT_FILTER_MEMORY);
 	~TitleIndex();
 	
+	bool FindArticle(string title, ArticleSearchResult& result);
+	int FindArticles(string title, vector<ArticleSearchResult>& results);
+	
+	// looks up many titles at once; matches[i] is the number of articles titles[i] matches (case
+	// is ignored), the result the number of titles found at all
+	int ResolveTitles(const vector<string>& titles, vector<int>& matches);
+	
+	// true if there is at least one article with this title (case is ignored)
+	bool ArticleExists(string title);
+	
 	ArticleSearchResult* FindArticle(string title, bool multiple=false);
 	void DeleteSearchResult(ArticleSearchResult* articleSearchResult);
 	string DataFileName();
@@ -62,24 +124,114 @@ public:
 	string GetSuggestions(string phrase, int maxSuggestions);
 	string GetRandomArticleTitle();
 	
+	size_t MaxBlockSize();
+	BlockCodec* Codec();
+	
 	string ImageNamespace();
 	string TemplateNamespace();	
+	
+	string GetStatistics();
+	
+	// creates the index file with the precomputed lookup data and uses it
+	bool WriteIndexFile();
+	bool HasIndexFile();
 
 private:
 	string  _dataFileName;
 	int		_numberOfArticles;
 	bool	isChinese;
 	
-	fpos_t	_titlesPos;
-	fpos_t	_indexPos_0;
-	fpos_t	_indexPos_1;
+	off_t	_titlesPos;
+	off_t	_indexPos_0;
+	off_t	_indexPos_1;
+	int		_slotSize;		// the size of an index entry, depends on the version of the data file
+	size_t	_maxBlockSize;	// the uncompressed size of a block at most, 0 if not known
+	BlockCodec* _codec;		// how the blocks are compressed
+	
+	off_t	_dataFileSize;
+	
+	// only used if the indexes can't be mapped
+	int		_fd;
 		
-	string GetTitle(FILE* f, int articleNumber, int indexNo);
-	string PrepareSearchPhrase(string phrase);
+	// the title table and the indexes mapped into memory, NULL if mapping is not possible
+	const unsigned char* _mapping;
+	size_t	_mappingSize;
+	off_t	_mappingPos;
+	
+	void MapIndexes();
+	const unsigned char* Mapped(off_t pos, size_t size);
+	
+	// the optional index file, mapped into memory
+	const unsigned char* _indexFile;
+	size_t	_indexFileSize;
+	
+	// the normalized titles of both indexes taken from the index file, NULL if not available
+	const unsigned int* _keyOffsets[2];
+	const char* _keys[2];
+	const unsigned long long* _keyPrefixes[2];
+	const unsigned int* _keyJumps[2];
+	
+	string IndexFileName();
+	void LoadIndexFile();
+	void UnloadIndexFile();
+	const unsigned char* IndexFileSection(unsigned int type, size_t* size);
+	long long WriteKeySection(FILE* f, int indexNo, vector<unsigned long long>* keyPrefixes, vector<unsigned long long>* filter, unsigned int numberOfBlocks, vector<unsigned int>* articles);
+	
+	// a bloom filter of the keys of index 0, from the index file or built at startup
+	const unsigned long long* _filter;
+	unsigned int _filterBlocks;
+	bool	_filterAllocated;
+	
+	void BuildFilter(size_t memory);
+	void DeleteFilter();
+	bool MayExist(const string& key);
+	
+	bool StoredKey(int indexNo, int index, const char** key, size_t* length);
+	string Key(int index, int indexNo);
+	int CompareKey(TITLEWINDOW* window, int index, const string& key, bool prefix);
+	bool PrefixRange(int indexNo, const string& key, int* lBound, int* uBound);
+	int LowerBoundKey(TITLEWINDOW* window, int lBound, int uBound, const string& key, bool upper, int* probes);
+	int GallopKey(TITLEWINDOW* window, int lBound, const string& key, bool upper, int* probes);
 	
-	fpos_t	_lastBlockPos;
-	int	_lastArticlePos;
-	int _lastArticleLength;
+	// a sparse copy of the sorted indexes, used to narrow a search before the file is touched
+	FENCES	_fences[2];
+	
+	void BuildFences(int indexNo, size_t memory);
+	void DeleteFences(int indexNo);
+	int OpenWindow(string key, TITLEWINDOW* window);
+	string WindowTitle(TITLEWINDOW* window, int index);
+	
+	// added to without a lock, so they are machine words
+	volatile long _lookups;
+	volatile long _probes;
+	volatile long _probesSaved;
+	volatile long _filterRejects;
+	
+	void AddStatistics(int probes, int probesSaved, int lookups=1, int filterRejects=0);
+	
+	// the prefix ranges of the last suggestion searches
+	pthread_mutex_t _suggestionMutex;
+	vector<SUGGESTIONRANGE> _suggestionRanges;
+	long long _suggestionRangesUsed;
+	
+	bool SuggestionRange(const string& key, int* lBound, int* uBound);
+	void AddSuggestionRange(const string& key, int lBound, int uBound);
+	int PrefixEnd(TITLEWINDOW* window, int lBound, int uBound, const string& key, int* probes);
+	
+	// the titles without a namespace, from the index file or built when first needed
+	pthread_mutex_t _articlesMutex;
+	const unsigned int* _articles;
+	int		_numberOfMainArticles;
+	vector<unsigned int> _mainArticles;
+	
+	void BuildMainArticles();
+	
+	bool FindRange(string lowercaseTitle, int* startIndex, int* endIndex);
+	bool ReadTitlePositions(int indexNo, int first, int count, long long* titlePos);
+	string ReadTitle(long long titlePos, ARTICLEPOSITION* position);
+	string GetTitle(int articleNumber, int indexNo, ARTICLEPOSITION* position=NULL);
+	string NormalizedTitle(string title, int indexNo);
+	string PrepareSearchPhrase(string phrase);
 	
 	string _imageNamespace;
 	string _templateNamespace;
@@ -23,6 +23,7 @@
 #include "WikiArticle.h"
 #include "WikiMarkupGetter.h"
 #include "WikiMarkupParser.h"
+#include "ArticleReader.h"
 #include "CPPStringUtils.h"
 #include "Settings.h"
 #include "StringUtils.h"
@@ -42,33 +43,65 @@ string WikiArticle::GetArticleName()
 	return _articleName;
 }
 
-wstring WikiArticle::GetArticle(ArticleSearchResult* articleSearchResult)
+static void ReadArticle(ArticleReader* articleReader, WikiMarkupParser* wikiMarkupParser)
+{
+	// the parser gets the markup piece by piece, it's never copied as a whole
+	wikiMarkupParser->BeginInput(articleReader ? articleReader->Length() : 0);
+	
+	const char* chunk;
+	size_t length;
+	while ( articleReader && articleReader->Read(&chunk, &length) )
+		wikiMarkupParser->AppendInput(chunk, length);
+	
+	wikiMarkupParser->EndInput();
+}
+
+string WikiArticle::GetArticle(ArticleSearchResult* articleSearchResult)
 {
 	WikiMarkupGetter wikiMarkupGetter(_languageCode);
-	wstring article = wikiMarkupGetter.GetMarkupForArticle(articleSearchResult);
+	ArticleReader* articleReader = wikiMarkupGetter.OpenArticle(articleSearchResult);
 	
-	return ProcessArticle(article, wikiMarkupGetter.GetLastArticleTitle());
+	string article = ProcessArticle(articleReader, wikiMarkupGetter.GetLastArticleTitle());
+	if ( articleReader )
+		delete articleReader;
+	
+	return article;
 }
 
-wstring WikiArticle::GetArticle(string utf8articleName)
+string WikiArticle::GetArticle(string utf8articleName)
 {
 	WikiMarkupGetter wikiMarkupGetter(_languageCode);
-	wstring article = wikiMarkupGetter.GetMarkupForArticle(utf8articleName);
+	ArticleReader* articleReader = wikiMarkupGetter.OpenArticle(utf8articleName);
+	
+	string article = ProcessArticle(articleReader, wikiMarkupGetter.GetLastArticleTitle());
+	if ( articleReader )
+		delete articleReader;
 	
-	return ProcessArticle(article, wikiMarkupGetter.GetLastArticleTitle());
+	return article;
 }	
 
-wstring WikiArticle::ProcessArticle(wstring article, string articleTitle)
+string WikiArticle::ProcessArticle(ArticleReader* articleReader, string articleTitle)
 {
-	if ( article.empty() )
-		return article;
+	wstring languageCode = CPPStringUtils::to_wstring(_languageCode);
+	wstring pageName = CPPStringUtils::to_wstring(articleTitle);
+	
+	WikiMarkupParser* wikiMarkupParser = new WikiMarkupParser(languageCode.c_str(), pageName.c_str());
+	ReadArticle(articleReader, wikiMarkupParser);
+	
+	const wchar_t* input = wikiMarkupParser->GetInput();
+	if ( !*input )
+	{
+		delete wikiMarkupParser;
+		return string();
+	}
 	_articleName = articleTitle;
 	
-	wstring redirected = wstring();
+	string redirected = string();
 	// check if we're redirected
-	if ( article.length()<200 )
+	if ( wcslen(input)<200 )
 	{
 		// for speed reason, make no sense to scan a 1 MB articles
+		wstring article = wstring(input);
 		wstring lowercaseArticle = CPPStringUtils::to_lower(article);
 		
 		size_t pos;
@@ -90,40 +123,46 @@ wstring WikiArticle::ProcessArticle(wstring article, string articleTitle)
 					   newUtf8ArticleName.replace(pos, 1, " ", 1);
 						
 				WikiMarkupGetter wikiMarkupGetter(_languageCode);
-				article =  wikiMarkupGetter.GetMarkupForArticle(newUtf8ArticleName);
+				ArticleReader* redirectReader = wikiMarkupGetter.OpenArticle(newUtf8ArticleName);
 			
-				redirected = L"<span class=\"wkRedirected\">(Redirected from " + CPPStringUtils::from_utf8w(_articleName) + L")</span>\r\n";
+				redirected = "<span class=\"wkRedirected\">(Redirected from " + _articleName + ")</span>\r\n";
 				_articleName = wikiMarkupGetter.GetLastArticleTitle();
+				
+				// the parser keeps a pointer to the page name
+				delete wikiMarkupParser;
+				pageName = CPPStringUtils::to_wstring(_articleName);
+				
+				wikiMarkupParser = new WikiMarkupParser(languageCode.c_str(), pageName.c_str());
+				ReadArticle(redirectReader, wikiMarkupParser);
+				
+				if ( redirectReader )
+					delete redirectReader;
 			}
 		}
 	}
 		
-	wstring pageName = CPPStringUtils::to_wstring(_articleName);
-	WikiMarkupParser wikiMarkupParser(CPPStringUtils::to_wstring(_languageCode).c_str(), pageName.c_str());
-	wikiMarkupParser.SetInput(article.c_str());
-	wikiMarkupParser.Parse();
+	// the output is only read once, it doesn't have to be in one piece
+	wikiMarkupParser->SetOutputChunked(true);
+	wikiMarkupParser->Parse();
 
-	article = wstring(wikiMarkupParser.GetOutput()); 
-	
 	// Prepare everything what should go before the article body itself
-	wstring preArticleHtml;
-	wstring articleTitleW = CPPStringUtils::from_utf8w(_articleName);
+	string preArticleHtml;
 	
 	//string filename = settings.WebContentPath() + "PreArticle.html";
 	string filename = __settings->WebContentPath() + "PreArticle.html";
 	void* contents = LoadFile(filename.c_str());
 	if ( contents )
 	{
-		preArticleHtml = CPPStringUtils::from_utf8w(string((char*) contents));
+		preArticleHtml = string((char*) contents);
 		
 		// replace some params
 		size_t pos;
 		
-		wstring placeholder = L"%ArticleTitle%";
+		string placeholder = "%ArticleTitle%";
 		while ( (pos=preArticleHtml.find(placeholder))!=string::npos )
-			preArticleHtml.replace(pos, placeholder.length(), articleTitleW);
+			preArticleHtml.replace(pos, placeholder.length(), _articleName);
 			   
-		placeholder = L"%RedirectedFrom%";
+		placeholder = "%RedirectedFrom%";
 		while ( (pos=preArticleHtml.find(placeholder))!=string::npos )
 			preArticleHtml.replace(pos, placeholder.length(), redirected);
 		
@@ -131,44 +170,51 @@ wstring WikiArticle::ProcessArticle(wstring article, string articleTitle)
 	}
 	else
 	{
-		preArticleHtml = L"<html><head>\r\n";
-
-		preArticleHtml.append(L"<meta id=\"viewport\" name=\"viewport\" content=\"width=320; initial-scale=0.6667; maximum-scale=1.0; minimum-scale=0.6667 \"/>\r\n");
-
-		preArticleHtml.append(L"<LINK href=\"/stylesheets/shared.css\" type=\"text/css\" rel=\"stylesheet\">\r\n");
-		preArticleHtml.append(L"<LINK href=\"/stylesheets/main.css\" type=\"text/css\" rel=\"stylesheet\">\r\n");
-		preArticleHtml.append(L"<LINK href=\"/stylesheets/mediawiki_common.css\" type=\"text/css\" rel=\"stylesheet\">\r\n");
-		preArticleHtml.append(L"<LINK href=\"/stylesheets/mediawiki_monobook.css\" type=\"text/css\" rel=\"stylesheet\">\r\n");
-		preArticleHtml.append(L"<LINK href=\"/stylesheets/wikisrv.css\" type=\"text/css\" rel=\"stylesheet\">\r\n");
-		preArticleHtml.append(L"<title>");
-		preArticleHtml.append(articleTitleW);
-		preArticleHtml.append(L"</title>\r\n");
-	
-		preArticleHtml.append(L"</head>\r\n<body class=\"wkBody\">\r\n");
-		preArticleHtml.append(L"<div class=\"wkTitle\">");
-		preArticleHtml.append(L"<a href=\"/\" class=\"wkTitleLink\"><img src=\"/icon_search.gif\"/>&nbsp;");
-		preArticleHtml.append(articleTitleW);
-		preArticleHtml.append(L"</a></div>\r\n");
+		preArticleHtml = "<html><head>\r\n";
+
+		preArticleHtml.append("<meta id=\"viewport\" name=\"viewport\" content=\"width=320; initial-scale=0.6667; maximum-scale=1.0; minimum-scale=0.6667 \"/>\r\n");
+
+		preArticleHtml.append("<LINK href=\"/stylesheets/shared.css\" type=\"text/css\" rel=\"stylesheet\">\r\n");
+		preArticleHtml.append("<LINK href=\"/stylesheets/main.css\" type=\"text/css\" rel=\"stylesheet\">\r\n");
+		preArticleHtml.append("<LINK href=\"/stylesheets/mediawiki_common.css\" type=\"text/css\" rel=\"stylesheet\">\r\n");
+		preArticleHtml.append("<LINK href=\"/stylesheets/mediawiki_monobook.css\" type=\"text/css\" rel=\"stylesheet\">\r\n");
+		preArticleHtml.append("<LINK href=\"/stylesheets/wikisrv.css\" type=\"text/css\" rel=\"stylesheet\">\r\n");
+		preArticleHtml.append("<title>");
+		preArticleHtml.append(_articleName);
+		preArticleHtml.append("</title>\r\n");
+	
+		preArticleHtml.append("</head>\r\n<body class=\"wkBody\">\r\n");
+		preArticleHtml.append("<div class=\"wkTitle\">");
+		preArticleHtml.append("<a href=\"/\" class=\"wkTitleLink\"><img src=\"/icon_search.gif\"/>&nbsp;");
+		preArticleHtml.append(_articleName);
+		preArticleHtml.append("</a></div>\r\n");
 		if ( !redirected.empty() )
 			preArticleHtml.append(redirected);
-		preArticleHtml.append(L"<p />\r\n");
+		preArticleHtml.append("<p />\r\n");
 	}
 
 	// prepare everything what should go after the article html
-	wstring postArticleHtml;
+	string postArticleHtml;
 	
 	filename = __settings->WebContentPath() + "PostArticle.html";
 	contents = LoadFile(filename.c_str());
 	if ( contents )
 	{
-		postArticleHtml = CPPStringUtils::from_utf8w(string((char*) contents));
+		postArticleHtml = string((char*) contents);
 		free(contents);
 	}
 	else	
-		postArticleHtml = L"\r\n</body></html>";
+		postArticleHtml = "\r\n</body></html>";
+	
+	// the parser output is encoded once, right behind the html in front of it
+	string article = preArticleHtml;
+	
+	const wchar_t* output;
+	int length;
+	for (int i=0; wikiMarkupParser->GetOutputChunk(i, &output, &length); i++)
+		CPPStringUtils::append_utf8(article, output, length);
+	delete wikiMarkupParser;
 	
-	// Insert it to the start of the article
-	article.insert(0, preArticleHtml.c_str());
 	article.append(postArticleHtml);
 
 	return article;
@@ -26,6 +26,8 @@
 #include <string>
 #include "TitleIndex.h"
 
+class ArticleReader;
+
 using namespace std;
 
 class WikiArticle {
@@ -35,11 +37,12 @@ public:
 	~WikiArticle();
 	
 	string GetArticleName();
-	wstring GetArticle(string utf8ArticleName);
-	wstring GetArticle(ArticleSearchResult* articleSearchResult);
+	// the html of the article, utf-8 encoded
+	string GetArticle(string utf8ArticleName);
+	string GetArticle(ArticleSearchResult* articleSearchResult);
 	
 	wstring FormatSearchResults(ArticleSearchResult* articleSearchResult);
-	wstring ProcessArticle(wstring article, string articleTitle);
+	string ProcessArticle(ArticleReader* articleReader, string articleTitle);
 
 private: 
 	string _articleName;
@@ -24,15 +24,26 @@
 #include <stdlib.h>
 #include <memory.h>
 #include <wchar.h>
-#include <bzlib.h>
 
 #include "Settings.h"
 #include "CPPStringUtils.h"
 #include "StopWatch.h"
+#include "ArticleReader.h"
 
 #include "WikiMarkupGetter.h"
+#include "CompiledTemplate.h"
 
-#define BUFFER_SIZE 32767
+// the name a template is kept under in the caches and the template pack, which don't care about the
+// case; only ascii letters are folded, the bytes of other utf-8 characters have to stay as they are
+static string TemplateCacheName(const string& templateName)
+{
+	string cacheName = templateName;
+	for (size_t i=0; i<cacheName.length(); i++)
+		if ( cacheName[i]>='A' && cacheName[i]<='Z' )
+			cacheName[i] += 'a' - 'A';
+	
+	return cacheName;
+}
 
 WikiMarkupGetter::WikiMarkupGetter(string language_code) 
 {
@@ -54,15 +65,11 @@ wstring WikiMarkupGetter::GetMarkupForArticle(const string utf8ArticleName)
 	if ( !titleIndex )
 		return wstring();
 	
-	ArticleSearchResult* articleSearchResult = titleIndex->FindArticle(utf8ArticleName);
-	
-	if ( !articleSearchResult )
+	ArticleSearchResult articleSearchResult;
+	if ( !titleIndex->FindArticle(utf8ArticleName, articleSearchResult) )
 		return wstring();
 	
-	wstring result = GetMarkupForArticle(articleSearchResult);
-	titleIndex->DeleteSearchResult(articleSearchResult);
-	
-	return result;
+	return GetMarkupForArticle(&articleSearchResult);
 }
 
 wstring WikiMarkupGetter::GetMarkupForArticle(ArticleSearchResult* articleSearchResult)
@@ -70,70 +77,54 @@ wstring WikiMarkupGetter::GetMarkupForArticle(ArticleSearchResult* articleSearch
 	if ( !articleSearchResult )
 		return wstring();
 	
-	fpos_t blockPos = articleSearchResult->BlockPos(); 
+	off_t blockPos = articleSearchResult->BlockPos(); 
 	int articlePos = articleSearchResult->ArticlePos();
 	int articleLength = articleSearchResult->ArticleLength();
 	
 	_lastArticleTitle = string(articleSearchResult->TitleInArchive());
 
 	TitleIndex* titleIndex = __settings->GetTitleIndex(_languageCode);
-	string filename = titleIndex->DataFileName();	
-	FILE* f = fopen(filename.c_str(), "rb");
-	if ( !f )
+	
+	// the block is decompressed once and shared by all articles and templates in it
+	BlockCache* blockCache = __settings->GetBlockCache();
+	CACHEDBLOCK* block = blockCache->GetBlock(titleIndex->DataFileName(), blockPos, titleIndex->Codec(), titleIndex->MaxBlockSize());
+	if ( !block )
 		return wstring();
-					
-	// seek to the block
-	fseeko(f, blockPos, SEEK_SET);
-		
-	// open the block
-	int bzerror;
-	BZFILE *bzf = BZ2_bzReadOpen(&bzerror, f, 0, 0, NULL, 0);
-	
-	char* text = (char*) malloc(articleLength+1);
-	char buffer[BUFFER_SIZE];
-	int read;
-	while ( (read=BZ2_bzRead(&bzerror, bzf, buffer, BUFFER_SIZE)) )
-	{
-		if ( articlePos-read<0 )
-		{
-			char* start = buffer + articlePos;
-			int len = (read-articlePos);
-			if ( len>articleLength )
-				len = articleLength;
-			
-			char* pText = text;
-			strncpy(pText, start, len);
-			articleLength -= len;
-			pText += len;
-			
-			while ( articleLength && (read=BZ2_bzRead(&bzerror, bzf, buffer, BUFFER_SIZE)) )
-			{
-				if ( articleLength>read )
-					len = read;
-				else
-					len = articleLength;
-				
-				strncpy(pText, buffer, len);
-				articleLength -= len;
-				pText += len;
-			}
-			
-			*pText = 0x0;
-			break;
-		}
-		else
-			articlePos -= read;
-	}
 	
-	BZ2_bzReadClose(&bzerror, bzf);
-	fclose(f);
+	wstring content;
+	if ( articlePos>=0 && articleLength>=0 && (size_t) articlePos + articleLength<=block->size )
+		content = CPPStringUtils::from_utf8w(string(block->data + articlePos, articleLength));
 	
-	wstring content = CPPStringUtils::from_utf8w(text);
-	free(text);
+	blockCache->Release(block);
 	
 	return content;
 }
 
+ArticleReader* WikiMarkupGetter::OpenArticle(const string utf8ArticleName)
+{
+	TitleIndex* titleIndex = __settings->GetTitleIndex(_languageCode);
+	if ( !titleIndex )
+		return NULL;
+	
+	ArticleSearchResult articleSearchResult;
+	if ( !titleIndex->FindArticle(utf8ArticleName, articleSearchResult) )
+		return NULL;
+	
+	return OpenArticle(&articleSearchResult);
+}
+
+ArticleReader* WikiMarkupGetter::OpenArticle(ArticleSearchResult* articleSearchResult)
+{
+	if ( !articleSearchResult )
+		return NULL;
+	
+	_lastArticleTitle = string(articleSearchResult->TitleInArchive());
+	
+	TitleIndex* titleIndex = __settings->GetTitleIndex(_languageCode);
+	
+	return new ArticleReader(titleIndex, __settings->GetBlockCache(), articleSearchResult);
+}
+
 string WikiMarkupGetter::GetLastArticleTitle()
 {
 	return _lastArticleTitle;
@@ -153,66 +144,69 @@ wstring WikiMarkupGetter::GetTemplate(const string utf8TemplateName, string temp
 	while ( (pos=templateName.find("_"))!=string::npos )
 		templateName.replace(pos, 1, " ", 1);
 	
-	// check the "en:convert/" template
-	// remove trailing slashes (a common error)
-	/*
-	while ( templateName.length()>0 && templateName[templateName.length()-1]=='/' )
-		templateName = templateName.substr(0, templateName.length()-1);
-	*/
-	string filename = CPPStringUtils::to_lower(CPPStringUtils::url_encode(templateName));
-	while ( (pos=filename.find("/"))!=string::npos )
-		filename.replace(pos, 1, "%2f", 3);
-
-	while ( (pos=filename.find("\\"))!=string::npos )
-		filename.replace(pos, 1, "%5c", 3);
-
-	while ( (pos=filename.find(":"))!=string::npos )
-		filename.replace(pos, 1, "%3a", 3);
-
-	// if the filename is empty, caching is disabled
-	if ( true )
-		filename = __settings->Path() + _languageCode + "/cache/" + filename;
-	else
-		filename = "";
+	string cacheName = TemplateCacheName(templateName);
+	
+	TemplateCache* templateCache = __settings->GetTemplateCache();
+	
+	wstring text;
+	if ( templateCache->GetTemplate(_languageCode, cacheName, text) )
+		return text;
 	
-	if ( !filename.empty() ) 
+	// the templates read from the archive before, kept on disk
+	TemplatePack* templatePack = __settings->TemplateFiles() ? __settings->GetTemplatePack(_languageCode) : NULL;
+	
+	const char* packedText;
+	size_t packedLength;
+	if ( templatePack && templatePack->FindTemplate(cacheName, &packedText, &packedLength) )
 	{
-		// try to get the template fron the cache
-		FILE* f = fopen(filename.c_str(), "rb");
-		if ( f ) 
-		{
-			int error = fseek(f, 0, SEEK_END);
-			fpos_t size;
-			
-			if ( !error )
-				error = fgetpos(f, &size);
-
-			if ( !error )
-				error = fseek(f, 0, SEEK_SET);
-			
-			int read = 0;
-			char* buffer = NULL;
-			
-			if ( !error && size>0 ) {
-				buffer = (char*) malloc(size);
-				read = fread(buffer, 1, size, f);
-			}
-				
-			fclose(f);
-			
-			if ( read ) 
-			{
-				string result = string(buffer);
-				free(buffer);
-				return CPPStringUtils::from_utf8w(result);
-			}
-			
-			if ( buffer )
-				free(buffer);
-		}	
+		text = CPPStringUtils::from_utf8w(packedText, packedLength);
+		templateCache->AddTemplate(_languageCode, cacheName, text);
+		
+		return text;
+	}
+	
+	if ( !ReadTemplate(templateName, templatePrefix, text) )
+	{
+		// it's not in the archive, so it isn't looked for again
+		templateCache->AddTemplate(_languageCode, cacheName, L"-");
+		return wstring(L"-");
 	}
 	
-	wstring text = wstring();
+	if ( templatePack )
+		templatePack->AddTemplate(cacheName, CPPStringUtils::to_utf8(text));
+	
+	templateCache->AddTemplate(_languageCode, cacheName, text);
+	
+	return text;
+}
+
+CompiledTemplate* WikiMarkupGetter::GetCompiledTemplate(const string utf8TemplateName, string templatePrefix)
+{
+	// the same name as GetTemplate uses for the cache
+	string cacheName = utf8TemplateName;
+	
+	size_t pos = 0;
+	while ( (pos=cacheName.find("_"))!=string::npos )
+		cacheName.replace(pos, 1, " ", 1);
+	
+	cacheName = TemplateCacheName(cacheName);
+	
+	TemplateCache* templateCache = __settings->GetTemplateCache();
+	
+	CompiledTemplate* compiledTemplate = templateCache->GetCompiledTemplate(_languageCode, cacheName);
+	if ( compiledTemplate )
+		return compiledTemplate;
+	
+	// GetTemplate puts it into the cache (if it isn't too large), the compiled form is kept with it
+	compiledTemplate = new CompiledTemplate(GetTemplate(utf8TemplateName, templatePrefix));
+	templateCache->SetCompiledTemplate(_languageCode, cacheName, compiledTemplate);
+	
+	return compiledTemplate;
+}
+
+bool WikiMarkupGetter::ReadTemplate(string templateName, string templatePrefix, wstring& text)
+{
+	text = wstring();
 	
 	// test for some "build in" templates
 	if ( templateName=="tl" )
@@ -232,20 +226,17 @@ wstring WikiMarkupGetter::GetTemplate(const string utf8TemplateName, string temp
 		TitleIndex* titleIndex = __settings->GetTitleIndex(_languageCode);
 		
 		// we're looking for templates; if there are more than one take it; maybe we're redirected
-		ArticleSearchResult* articleSearchResult = titleIndex->FindArticle(templateName, true);
-
-		if ( !articleSearchResult )
-			return wstring(L"-");
+		vector<ArticleSearchResult> articleSearchResults;
+		if ( !titleIndex->FindArticles(templateName, articleSearchResults) )
+			return false;
 		
-		templateName = articleSearchResult->Title();
-		if ( templateName!=articleSearchResult->TitleInArchive() )
-			templateName = articleSearchResult->TitleInArchive();
-		
-		titleIndex->DeleteSearchResult(articleSearchResult);
+		templateName = articleSearchResults[0].Title();
+		if ( templateName!=articleSearchResults[0].TitleInArchive() )
+			templateName = articleSearchResults[0].TitleInArchive();
 			
 		wstring wikiTemplate = GetMarkupForArticle(templateName);
 		if ( wikiTemplate.empty() )
-			return wstring(L"-");
+			return false;
 		
 		if ( wikiTemplate.length()<200 )
 		{
@@ -361,23 +352,9 @@ wstring WikiMarkupGetter::GetTemplate(const string utf8TemplateName, string temp
 	while ( (pos=text.find(L"{{!}}} ", pos))!=string::npos )
 		text.replace(pos+3, 1, L")", 1);
 	*/
-	if ( !filename.empty() ) 
-	{
-		// try to store the text
-		FILE* f = fopen(filename.c_str(), "wb");
-		if ( f ) 
-		{
-			string data = CPPStringUtils::to_utf8(text);
-			fwrite(data.c_str(), 1, data.length(), f);
-			
-			char c = 0;
-			fwrite(&c, 1, 1, f);
-		
-			fclose(f);
-		}	
-	}
-	
-	return text;
+
+	return true;
 }
 
 
+
@@ -24,6 +24,9 @@
 
 using namespace std;
 
+class ArticleReader;
+class CompiledTemplate;
+
 class WikiMarkupGetter
 {	
 public:
@@ -36,13 +39,23 @@ public:
 	wstring GetMarkupForArticle(const string utf8ArticleName);
 	wstring GetMarkupForArticle(ArticleSearchResult* articleSearchResult);
 
+	// the utf-8 markup piece by piece, the reader has to be deleted; NULL if there is no such article
+	ArticleReader* OpenArticle(const string utf8ArticleName);
+	ArticleReader* OpenArticle(ArticleSearchResult* articleSearchResult);
+
 	string GetLastArticleTitle();
 
 	wstring GetTemplate(const wstring templateName, string templatePrefix);
 	wstring GetTemplate(const string utf8TemplateName, string templatePrefix);
+
+	// the template ready to be expanded, "-" as its text if there is none; it has to be released
+	CompiledTemplate* GetCompiledTemplate(const string utf8TemplateName, string templatePrefix);
 	
 private:
 	string _languageCode;	
 	string _lastArticleTitle;
+	
+	// the text of a template as it is included, false if it's not in the archive
+	bool ReadTemplate(string templateName, string templatePrefix, wstring& text);
 };
 
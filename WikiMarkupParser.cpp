@@ -25,6 +25,9 @@
 #include <string.h>
 #include <memory.h>
 
+#include <vector>
+#include <algorithm>
+
 #include "Settings.h"
 #include "WikiMarkupParser.h"
 #include "WikiMarkupGetter.h"
@@ -43,13 +46,12 @@ const wchar_t* nsNames[]  = {L"unused", L"Talk", L"User", L"User_talk", L"Wikipe
 
 const wchar_t* ignoredTemplates[] = {L"commons", 0x0};
 
-typedef struct tagTEMPLATEPARAM
+typedef struct
 {
-	wstring position;
-	wstring name;
-	wstring value;
-	tagTEMPLATEPARAM* next;
-} TEMPLATEPARAM;
+	const wchar_t* text;
+	int length;
+	wchar_t* expansion;				// freed when the pieces are joined
+} TEXTPIECE;
 
 typedef struct tagTOC
 {
@@ -66,18 +68,22 @@ typedef struct tagREF
 	tagREF*	next;
 } REF;
 
-WikiMarkupParser::WikiMarkupParser(const wchar_t* languageCode, const wchar_t* pageName, bool doExpandTemplates) 
+WikiMarkupParser::WikiMarkupParser(const wchar_t* languageCode, const wchar_t* pageName, bool doExpandTemplates, ParserArena* arena) 
 {
+	// the parsers for parts of the article use the arena of the one for the whole article
+	_ownArena = arena==NULL;
+	_arena = _ownArena ? new ParserArena() : arena;
+	
 	_languageCodeW = (wchar_t*) malloc((wcslen(languageCode)+1) * sizeof(wchar_t));
 	wcscpy((wchar_t*) _languageCodeW, languageCode);
 		
 	_pInput = NULL;
 	_pCurrentInput = NULL;
-	
-	_pOutput = NULL;
-	_pCurrentOutput = NULL;
-	_iOutputSize = 0;
-	_iOutputRemain = 0;
+	_inputLength = 0;
+	_inputSize = 0;
+	_utf8PendingLength = 0;
+	_crPending = false;
+	_inputEnded = false;
 	
 	_doExpandTemplates = doExpandTemplates;
 	
@@ -99,12 +105,18 @@ WikiMarkupParser::WikiMarkupParser(const wchar_t* languageCode, const wchar_t* p
 	_tocPosition = -1;
 	
 	_toc = NULL;
+	_lastToc = NULL;
 	
 	_references = NULL;
 	
 	_categories = NULL;
 	
+	_missingLinks = NULL;
+	_sharedMissingLinks = false;
+	
 	_pageName = pageName;
+	
+	_expansionDependencies = 0;
 		
 	string lc = CPPStringUtils::to_string(_languageCodeW);
 	_titleIndex = __settings->GetTitleIndex(lc);
@@ -118,7 +130,7 @@ WikiMarkupParser::WikiMarkupParser(const wchar_t* languageCode, const wchar_t* p
 	if ( imageNamespace.empty() )
 		imageNamespace = "image";
 												
-	_imageNamespace = wstrdup(CPPStringUtils::to_wstring(imageNamespace).c_str());
+	_imageNamespace = _arena->Strdup(CPPStringUtils::to_wstring(imageNamespace).c_str());
 	
 	_imagesInstalled = __settings->AreImagesInstalled(lc);
 }
@@ -127,16 +139,10 @@ WikiMarkupParser::~WikiMarkupParser()
 {
 	if ( _pInput!=NULL ) 
 	{
-		free(_pInput);
+		_arena->Free(_pInput);
 		_pInput = NULL;
 	}
 
-	if ( _pOutput!=NULL ) 
-	{
-		free(_pOutput);
-		_pOutput = NULL;
-	}	
-	
 	while ( _pCurrentTag )
 	{
 		tagType *oldTag = _pCurrentTag;
@@ -144,8 +150,8 @@ WikiMarkupParser::~WikiMarkupParser()
 		if ( _pCurrentTag!=NULL ) 
 			_pCurrentTag->pNext = NULL;
 	
-		free(oldTag->name);
-		delete(oldTag);
+		_arena->Free(oldTag->name);
+		_arena->Free(oldTag);
 	}
 
 	while ( _toc )
@@ -154,9 +160,9 @@ WikiMarkupParser::~WikiMarkupParser()
 		_toc = toc->next;
 
 		if ( toc->name )
-			free(toc->name);
+			_arena->Free(toc->name);
 	
-		delete(toc);
+		_arena->Free(toc);
 	}	
 	
 	while ( _references )
@@ -164,26 +170,33 @@ WikiMarkupParser::~WikiMarkupParser()
 		REF* ref = (REF*) _references;
 		_references = ref->next;
 		
-		delete(ref);
+		_arena->Free(ref);
 	}	
 	
 	if ( _categories )
 	{
-		free(_categories);
+		_arena->Free(_categories);
 		_categories = NULL;
 	}
 	
+	if ( _missingLinks && !_sharedMissingLinks )
+		delete((vector<wstring>*) _missingLinks);
+	_missingLinks = NULL;
+	
 	if ( _languageCodeW )
 	{
-		free((wchar_t*) _languageCodeW);
+		_arena->Free((wchar_t*) _languageCodeW);
 		_languageCodeW = NULL;
 	}
 	
 	if ( _imageNamespace )
 	{
-		free(_imageNamespace);
+		_arena->Free(_imageNamespace);
 		_imageNamespace = NULL;
 	}
+	
+	if ( _ownArena )
+		delete _arena;
 }
 
 void WikiMarkupParser::SetInput(const wchar_t* pInput) 
@@ -192,7 +205,7 @@ void WikiMarkupParser::SetInput(const wchar_t* pInput)
 		return;
 		
 	if ( _pInput!=NULL )
-		free(_pInput);
+		_arena->Free(_pInput);
 		
 	_pInput = (wchar_t*) malloc( (wcslen(pInput)+1) * sizeof(wchar_t) );
 	
@@ -214,26 +227,137 @@ void WikiMarkupParser::SetInput(const wchar_t* pInput)
 	
 	_inputLength = wcslen(_pInput);
 		
-	if ( _pOutput!=NULL )
-		free(_pOutput);
-		
-	_pCurrentOutput = _pOutput;
-	_iOutputRemain = _iOutputSize;
+	_output.Clear();
 }
 
-const wchar_t* WikiMarkupParser::GetOutput() 
+void WikiMarkupParser::BeginInput(int lengthHint)
 {
-	if ( _pOutput==NULL ) 
+	if ( _pInput!=NULL )
+		_arena->Free(_pInput);
+	
+	// an utf-8 text never has more chars than bytes
+	_inputSize = lengthHint>0 ? lengthHint : OUTPUT_GROWS;
+	_pInput = (wchar_t*) malloc( (_inputSize+1) * sizeof(wchar_t) );
+	*_pInput = 0x0;
+	
+	_inputLength = 0;
+	_utf8PendingLength = 0;
+	_crPending = false;
+	_inputEnded = false;
+}
+
+void WikiMarkupParser::AppendInputChar(wchar_t c)
+{
+	if ( _inputEnded )
+		return;
+	
+	wchar_t store[2];
+	int count = 0;
+	
+	// the same as SetInput: "\r\n" stays, a single "\r" becomes "\n"
+	if ( _crPending )
 	{
-		_iOutputSize = OUTPUT_GROWS;
-		_pOutput = (wchar_t*) malloc((_iOutputSize+1) *sizeof(wchar_t));
-			
-		_pCurrentOutput = _pOutput;
-		_iOutputRemain = _iOutputSize;
-		*_pCurrentOutput = 0x0;
+		store[count++] = c=='\n' ? '\r' : '\n';
+		_crPending = false;
 	}
 	
-	return _pOutput;
+	if ( c=='\r' )
+		_crPending = true;
+	else if ( c==0x0 )
+		_inputEnded = true;
+	else
+		store[count++] = c;
+	
+	if ( _inputLength + count>_inputSize )
+	{
+		_inputSize = _inputSize*2 + count;
+		_pInput = (wchar_t*) realloc(_pInput, (_inputSize+1) * sizeof(wchar_t));
+	}
+	
+	for (int i=0; i<count; i++)
+		_pInput[_inputLength++] = store[i];
+}
+
+void WikiMarkupParser::AppendInput(const char* utf8, int length)
+{
+	if ( _pInput==NULL )
+		BeginInput(length);
+	
+	// decoded like CPPStringUtils::from_utf8w, a sequence may be split between two calls
+	for (int i=0; i<length; i++)
+	{
+		unsigned int c = (unsigned char) utf8[i];
+		
+		if ( _utf8PendingLength==0 )
+		{
+			if ( c<0x80 )
+				AppendInputChar(c);
+			else if ( (c & 0xe0)==0xc0 || (c & 0xf0)==0xe0 || (c & 0xf8)==0xf0 )
+				_utf8Pending[_utf8PendingLength++] = c;
+			else
+			{
+				// illegal coding, skip that char
+				AppendInputChar('?');
+			}
+			continue;
+		}
+		
+		_utf8Pending[_utf8PendingLength++] = c;
+		
+		unsigned int c1 = _utf8Pending[0];
+		if ( (c1 & 0xe0)==0xc0 )
+		{
+			AppendInputChar(((c1 & 0x1f)<<6) | (_utf8Pending[1] & 0x3f));
+			_utf8PendingLength = 0;
+		}
+		else if ( (c1 & 0xf0)==0xe0 && _utf8PendingLength==3 )
+		{
+			AppendInputChar(((c1 & 0x0f)<<12) | ((_utf8Pending[1] & 0x3f)<<6) | (_utf8Pending[2] & 0x3f));
+			_utf8PendingLength = 0;
+		}
+		else if ( (c1 & 0xf8)==0xf0 && _utf8PendingLength==4 )
+		{
+			AppendInputChar(((c1 & 0x07)<<18) | ((_utf8Pending[1] & 0x3f)<<12) | ((_utf8Pending[2] & 0x3f)<<6) | (_utf8Pending[3] & 0x3f));
+			_utf8PendingLength = 0;
+		}
+	}
+}
+
+void WikiMarkupParser::EndInput()
+{
+	if ( _pInput==NULL )
+		BeginInput();
+	
+	// a sequence cut off at the end is dropped
+	_utf8PendingLength = 0;
+	
+	if ( _crPending )
+		AppendInputChar(0x0);
+	_inputEnded = true;
+	
+	_pInput[_inputLength] = 0x0;
+	
+	_output.Clear();
+}
+
+const wchar_t* WikiMarkupParser::GetInput()
+{
+	return _pInput;
+}
+
+const wchar_t* WikiMarkupParser::GetOutput() 
+{
+	return _output.Text();
+}
+
+void WikiMarkupParser::SetOutputChunked(bool chunked)
+{
+	_output.SetChunked(chunked);
+}
+
+bool WikiMarkupParser::GetOutputChunk(int index, const wchar_t** text, int* length)
+{
+	return _output.GetChunk(index, text, length);
 }
 
 double WikiMarkupParser::EvaluateExpression(const wchar_t* expression)
@@ -274,34 +398,6 @@ double WikiMarkupParser::EvaluateExpression(const wchar_t* expression)
 	 */
 }
 
-void WikiMarkupParser::ReplaceInput(const wchar_t* text, int position, int length) 
-{	
-	if ( position<0 || length<0 )
-		return;
-	
-	if ( position>_inputLength || (position+length)>_inputLength )
-		return;
-	
-	int text_length = 0;
-	if ( text )
-		text_length = wcslen(text);
-	
-	int new_length = _inputLength - length + text_length;
-	
-	wchar_t* new_input = (wchar_t*) malloc((new_length+1) * sizeof(wchar_t));
-	wcsncpy(new_input, _pInput, position);
-	new_input[position] = 0x0;
-	if ( text )
-		wcscat(new_input, text);
-	wcscat(new_input, _pInput + position + length);
-
-	free(_pInput);
-	
-	_pInput = new_input;
-	_pCurrentInput = _pInput + position;
-	_inputLength = new_length;
-}
-
 inline wchar_t WikiMarkupParser::GetNextChar() 
 {
 	if ( *_pCurrentInput==0x00 )
@@ -310,6 +406,34 @@ inline wchar_t WikiMarkupParser::GetNextChar()
 	return *_pCurrentInput++;
 }
 
+// the chars Parse() has to look at one by one, every other char is plain text which
+// is copied to the output as it is (chars above 127 never have a meaning)
+static const unsigned char plainTextStops[128] = {
+	1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0,		// 0x00, '\n'
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 1, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0,		// '!', '\''
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 1, 0, 0, 0,		// ':', '<'
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 1,		// '[', '_'
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0		// '|'
+};
+
+#define IS_PLAIN_TEXT(c)	((unsigned int) (c)>127 || !plainTextStops[(unsigned int) (c)])
+
+// returns the first char behind the plain text starting at text
+static inline wchar_t* EndOfPlainText(wchar_t* text)
+{
+	// four chars per round, most runs are longer than a few words
+	while ( IS_PLAIN_TEXT(text[0]) && IS_PLAIN_TEXT(text[1]) && IS_PLAIN_TEXT(text[2]) && IS_PLAIN_TEXT(text[3]) )
+		text += 4;
+	
+	while ( IS_PLAIN_TEXT(*text) )
+		text++;
+	
+	return text;
+}
+
 inline wchar_t WikiMarkupParser::Peek() 
 {
 	return *_pCurrentInput;
@@ -342,7 +466,7 @@ wchar_t* WikiMarkupParser::RemoveComments(const wchar_t* src)
 	int srcLength = wcslen(src);
 	const wchar_t* srcCurrent = src;
 	
-	wchar_t* dst = (wchar_t*) malloc((srcLength+1)*sizeof(wchar_t));
+	wchar_t* dst = (wchar_t*) _arena->Alloc((srcLength+1)*sizeof(wchar_t));
 	wchar_t* dstCurrent = dst;
 	
 	int state = 0;
@@ -387,7 +511,7 @@ wchar_t* WikiMarkupParser::RemoveComments(const wchar_t* src)
 
 	if ( !changed )
 	{
-		free(dst);
+		_arena->Free(dst);
 		return (wchar_t*) src;
 	}
 	else
@@ -410,13 +534,9 @@ wchar_t* WikiMarkupParser::ExpandTemplates(const wchar_t* src)
 		
 	const wchar_t* srcPos = src;
 	const wchar_t* srcCurrent = src;
-	int srcLength = wcslen(src);
 
-	int dstSize = 0;
-	int dstLength = srcLength;
-	wchar_t* dst = (wchar_t*) malloc((dstLength+1)*sizeof(wchar_t));
-	wchar_t* dstPos = dst;
-	*dstPos = 0x0;
+	// the text between the templates and the expansions, joined once at the end
+	vector<TEXTPIECE> pieces;
 	
 	const wchar_t* startOfTagName = NULL;
 	const wchar_t* endOfTagName = NULL;
@@ -531,20 +651,8 @@ wchar_t* WikiMarkupParser::ExpandTemplates(const wchar_t* src)
 				int size = (srcCurrent-srcPos - 1); 
 				if ( size>0 )
 				{
-					int newDstSize = dstSize + size;
-					if ( newDstSize>dstLength )
-					{
-						dstLength += ( size + (srcLength - (srcCurrent - src) ) + 256);
-						dst = (wchar_t*) realloc(dst, (dstLength+1)*sizeof(wchar_t));
-						
-						dstPos = dst + dstSize;
-					}
-					
-					wcsncpy(dstPos, srcPos, size);
-					dstPos += size;
-					*dstPos = 0x0;
-					
-					dstSize += size;
+					TEXTPIECE piece = {srcPos, size, NULL};
+					pieces.push_back(piece);
 					
 					srcPos = srcCurrent;
 				}
@@ -581,7 +689,7 @@ wchar_t* WikiMarkupParser::ExpandTemplates(const wchar_t* src)
 				{
 					int templateLength = srcCurrent - srcPos - 2; // the two trailing } are ignored
 					
-					wchar_t* templateText = (wchar_t*) malloc((templateLength+1)*sizeof(wchar_t));
+					wchar_t* templateText = (wchar_t*) _arena->Alloc((templateLength+1)*sizeof(wchar_t));
 					if ( templateLength>0 )
 						wcsncpy(templateText, srcPos, templateLength);
 					templateText[templateLength] = 0x0;
@@ -594,56 +702,73 @@ wchar_t* WikiMarkupParser::ExpandTemplates(const wchar_t* src)
 					// do something with the template here
 					if ( templateLength )
 					{
-						wchar_t* expandedTemplate = ExpandTemplate(templateText);
-						if ( expandedTemplate )
+						ExpansionCache* expansionCache = __settings->GetExpansionCache();
+						string languageCode = CPPStringUtils::to_string(_languageCodeW);
+						wstring cachedExpansion;
+						int dependencies = 0;
+						
+						wchar_t* expandedTemplate = NULL;
+						if ( expansionCache && expansionCache->GetExpansion(languageCode, templateText, _pageName, cachedExpansion, &dependencies) )
 						{
-							if ( DEBUG )
-								wprintf(L"\r\nExpanded Template:\r\n%S\r\n", expandedTemplate);
+							// the calls in it were expanded already
+							_expansionDependencies |= dependencies;
+							if ( !cachedExpansion.empty() )
+								expandedTemplate = _arena->Strdup(cachedExpansion.c_str());
+						}
+						else
+						{
+							// collect what this call alone depends on
+							int outerDependencies = _expansionDependencies;
+							_expansionDependencies = 0;
 							
-							int size = wcslen(expandedTemplate); 
-							if ( size>4 )
+							expandedTemplate = ExpandTemplate(templateText);
+							if ( expandedTemplate && wcslen(expandedTemplate)>4 )
 							{
 								wchar_t* help = ExpandTemplates(expandedTemplate);
 								while ( help!=expandedTemplate )
 								{
-									free(expandedTemplate);
+									_arena->Free(expandedTemplate);
 									expandedTemplate = help;
 									
 									if ( expandedTemplate )
 										help = ExpandTemplates(expandedTemplate);
 								}
-								
-								size = wcslen(expandedTemplate); 
 							}
-													
+							
+							// nothing left is the same as a cache hit on an empty expansion
+							if ( expandedTemplate && !*expandedTemplate )
+							{
+								_arena->Free(expandedTemplate);
+								expandedTemplate = NULL;
+							}
+							
+							if ( expansionCache )
+								expansionCache->AddExpansion(languageCode, templateText, _pageName, expandedTemplate ? expandedTemplate : L"", _expansionDependencies);
+							
+							_expansionDependencies |= outerDependencies;
+						}
+						
+						if ( expandedTemplate )
+						{
+							if ( DEBUG )
+								wprintf(L"\r\nExpanded Template:\r\n%S\r\n", expandedTemplate);
+							
+							int size = wcslen(expandedTemplate); 
 							if ( size>0 )
 							{									
 								if ( DEBUG )
 									wprintf(L"\r\nExpanded Template:\r\n%S\r\n", expandedTemplate);
 								
-								int newDstSize = dstSize + size;
-								if ( newDstSize>dstLength )
-								{
-									// add the current template size, the remaining bytes and 256
-									dstLength += (size + (srcLength - (srcCurrent - src) ) + 256);
-									dst = (wchar_t*) realloc(dst, (dstLength+1)*sizeof(wchar_t));
-									
-									dstPos = dst + dstSize;
-								}
-								
-								wcsncpy(dstPos, expandedTemplate, size);
-								dstPos += size;
-								*dstPos = 0x0;
-								
-								dstSize += size;
+								TEXTPIECE piece = {expandedTemplate, size, expandedTemplate};
+								pieces.push_back(piece);
 							}
-							
-							free(expandedTemplate);
+							else
+								_arena->Free(expandedTemplate);
 						}
 					}
 					
 					handledOne = true;
-					free(templateText);
+					_arena->Free(templateText);
 				}
 				else 
 				{
@@ -656,52 +781,88 @@ wchar_t* WikiMarkupParser::ExpandTemplates(const wchar_t* src)
 		
 	} // while
 	
-	if ( handledOne )
-	{
-		// add everything what is left now (if necessary)
-		int size = (srcCurrent-srcPos - 1); 
-		if ( size>0 )
-		{
-			int newDstSize = dstSize + size;
-			if ( newDstSize>dstLength )
-			{
-				dstLength = newDstSize;
-				dst = (wchar_t*) realloc(dst, (dstLength+1)*sizeof(wchar_t));
-				
-				dstPos = dst + dstSize;
-			}
-			
-			wcsncpy(dstPos, srcPos, size);
-			dstPos += size;
-			*dstPos = 0x0;
-			
-			dstSize += size;
-			
-			srcPos = srcCurrent;		
-		}
-		else
-			*dstPos = 0x0;
-	}
-		
-	//	if ( DEBUG )
-	//	wprintf(L"---\r\n%S\r\b---", dst);	
-		
 	if ( !handledOne )
 	{
-		// if there was nothing to free the dst pointer and return the src
+		// if there was nothing return the src
 		// do not free commentsRemoved; if they are source is pointing to them
-		
-		free(dst);
 		return (wchar_t*) src;
 	}
-	else
+	
+	// add everything what is left now (if necessary)
+	int size = (srcCurrent-srcPos - 1); 
+	if ( size>0 )
+	{
+		TEXTPIECE piece = {srcPos, size, NULL};
+		pieces.push_back(piece);
+	}
+	
+	int dstLength = 0;
+	for (size_t i=0; i<pieces.size(); i++)
+		dstLength += pieces[i].length;
+	
+	wchar_t* dst = (wchar_t*) _arena->Alloc((dstLength+1)*sizeof(wchar_t));
+	wchar_t* dstPos = dst;
+	for (size_t i=0; i<pieces.size(); i++)
 	{
-		// everything is in dst now
-		if ( commentsRemoved )
-			free(commentsRemoved);
+		wmemcpy(dstPos, pieces[i].text, pieces[i].length);
+		dstPos += pieces[i].length;
 		
-		return dst;
+		if ( pieces[i].expansion )
+			_arena->Free(pieces[i].expansion);
 	}
+	*dstPos = 0x0;
+		
+	//	if ( DEBUG )
+	//	wprintf(L"---\r\n%S\r\b---", dst);	
+	
+	// everything is in dst now
+	if ( commentsRemoved )
+		_arena->Free(commentsRemoved);
+	
+	return dst;
+}
+
+// the "{|" check of ExpandTemplate; the text in front of the first parser function done in place isn't known
+static bool StartsTable(const TEMPLATEOUTPUT* output)
+{
+	if ( output->firstCall>=0 && output->firstCall<2 )
+		return false;
+	
+	if ( output->firstCall<0 && output->text.length()<=2 )
+		return false;
+	
+	return output->text[0]==L'{' && output->text[1]==L'|';
+}
+
+// trims like trim_left and trim_right, but not into the results of parser functions done in place
+static void TrimOutputLeft(TEMPLATEOUTPUT* output)
+{
+	int end = output->firstCall>=0 ? output->firstCall : output->text.length();
+	
+	int count = 0;
+	while ( count<end && output->text[count]<=0x20 )
+		count++;
+	
+	if ( !count )
+		return;
+	
+	output->text.erase(0, count);
+	if ( output->firstCall>=0 )
+	{
+		output->firstCall -= count;
+		output->lastCall -= count;
+	}
+}
+
+static void TrimOutputRight(TEMPLATEOUTPUT* output)
+{
+	int start = output->lastCall>=0 ? output->lastCall : 0;
+	
+	int length = output->text.length();
+	while ( length>start && output->text[length-1]<=0x20 )
+		length--;
+	
+	output->text.erase(length);
 }
 
 wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
@@ -728,7 +889,7 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 	// wprintf(L"Expanding template:\r\n'%S'\n", templateText);
 
 	int length = pos-templateText+1;
-	wchar_t* preTemplateName = (wchar_t*) malloc(length*sizeof(wchar_t));
+	wchar_t* preTemplateName = (wchar_t*) _arena->Alloc(length*sizeof(wchar_t));
 	wcsncpy(preTemplateName, templateText, pos-templateText);
 	preTemplateName[pos-templateText] = 0x0;
 	
@@ -740,7 +901,7 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 		wchar_t* expandedTemplateName = ExpandTemplates(preTemplateName);
 		if ( expandedTemplateName!=preTemplateName )
 		{
-			free(preTemplateName);
+			_arena->Free(preTemplateName);
 			preTemplateName = expandedTemplateName;
 		}
 	}
@@ -750,7 +911,7 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 	trim(templateName);
 	
 	// remove garbage
-	free(preTemplateName);
+	_arena->Free(preTemplateName);
 	
 	// wprintf(L"Template name: '%S'\n", templateName);
 		
@@ -778,13 +939,13 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 				if ( expandedCondition!=condition )
 				{
 					/*
-					wchar_t* newTemplate = (wchar_t*) malloc((2 + 4 + wcslen(expandedCondition) + wcslen(pos) + 2 + 1) * sizeof(wchar_t));
+					wchar_t* newTemplate = (wchar_t*) _arena->Alloc((2 + 4 + wcslen(expandedCondition) + wcslen(pos) + 2 + 1) * sizeof(wchar_t));
 					wcscpy(newTemplate, L"{{#if:");
 					wcscat(newTemplate, expandedCondition);
 					wcscat(newTemplate, pos);
 					wcscat(newTemplate, L"}}");
 					
-					free(expandedCondition);
+					_arena->Free(expandedCondition);
 					return newTemplate;
 					 */
 					
@@ -792,7 +953,7 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 					if ( !*expandedCondition )
 						result = false;
 					
-					free(expandedCondition);
+					_arena->Free(expandedCondition);
 				}
 			}
 		}
@@ -815,7 +976,7 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 				
 				DBH Value(value);
 				
-				return wstrdup(value);
+				return _arena->Strdup(value);
 			}
 			else
 				return NULL;
@@ -831,7 +992,7 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 				
 				DBH Value(pos);
 				
-				return wstrdup(pos);
+				return _arena->Strdup(pos);
 			}
 			else
 				return NULL;
@@ -848,7 +1009,7 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 		
 		
 		bool result = false;
-		wchar_t* expression = wstrdup(templateName+9);		
+		wchar_t* expression = _arena->Strdup(templateName+9);		
 		if ( *expression )
 		{
 			DBH Expression1(expression);
@@ -857,7 +1018,7 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 				wchar_t* expandedExpression = ExpandTemplates(expression);
 				if ( expandedExpression!=expression )
 				{
-					free(expression);
+					_arena->Free(expression);
 					
 					trim(expandedExpression);
 					expression = expandedExpression;
@@ -868,12 +1029,11 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 			DBH Expression(expression);
 			
 			TitleIndex* titleIndex = __settings->GetTitleIndex(CPPStringUtils::to_string(_languageCodeW));
-			ArticleSearchResult* articleSearchResult = titleIndex->FindArticle(CPPStringUtils::to_utf8(wstring(expression)));
 			
-			result = !articleSearchResult;
-			titleIndex->DeleteSearchResult(articleSearchResult);
+			// most of the checked pages don't exist, the filter answers them without a search
+			result = titleIndex->ArticleExists(CPPStringUtils::to_utf8(wstring(expression)));
 		}
-		free(expression);
+		_arena->Free(expression);
 		
 		pos++;
 		if ( result )
@@ -893,7 +1053,7 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 				
 				DBH Value(value);
 				
-				return wstrdup(value);
+				return _arena->Strdup(value);
 			}
 			else
 				return NULL;
@@ -909,7 +1069,7 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 				
 				DBH Value(pos);
 				
-				return wstrdup(pos);
+				return _arena->Strdup(pos);
 			}
 			else
 				return NULL;
@@ -928,7 +1088,7 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 		
 		bool result = false;
 		
-		wchar_t* expression = wstrdup(templateName+8);		
+		wchar_t* expression = _arena->Strdup(templateName+8);		
 		if ( *expression )
 		{
 			if ( wcsstr(expression, L"{{") )
@@ -936,7 +1096,7 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 				wchar_t* expandedExpression = ExpandTemplates(expression);
 				if ( expandedExpression!=expression )
 				{
-					free(expression);
+					_arena->Free(expression);
 					
 					 trim(expandedExpression);
 					expression = expandedExpression;
@@ -950,7 +1110,7 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 			if ( result )
 				result = true;
 		}
-		free(expression);
+		_arena->Free(expression);
 		
 		pos++;
 		if ( result )
@@ -970,7 +1130,7 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 				
 				DBH Value(value);
 				
-				return wstrdup(value);
+				return _arena->Strdup(value);
 			}
 			else
 				return NULL;
@@ -986,7 +1146,7 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 				
 				DBH Value(pos);
 				
-				return wstrdup(pos);
+				return _arena->Strdup(pos);
 			}
 			else
 				return NULL;
@@ -1005,13 +1165,13 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 		
 		if ( templateName[6] )
 		{
-			wchar_t* expression = wstrdup(templateName+6);		
+			wchar_t* expression = _arena->Strdup(templateName+6);		
 			if ( wcsstr(expression, L"{{") )
 			{
 				wchar_t* expandedExpression = ExpandTemplates(expression);
 				if ( expandedExpression!=expression )
 				{
-					free(expression);
+					_arena->Free(expression);
 					
 					trim(expandedExpression);
 					expression = expandedExpression;
@@ -1023,8 +1183,8 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 			
 			wchar_t result[256];
 			swprintf(result, 256, L"%g", EvaluateExpression(expression));
-			free(expression);
-			return wstrdup(result);
+			_arena->Free(expression);
+			return _arena->Strdup(result);
 		}
 
 		return NULL;
@@ -1060,7 +1220,7 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 					if ( notEqual )
 						length++;
 					
-					wchar_t* newTemplate = (wchar_t*) malloc( (length+1) * sizeof(wchar_t) );
+					wchar_t* newTemplate = (wchar_t*) _arena->Alloc( (length+1) * sizeof(wchar_t) );
 					if ( notEqual )
 						wcscpy(newTemplate, L"{{#ifneq:");
 					else
@@ -1070,7 +1230,7 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 					wcscat(newTemplate, pos);
 					wcscat(newTemplate, L"}}");
 					
-					free(expandedLeft);
+					_arena->Free(expandedLeft);
 					return newTemplate;
 				}
 			}
@@ -1102,7 +1262,7 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 							if ( notEqual )
 								length++;
 							
-							wchar_t* newTemplate = (wchar_t*) malloc( (length+1) * sizeof(wchar_t) );
+							wchar_t* newTemplate = (wchar_t*) _arena->Alloc( (length+1) * sizeof(wchar_t) );
 							if ( notEqual )
 								wcscpy(newTemplate, L"{{#ifneq:");
 							else
@@ -1114,7 +1274,7 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 							wcscat(newTemplate, pos);
 							wcscat(newTemplate, L"}}");
 							
-							free(expandedRight);
+							_arena->Free(expandedRight);
 							return newTemplate;
 						}
 					}
@@ -1134,7 +1294,7 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 						value[length] = 0x0;
 						trim(value);
 						
-						return wstrdup(value);
+						return _arena->Strdup(value);
 					}
 					else 
 					{
@@ -1151,7 +1311,7 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 							value[length] = 0x0;
 							trim(value);
 							
-							return wstrdup(value);
+							return _arena->Strdup(value);
 						}
 					}
 				}
@@ -1184,13 +1344,13 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 			wchar_t* expandedPhrase = ExpandTemplates(phrase);
 			if ( expandedPhrase!=phrase )
 			{
-				wchar_t* newTemplate = (wchar_t*) malloc((2 + 8 + wcslen(expandedPhrase) + wcslen(pos) + 2 + 1) * sizeof(wchar_t));
+				wchar_t* newTemplate = (wchar_t*) _arena->Alloc((2 + 8 + wcslen(expandedPhrase) + wcslen(pos) + 2 + 1) * sizeof(wchar_t));
 				wcscpy(newTemplate, L"{{#switch:");
 				wcscat(newTemplate, expandedPhrase);
 				wcscat(newTemplate, pos);
 				wcscat(newTemplate, L"}}");
 				
-				free(expandedPhrase);
+				_arena->Free(expandedPhrase);
 				return newTemplate;
 			}
 		}
@@ -1228,21 +1388,21 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 				if ( !wcscmp(phrase, name) || takeNext )
 				{
 					if ( defaultValue )
-						free(defaultValue);
+						_arena->Free(defaultValue);
 					
 					wchar_t* value = equalPos + 1;
 					// trim(value);
 					
-					return wstrdup(value);
+					return _arena->Strdup(value);
 				}
 				else if ( !wcscmp(name, L"#default") || takeNextForDefault )
 				{
 					if ( defaultValue )
-						free(defaultValue);
+						_arena->Free(defaultValue);
 					
 					wchar_t* value = equalPos + 1;
 					// trim(value);
-					defaultValue = wstrdup(value);
+					defaultValue = _arena->Strdup(value);
 					takeNextForDefault = false;
 				}
 			}
@@ -1268,26 +1428,26 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 	{
 		wstring error = L"USP:" + wstring(templateName);
 		// probably #ifexp
-		return wstrdup(error.c_str());
+		return _arena->Strdup(error.c_str());
 	}
 	else
 	{
 		// check for ignored templates
-		wchar_t* name = wstrdup(templateName);
+		wchar_t* name = _arena->Strdup(templateName);
 		to_lower(name);
 		const wchar_t** ignored = ignoredTemplates;
 		while ( *ignored )
 		{
 			if ( !wcscmp(*ignored, name) )
 			{
-				free(name);
+				_arena->Free(name);
 				return NULL;
 			}
 			
 			ignored++;
 		}
 		
-		free(name);
+		_arena->Free(name);
 	}
 	
 	// Let's try to get the template
@@ -1298,15 +1458,22 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 		templatePrefix = _languageConfig->GetSetting("templatePrefix", "Template:");
 	else
 		templatePrefix += ":";
-	wstring wikiTemplate = wikiMarkupGetter.GetTemplate(CPPStringUtils::to_utf8(templateName), templatePrefix);
+	CompiledTemplate* compiledTemplate = wikiMarkupGetter.GetCompiledTemplate(CPPStringUtils::to_utf8(templateName), templatePrefix);
+	const wstring& wikiTemplate = compiledTemplate->Text();
 	
 	// if ( DEBUG )
 	//	wprintf(L"\r\nGot template:\r\n%S\r\n", wikiTemplate.c_str());	
 	
 	if ( wikiTemplate==L"-" )
+	{
+		compiledTemplate->Release();
 		return NotHandledText(templateName);
+	}
 	else if ( wikiTemplate== L"{{" + wstring(templateName) + L"}}" )
+	{
+		compiledTemplate->Release();
 		return NULL; // prevents recursion:
+	}
 
 	TEMPLATEPARAM* params = NULL;
 	
@@ -1314,7 +1481,7 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 	if ( *pos )
 		pos++;
 	
-	wchar_t* templateParameters = wstrdup(pos);	
+	wchar_t* templateParameters = _arena->Strdup(pos);	
 	
 	if ( wcsstr(templateParameters, L"{{") )
 	{
@@ -1322,7 +1489,7 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 		if ( newParams!=templateParameters )
 		{
 			// wprintf(L"\r\n%S\r\nNew:%S\r\n", templateParameters, newParams);
-			free(templateParameters);
+			_arena->Free(templateParameters);
 			templateParameters = newParams;
 		}
 	}		
@@ -1445,9 +1612,38 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 		// for ( int i=0; i<paramCount; i++)
 		// 	wprintf(L"%S. %S=%S\r\n", listOfParams[i]->position.c_str(), listOfParams[i]->name.c_str(), listOfParams[i]->value.c_str());
 	}
-	free(templateParameters);
+	_arena->Free(templateParameters);
 		
-	// so we have the template, lets parse out all the params
+	// so we have the template, lets fill in the params
+	TEMPLATEOUTPUT output;
+	if ( !EvaluateTemplate(compiledTemplate, listOfParams, paramCount, &output) )
+	{
+		// the values have to be searched for params too
+		output.text = wikiTemplate;
+		output.firstCall = -1;
+		SubstituteTemplateParams(output.text, listOfParams, paramCount);
+	}
+	compiledTemplate->Release();
+	
+	// wprintf(L"Result:\n%S\n", output.text.c_str());
+	
+	// cleanup
+	while ( params )
+	{
+		TEMPLATEPARAM* help = params;
+		params = params->next;
+		delete help;
+	}
+	
+	// if this expands to a table, add a newline in front
+	if ( StartsTable(&output) )
+		output.text = L"\n" + output.text;
+	
+	return _arena->Strdup(output.text.c_str());
+}
+
+void WikiMarkupParser::SubstituteTemplateParams(wstring& wikiTemplate, TEMPLATEPARAM** listOfParams, int paramCount)
+{
 	size_t start = 0;
 	while ( (start=wikiTemplate.find(L"{{{", start))!=string::npos )
 	{
@@ -1526,49 +1722,300 @@ wchar_t* WikiMarkupParser::ExpandTemplate(const wchar_t* templateText)
 			start = start - 3;
 		}
 	}
-	// wprintf(L"Result:\n%S\n", wikiTemplate.c_str());
+}
+
+bool WikiMarkupParser::EvaluateTemplate(CompiledTemplate* compiledTemplate, TEMPLATEPARAM** listOfParams, int paramCount, TEMPLATEOUTPUT* output)
+{
+	TEMPLATEEVALUATION evaluation;
+	evaluation.params = listOfParams;
+	evaluation.paramCount = paramCount;
 	
-	// cleanup
-	while ( params )
+	if ( compiledTemplate->Calls() )
 	{
-		TEMPLATEPARAM* help = params;
-		params = params->next;
-		delete help;
+		evaluation.inPlace = true;
+		evaluation.commentSafe = compiledTemplate->HasComments();
+		evaluation.disturbed = false;
+		evaluation.opened = false;
+		evaluation.failed = false;
+		
+		output->text = wstring();
+		output->firstCall = -1;
+		output->lastCall = -1;
+		EvaluateTemplateNodes(compiledTemplate->Calls(), &evaluation, output);
+		
+		// without the comments the text may start with a table though it didn't
+		if ( !evaluation.failed && !(evaluation.opened && output->firstCall>=0) && !(evaluation.commentSafe && StartsTable(output)) )
+			return true;
 	}
 	
-	// if this expands to a table, add a newline in front
-	if ( wikiTemplate.length()>2 && wikiTemplate[0]==L'{' && wikiTemplate[1]==L'|' )
-		wikiTemplate = L"\n" + wikiTemplate;
+	evaluation.inPlace = false;
+	evaluation.commentSafe = false;
+	evaluation.disturbed = false;
+	evaluation.opened = false;
+	evaluation.failed = false;
+	
+	output->text = wstring();
+	output->firstCall = -1;
+	output->lastCall = -1;
+	EvaluateTemplateNodes(compiledTemplate->Nodes(), &evaluation, output);
+	
+	return !evaluation.failed;
+}
+
+void WikiMarkupParser::EvaluateTemplateNodes(const TEMPLATENODE* node, TEMPLATEEVALUATION* evaluation, TEMPLATEOUTPUT* output)
+{
+	for (; node; node=node->next)
+	{
+		switch ( node->type )
+		{
+			case TEMPLATE_TEXT:
+				output->text += node->text;
+				break;
+				
+			case TEMPLATE_PARAM:
+				EvaluateTemplateParam(node, evaluation, output);
+				break;
+				
+			default:
+				if ( !EvaluateParserFunction(node, evaluation, output) )
+					EvaluateTemplateNodes(node->call, evaluation, output);
+				break;
+		}
+	}
+}
+
+wstring WikiMarkupParser::EvaluateTemplateText(const TEMPLATENODE* node, TEMPLATEEVALUATION* evaluation)
+{
+	TEMPLATEOUTPUT output;
+	output.firstCall = -1;
+	output.lastCall = -1;
+	
+	EvaluateTemplateNodes(node, evaluation, &output);
+	
+	return output.text;
+}
+
+void WikiMarkupParser::EvaluateTemplateParam(const TEMPLATENODE* node, TEMPLATEEVALUATION* evaluation, TEMPLATEOUTPUT* output)
+{
+	size_t start = output->text.length();
+	
+	const wstring* value = TemplateParamValue(node->text, evaluation);
+	if ( value )
+		output->text += *value;
+	else
+		EvaluateTemplateNodes(node->defaultValue, evaluation, output);
+	
+	wstring inserted = output->text.substr(start);
+	
+	// SubstituteTemplateParams looks for params in the inserted text too
+	if ( inserted.find(L"{{{")!=wstring::npos || (!inserted.empty() && inserted[inserted.length()-1]==L'{') )
+		evaluation->failed = true;
+	
+	if ( node->adjacent || !CompiledTemplate::IsInert(inserted) )
+		evaluation->disturbed = true;
+	
+	if ( node->adjacent || inserted.find(L'{')!=wstring::npos )
+		evaluation->opened = true;
+	
+	if ( evaluation->commentSafe && (node->adjacent || !CompiledTemplate::IsCommentSafe(inserted)) )
+		evaluation->failed = true;
+}
+
+bool WikiMarkupParser::EvaluateParserFunction(const TEMPLATENODE* node, TEMPLATEEVALUATION* evaluation, TEMPLATEOUTPUT* output)
+{
+	if ( !evaluation->inPlace || evaluation->disturbed )
+		return false;
+	
+	// the values must not change where the call and its parts end
+	for (size_t i=0; i<node->params.size(); i++)
+	{
+		const TEMPLATENODE* param = node->params[i];
+		if ( param->adjacent )
+			return false;
+		
+		const wstring* value = TemplateParamValue(param->text, evaluation);
+		if ( value ? !CompiledTemplate::IsPlain(*value) : !param->plain )
+			return false;
+	}
+	
+	TEMPLATEOUTPUT result;
+	result.firstCall = -1;
+	result.lastCall = -1;
+	
+	// the same as ExpandTemplate does, an operand with a call in it is left to it
+	wstring operand = EvaluateTemplateText(node->parts[0], evaluation);
+	switch ( node->type )
+	{
+		case TEMPLATE_IF:
+		case TEMPLATE_IFEXIST:
+		{
+			if ( node->parts.size()<2 )
+				break;
+			
+			bool condition = false;
+			if ( node->type==TEMPLATE_IF )
+			{
+				operand = CPPStringUtils::trim(operand);
+				if ( operand.find(L"{{")!=wstring::npos )
+					return false;
+				
+				condition = !operand.empty();
+			}
+			else
+			{
+				size_t length = operand.length();
+				while ( length && operand[length-1]<=0x20 )
+					length--;
+				operand.erase(length);
+				
+				if ( !operand.empty() )
+				{
+					if ( operand.find(L"{{")!=wstring::npos )
+						return false;
+					
+					TitleIndex* titleIndex = __settings->GetTitleIndex(CPPStringUtils::to_string(_languageCodeW));
+					condition = titleIndex->ArticleExists(CPPStringUtils::to_utf8(operand));
+				}
+			}
+			
+			if ( condition )
+			{
+				EvaluateTemplateNodes(node->parts[1], evaluation, &result);
+				TrimOutputRight(&result);
+			}
+			else if ( node->parts.size()>2 )
+				EvaluateTemplateNodes(node->parts[2], evaluation, &result);
+			break;
+		}
+			
+		case TEMPLATE_IFEQ:
+		{
+			wstring left = CPPStringUtils::trim(operand);
+			if ( left.find(L"{{")!=wstring::npos )
+				return false;
+			
+			if ( node->parts.size()<3 )
+				break;
+			
+			wstring right = CPPStringUtils::trim(EvaluateTemplateText(node->parts[1], evaluation));
+			if ( right.find(L"{{")!=wstring::npos )
+				return false;
+			
+			if ( left==right )
+				EvaluateTemplateNodes(node->parts[2], evaluation, &result);
+			else if ( node->parts.size()>3 )
+				EvaluateTemplateNodes(node->parts[3], evaluation, &result);
+			
+			TrimOutputLeft(&result);
+			TrimOutputRight(&result);
+			break;
+		}
+			
+		case TEMPLATE_SWITCH:
+		{
+			if ( node->parts.size()<2 )
+				break;
+			
+			wstring phrase = CPPStringUtils::trim(operand);
+			if ( phrase.find(L"{{")!=wstring::npos )
+				return false;
+			
+			bool takeNext = false;
+			bool takeNextForDefault = false;
+			const TEMPLATENODE* defaultValue = NULL;
+			const TEMPLATENODE* value = NULL;
+			bool found = false;
+			
+			// the values are lists of nodes, an empty one is NULL
+			for (size_t i=1; i<node->parts.size() && !found; i++)
+			{
+				const TEMPLATENODE* caseNode = node->parts[i];
+				if ( caseNode->parts.size()>1 )
+				{
+					wstring name = CPPStringUtils::trim(EvaluateTemplateText(caseNode->parts[0], evaluation));
+					if ( name==phrase || takeNext )
+					{
+						value = caseNode->parts[1];
+						found = true;
+					}
+					else if ( name==L"#default" || takeNextForDefault )
+					{
+						defaultValue = caseNode->parts[1];
+						takeNextForDefault = false;
+					}
+				}
+				else
+				{
+					wstring data = EvaluateTemplateText(caseNode->parts[0], evaluation);
+					if ( data==phrase )
+						takeNext = true;
+					else if ( data==L"#default" )
+						takeNextForDefault = true;
+				}
+			}
+			
+			if ( !found )
+				value = defaultValue;
+			
+			EvaluateTemplateNodes(value, evaluation, &result);
+			break;
+		}
+	}
+	
+	int pos = output->text.length();
+	output->text += result.text;
+	if ( output->firstCall<0 )
+		output->firstCall = pos;
+	output->lastCall = output->text.length();
+	
+	return true;
+}
+
+const wstring* WikiMarkupParser::TemplateParamValue(const wstring& name, TEMPLATEEVALUATION* evaluation)
+{
+	// the first one with the name or the position, empty values don't count
+	for (int i=0; i<evaluation->paramCount; i++)
+	{
+		TEMPLATEPARAM* param = evaluation->params[i];
+		if ( param->name==name || param->position==name )
+			return param->value.empty() ? NULL : &param->value;
+	}
 	
-	return wstrdup(wikiTemplate.c_str());
+	return NULL;
 }
 
 wchar_t* WikiMarkupParser::HandleKnownTemplatesAndVariables(const wchar_t* text)
 {
 	if ( text==NULL )
 		return NULL;
+	
+	// the results of these can't be reused on another page or later on
+	if ( (!wcsncmp(text, L"CURRENT", 7) && wcscmp(text, L"CURRENTVERSION")) || !wcsncmp(text, L"LOCAL", 5) )
+		_expansionDependencies |= EXPANSION_DEPENDS_ON_TIME;
+	else if ( wcsstr(text, L"PAGENAME") )
+		_expansionDependencies |= EXPANSION_DEPENDS_ON_PAGE;
 
 	/* Table helpers  */
 	if ( !wcscmp(text, L"!") )
-		return wstrdup(L"|");
+		return _arena->Strdup(L"|");
 	else if ( !wcscmp(text, L"!-") )
-		return wstrdup(L"|-");
+		return _arena->Strdup(L"|-");
 	else if ( !wcscmp(text, L"!!") )
-		return wstrdup(L"||");
+		return _arena->Strdup(L"||");
 	else if ( !wcscmp(text, L"!-!") )
-		return wstrdup(L"|-\n|");
+		return _arena->Strdup(L"|-\n|");
 	else if ( !wcscmp(text, L"!+") )
-		return wstrdup(L"|+");
+		return _arena->Strdup(L"|+");
 	else if ( !wcscmp(text, L"!~") )
-		return wstrdup(L"|-\n!");
+		return _arena->Strdup(L"|-\n!");
 	else if ( !wcscmp(text, L"(!") )
-		return wstrdup(L"{|");
+		return _arena->Strdup(L"{|");
 	else if ( !wcscmp(text, L"!)") )
-		return wstrdup(L"|}");
+		return _arena->Strdup(L"|}");
 	else if ( !wcscmp(text, L"((") )
-		return wstrdup(L"{{");
+		return _arena->Strdup(L"{{");
 	else if ( !wcscmp(text, L"))") )
-		return wstrdup(L"}}");
+		return _arena->Strdup(L"}}");
 	
 	/* Namespaces and urls functions */
 	else if ( startsWith(text, L"ns:") )
@@ -1581,7 +2028,7 @@ wchar_t* WikiMarkupParser::HandleKnownTemplatesAndVariables(const wchar_t* text)
 		if ( which<1 || which>15 )
 			return NotHandledText(text);
 		
-		return wstrdup(nsNames[which]);
+		return _arena->Strdup(nsNames[which]);
 	}	
 	else if ( startsWith(text, L"localurl:") )
 	{
@@ -1594,7 +2041,7 @@ wchar_t* WikiMarkupParser::HandleKnownTemplatesAndVariables(const wchar_t* text)
 		wcscat(buffer, L"/");
 		wcscat(buffer, url);
 		
-		return wstrdup(buffer);
+		return _arena->Strdup(buffer);
 	}
 	else if ( startsWith(text, L"urlencode:") )
 	{
@@ -1602,7 +2049,7 @@ wchar_t* WikiMarkupParser::HandleKnownTemplatesAndVariables(const wchar_t* text)
 		if ( !*(url+1) )
 			return NotHandledText(text);
 
-		return wstrdup(CPPStringUtils::url_encode(wstring(url)).c_str());
+		return _arena->Strdup(CPPStringUtils::url_encode(wstring(url)).c_str());
 	}
 	else if ( startsWith(text, L"anchorencode:") )
 	{
@@ -1610,7 +2057,7 @@ wchar_t* WikiMarkupParser::HandleKnownTemplatesAndVariables(const wchar_t* text)
 		if ( !*(url+1) )
 			return NotHandledText(text);
 		
-		return wstrdup(CPPStringUtils::url_encode(wstring(url)).c_str());
+		return _arena->Strdup(CPPStringUtils::url_encode(wstring(url)).c_str());
 	}
 	else if ( startsWith(text, L"fullurl:") )
 	{
@@ -1624,7 +2071,7 @@ wchar_t* WikiMarkupParser::HandleKnownTemplatesAndVariables(const wchar_t* text)
 		wcscat(buffer, L"/");
 		wcscat(buffer, url);
 		
-		return wstrdup(buffer);
+		return _arena->Strdup(buffer);
 	}
 
 	/* Formatting */         
@@ -1634,7 +2081,7 @@ wchar_t* WikiMarkupParser::HandleKnownTemplatesAndVariables(const wchar_t* text)
 		if ( !*value )
 			return NotHandledText(text);
 		
-		return wstrdup(value);
+		return _arena->Strdup(value);
 	}
 	else if ( startsWith(text, L"lc:") )
 	{
@@ -1646,7 +2093,7 @@ wchar_t* WikiMarkupParser::HandleKnownTemplatesAndVariables(const wchar_t* text)
 		value[length] = 0x0;
 		to_lower(value);
 		
-		return wstrdup(value);
+		return _arena->Strdup(value);
 	}
 	else if ( startsWith(text, L"lcfirst:") )
 	{
@@ -1659,7 +2106,7 @@ wchar_t* WikiMarkupParser::HandleKnownTemplatesAndVariables(const wchar_t* text)
 		
 		value[0] = _to_wlower(value[0]);
 		
-		return wstrdup(value);
+		return _arena->Strdup(value);
 	}
 	else if ( startsWith(text, L"uc:") )
 	{
@@ -1671,7 +2118,7 @@ wchar_t* WikiMarkupParser::HandleKnownTemplatesAndVariables(const wchar_t* text)
 		value[length] = 0x0;
 		to_upper(value);
 		
-		return wstrdup(value);
+		return _arena->Strdup(value);
 	}
 	else if ( startsWith(text, L"ucfirst:") )
 	{
@@ -1684,7 +2131,7 @@ wchar_t* WikiMarkupParser::HandleKnownTemplatesAndVariables(const wchar_t* text)
 		
 		value[0] = _to_wupper(value[0]);
 		
-		return wstrdup(value);
+		return _arena->Strdup(value);
 	}                        
 	else if ( startsWith(text, L"formatnum:") )
 	{		
@@ -1733,25 +2180,25 @@ wchar_t* WikiMarkupParser::HandleKnownTemplatesAndVariables(const wchar_t* text)
 			help--;
 		}
 		
-		return wstrdup(result.c_str());
+		return _arena->Strdup(result.c_str());
 	}
 	else if ( startsWith(text, L"padleft:") )
 	{
-		return wstrdup(text+8);
+		return _arena->Strdup(text+8);
 	}
 	else if ( startsWith(text, L"padright:") )
 	{
-		return wstrdup(text+8);
+		return _arena->Strdup(text+8);
 	}
 	
 	/* conversion */
 	else if ( startsWith(text, L"convert|") )
 	{
-		return wstrdup(text+8);
+		return _arena->Strdup(text+8);
 	}
 	else if ( startsWith(text, L"Dmoz|") )
 	{
-		return wstrdup(L"");
+		return _arena->Strdup(L"");
 	}
 	
 	/* Date and Time functions */
@@ -1762,7 +2209,7 @@ wchar_t* WikiMarkupParser::HandleKnownTemplatesAndVariables(const wchar_t* text)
 		
 		wchar_t buffer[16];
 		swprintf(buffer, 16, L"%i", lt->tm_mday);
-		return wstrdup(buffer);
+		return _arena->Strdup(buffer);
 	}
 	else if ( !wcscmp(text, L"CURRENTDAY2") || !wcscmp(text, L"LOCALDAY2") ) 
 	{
@@ -1770,13 +2217,13 @@ wchar_t* WikiMarkupParser::HandleKnownTemplatesAndVariables(const wchar_t* text)
 		
 		wchar_t buffer[16];
 		swprintf(buffer, 16, L"%02i", lt->tm_mday);
-		return wstrdup(buffer);
+		return _arena->Strdup(buffer);
 	}
 	else if ( !wcscmp(text, L"CURRENTDAYNAME") || !wcscmp(text, L"LOCALDAYNAME") ) 
 	{
 		time_t t; time(&t); struct tm* lt; lt = localtime(&t);
 		
-		return wstrdup(DayName(lt->tm_wday).c_str());
+		return _arena->Strdup(DayName(lt->tm_wday).c_str());
 	}
 	else if ( !wcscmp(text, L"CURRENTDOW") || !wcscmp(text, L"LOCALDOW") ) 
 	{
@@ -1784,7 +2231,7 @@ wchar_t* WikiMarkupParser::HandleKnownTemplatesAndVariables(const wchar_t* text)
 		
 		wchar_t buffer[16];
 		swprintf(buffer, 16, L"%i", lt->tm_wday);
-		return wstrdup(buffer);
+		return _arena->Strdup(buffer);
 	}
 	else if ( !wcscmp(text, L"CURRENTMONTH") ||  !wcscmp(text, L"LOCALMONTH") ) 
 	{
@@ -1792,19 +2239,19 @@ wchar_t* WikiMarkupParser::HandleKnownTemplatesAndVariables(const wchar_t* text)
 		
 		wchar_t buffer[16];
 		swprintf(buffer, 16, L"%02i", lt->tm_mon + 1);
-		return wstrdup(buffer);
+		return _arena->Strdup(buffer);
 	}
 	else if ( !wcscmp(text, L"CURRENTMONTHABBREV") || !wcscmp(text, L"LOCALMONTHABBREV") ) 
 	{
 		time_t t; time(&t); struct tm* lt; lt = localtime(&t);
 		
-		return wstrdup(AbbrMonthName(lt->tm_mon).c_str());
+		return _arena->Strdup(AbbrMonthName(lt->tm_mon).c_str());
 	}
 	else if ( !wcscmp(text, L"CURRENTMONTHNAME") || !wcscmp(text, L"CURRENTMONTHNAMEGEN") || !wcscmp(text, L"LOCALMONTHNAME") || !wcscmp(text, L"LOCALMONTHNAMEGEN") ) 
 	{
 		time_t t; time(&t); struct tm* lt; lt = localtime(&t);
 		
-		return wstrdup(MonthName(lt->tm_mon).c_str());
+		return _arena->Strdup(MonthName(lt->tm_mon).c_str());
 	}
 	else if ( !wcscmp(text, L"CURRENTTIME") || !wcscmp(text, L"LOCALTIME") ) 
 	{
@@ -1812,7 +2259,7 @@ wchar_t* WikiMarkupParser::HandleKnownTemplatesAndVariables(const wchar_t* text)
 		
 		wchar_t buffer[16];
 		swprintf(buffer, 16, L"%02i:%02i", lt->tm_hour, lt->tm_min);
-		return wstrdup(buffer);
+		return _arena->Strdup(buffer);
 	}
 	else if ( !wcscmp(text, L"CURRENTHOUR") || !wcscmp(text, L"LOCALHOUR") ) 
 	{
@@ -1820,7 +2267,7 @@ wchar_t* WikiMarkupParser::HandleKnownTemplatesAndVariables(const wchar_t* text)
 		
 		wchar_t buffer[16];
 		swprintf(buffer, 16, L"%02i", lt->tm_hour);
-		return wstrdup(buffer);
+		return _arena->Strdup(buffer);
 	}
 	else if ( !wcscmp(text, L"CURRENTMINUTE") || !wcscmp(text, L"LOCALMINUTE") ) 
 	{
@@ -1828,7 +2275,7 @@ wchar_t* WikiMarkupParser::HandleKnownTemplatesAndVariables(const wchar_t* text)
 		
 		wchar_t buffer[16];
 		swprintf(buffer, 16, L"%02i", lt->tm_min);
-		return wstrdup(buffer);
+		return _arena->Strdup(buffer);
 	}
 	else if ( !wcscmp(text, L"CURRENTWEEK") || !wcscmp(text, L"LOCALWEEK") ) 
 	{
@@ -1836,7 +2283,7 @@ wchar_t* WikiMarkupParser::HandleKnownTemplatesAndVariables(const wchar_t* text)
 
 		wchar_t buffer[16];
 		swprintf(buffer, 16, L"%i", lt->tm_yday/7 + 1);
-		return wstrdup(buffer);
+		return _arena->Strdup(buffer);
 	}
 	else if ( !wcscmp(text, L"CURRENTYEAR") || !wcscmp(text, L"LOCALYEAR") ) 
 	{
@@ -1844,7 +2291,7 @@ wchar_t* WikiMarkupParser::HandleKnownTemplatesAndVariables(const wchar_t* text)
 		
 		wchar_t buffer[16];
 		swprintf(buffer, 16, L"%04i", lt->tm_year + 1900);
-		return wstrdup(buffer);
+		return _arena->Strdup(buffer);
 	}
 	else if ( !wcscmp(text, L"CURRENTTIMESTAMP") || !wcscmp(text, L"LOCALTIMESTAMP") ) 
 	{
@@ -1852,7 +2299,7 @@ wchar_t* WikiMarkupParser::HandleKnownTemplatesAndVariables(const wchar_t* text)
 		
 		wchar_t buffer[16];
 		swprintf(buffer, 16, L"%04i%02i%02i%02i%02i%02i", lt->tm_year + 1900, lt->tm_mon, lt->tm_mday, lt->tm_hour, lt->tm_min, lt->tm_sec);
-		return wstrdup(buffer);
+		return _arena->Strdup(buffer);
 	}
 	
 	/* Page names and related info  */
@@ -1860,14 +2307,14 @@ wchar_t* WikiMarkupParser::HandleKnownTemplatesAndVariables(const wchar_t* text)
 	else if ( !wcscmp(text, L"PAGENAME") || !wcscmp(text, L"PAGENAMEE") )
 	{
 		if ( _pageName==NULL )
-			return wstrdup(L"");
+			return _arena->Strdup(L"");
 		else
-			return wstrdup(_pageName);
+			return _arena->Strdup(_pageName);
 	}
 	else if ( !wcscmp(text, L"SUBPAGENAME") || !wcscmp(text, L"SUBPAGENAMEE") )
 	{
 		if ( _pageName==NULL )
-			return wstrdup(L"");
+			return _arena->Strdup(L"");
 
 		const wchar_t* slash = NULL;
 		const wchar_t* help = _pageName;
@@ -1878,23 +2325,23 @@ wchar_t* WikiMarkupParser::HandleKnownTemplatesAndVariables(const wchar_t* text)
 		}
 		
 		if ( slash )
-			return wstrdup(slash);
+			return _arena->Strdup(slash);
 		else
-			return wstrdup(L"");
+			return _arena->Strdup(L"");
 	}
 	else if ( !wcscmp(text, L"BASEPAGENAME") || !wcscmp(text, L"BASEPAGENAMEE") )
 	{
 		if ( _pageName==NULL )
-			return wstrdup(L"");
+			return _arena->Strdup(L"");
 		
 		const wchar_t* slash = wcsstr(_pageName, L"/");
 		if ( slash )
-			return wstrndup(_pageName, slash-_pageName);
+			return _arena->Strndup(_pageName, slash-_pageName);
 		else
-			return wstrdup(_pageName);
+			return _arena->Strdup(_pageName);
 	}
 	else if ( !wcscmp(text, L"NAMESPACE") || !wcscmp(text, L"NAMESPACEE") )
-		return wstrdup(_languageCodeW);
+		return _arena->Strdup(_languageCodeW);
 	else if ( !wcscmp(text, L"FULLPAGENAME") || !wcscmp(text, L"FULLPAGENAMEE") )
 	{
 		wchar_t buffer[wcslen(_languageCodeW) + 1 + wcslen(_pageName) + 1];
@@ -1902,82 +2349,82 @@ wchar_t* WikiMarkupParser::HandleKnownTemplatesAndVariables(const wchar_t* text)
 		wcscat(buffer, L"/");
 		wcscat(buffer, _pageName);
 
-		return wstrdup(buffer);
+		return _arena->Strdup(buffer);
 	}
 	else if ( !wcscmp(text, L"TALKSPACE") || !wcscmp(text, L"TALKSPACEE") ) 
-		return wstrdup(L"");
+		return _arena->Strdup(L"");
 	else if ( !wcscmp(text, L"SUBJECTSPACE") || !wcscmp(text, L"SUBJECTSPACEE") ) 
-		return wstrdup(L"");
+		return _arena->Strdup(L"");
 	else if ( !wcscmp(text, L"ARTICLESPACE") || !wcscmp(text, L"ARTICLESPACEE") ) 
-		return wstrdup(L"");
+		return _arena->Strdup(L"");
 	else if ( !wcscmp(text, L"TALKPAGENAME") || !wcscmp(text, L"TALKPAGENAMEE") ) 
-		return wstrdup(L"");
+		return _arena->Strdup(L"");
 	else if ( !wcscmp(text, L"SUBJECTPAGENAME") || !wcscmp(text, L"SUBJECTPAGENAMEE") ) 
-		return wstrdup(L"");
+		return _arena->Strdup(L"");
 	else if ( !wcscmp(text, L"ARTICLEPAGENAME") || !wcscmp(text, L"ARTICLEPAGENAMEE") ) 
-		return wstrdup(L"");
+		return _arena->Strdup(L"");
 	else if ( !wcscmp(text, L"REVISIONID") ) 
-		return wstrdup(L"0");
+		return _arena->Strdup(L"0");
 	else if ( !wcscmp(text, L"REVISIONDAY") ) 
-		return wstrdup(L"1");
+		return _arena->Strdup(L"1");
 	else if ( !wcscmp(text, L"REVISIONDAY2") ) 
-		return wstrdup(L"01");
+		return _arena->Strdup(L"01");
 	else if ( !wcscmp(text, L"REVISIONMONTH") ) 
-		return wstrdup(L"01");
+		return _arena->Strdup(L"01");
 	else if ( !wcscmp(text, L"REVISIONYEAR") ) 
-		return wstrdup(L"2007");
+		return _arena->Strdup(L"2007");
 	else if ( !wcscmp(text, L"REVISIONTIMESTAMP") ) 
-		return wstrdup(L"20070101000000");
+		return _arena->Strdup(L"20070101000000");
 	else if ( !wcscmp(text, L"SITENAME") ) 
-		return wstrdup(L"Offline-Wikipedia");
+		return _arena->Strdup(L"Offline-Wikipedia");
 	else if ( !wcscmp(text, L"SERVER") ) 
-		return wstrdup(L"http://127.0.0.1");
+		return _arena->Strdup(L"http://127.0.0.1");
 	else if ( !wcscmp(text, L"SCRIPTPATH") ) 
-		return wstrdup(L"");
+		return _arena->Strdup(L"");
 	else if ( !wcscmp(text, L"/scripts") ) 
-		return wstrdup(L"");
+		return _arena->Strdup(L"");
 	else if ( !wcscmp(text, L"SERVERNAME") ) 
-		return wstrdup(L"127.0.0.1");
+		return _arena->Strdup(L"127.0.0.1");
 
 	/* statistics */ 
 	else if ( !wcscmp(text, L"CURRENTVERSION") ) 
-		return wstrdup(CPPStringUtils::to_wstring(__settings->Version()).c_str());
+		return _arena->Strdup(CPPStringUtils::to_wstring(__settings->Version()).c_str());
 	else if ( !wcscmp(text, L"NUMBEROFEDITS") ) 
-		return wstrdup(L"1");
+		return _arena->Strdup(L"1");
 	else if ( !wcscmp(text, L"NUMBEROFARTICLES") ) 
 	{
 		TitleIndex* titleIndex = __settings->GetTitleIndex(CPPStringUtils::to_string(_languageCodeW));
 		wchar_t buffer[32];
 		swprintf(buffer, 32, L"%i", titleIndex->NumberOfArticles());
-		return wstrdup(buffer);
+		return _arena->Strdup(buffer);
 	}
 	else if ( !wcscmp(text, L"NUMBEROFPAGES") ) 
-		return wstrdup(L"1");
+		return _arena->Strdup(L"1");
 	else if ( !wcscmp(text, L"NUMBEROFFILES") ) 
-		return wstrdup(L"1");
+		return _arena->Strdup(L"1");
 	else if ( !wcscmp(text, L"NUMBEROFEDITS") ) 
-		return wstrdup(L"1.0");
+		return _arena->Strdup(L"1.0");
 	else if ( !wcscmp(text, L"NUMBEROFUSERS") ) 
-		return wstrdup(L"1");
+		return _arena->Strdup(L"1");
 	else if ( !wcscmp(text, L"NUMBEROFADMINS") ) 
-		return wstrdup(L"1");
+		return _arena->Strdup(L"1");
 	else if ( !wcscmp(text, L"PAGESINNAMESPACE") ) 
-		return wstrdup(L"1");
+		return _arena->Strdup(L"1");
 	else if ( !wcscmp(text, L"PAGESINNS:") ) 
-		return wstrdup(L"1");
+		return _arena->Strdup(L"1");
 
 	/* Miscellany */
 	else if ( startsWith(text, L"DISPLAYTITLE:") ) 
-		return wstrdup(L"");
+		return _arena->Strdup(L"");
 	else if ( !wcscmp(text, L"DIRMARK") || !wcscmp(text, L"DIRECTIONMARK") ) 
-		return wstrdup(L"");
+		return _arena->Strdup(L"");
 	else if ( !wcscmp(text, L"CONTENTLANGUAGE") ) 
-		return wstrdup(_languageCodeW);
+		return _arena->Strdup(_languageCodeW);
 	else if ( startsWith(text, L"DEFAULTSORT") )
-		return wstrdup(L""); 
+		return _arena->Strdup(L""); 
 	
 	else if ( !wcscmp(text, L"reflist") )
-		return wstrdup(L"<references />");	
+		return _arena->Strdup(L"<references />");	
 		
 	else
 		return NULL; // not handled	
@@ -1990,7 +2437,7 @@ wchar_t* WikiMarkupParser::NotHandledText(const wchar_t* text)
 	buffer += CPPStringUtils::to_wstring(templatePrefix) + text;
 	buffer += L"</span>";
 
-	return wstrdup(buffer.c_str());	
+	return _arena->Strdup(buffer.c_str());	
 }
 
 const wchar_t* WikiMarkupParser::PosOfNextParamPipe(const wchar_t* pos)
@@ -2061,7 +2508,7 @@ wchar_t* WikiMarkupParser::GetTextInDoubleBrakets(wchar_t startBraket, wchar_t e
 		count++;
 	}
 	
-	text = (wchar_t*) malloc((count+1) * sizeof(wchar_t));
+	text = (wchar_t*) _arena->Alloc((count+1) * sizeof(wchar_t));
 	wchar_t* pText = text;
 		
 	while (count--)
@@ -2096,7 +2543,7 @@ wchar_t* WikiMarkupParser::GetTextInSingleBrakets(wchar_t startBraket, wchar_t e
 		count++;
 	}
 	
-	wchar_t* text = (wchar_t*) malloc((count+1) * sizeof(wchar_t));
+	wchar_t* text = (wchar_t*) _arena->Alloc((count+1) * sizeof(wchar_t));
 	wchar_t* pText = text;
 	
 	while (count--)
@@ -2121,7 +2568,7 @@ wchar_t* WikiMarkupParser::GetNextLine()
 		count++;
 	}
 	
-	wchar_t* line = (wchar_t*) malloc((count+1)*sizeof(wchar_t));
+	wchar_t* line = (wchar_t*) _arena->Alloc((count+1)*sizeof(wchar_t));
 	wchar_t* pLine = line;
 	
 	while ( count-- )
@@ -2157,7 +2604,7 @@ wchar_t* WikiMarkupParser::GetTextUntilNextTag()
 		return NULL;
 	
 	int length = stop-start;
-	wchar_t* result = (wchar_t*) malloc((length+1) * sizeof(wchar_t));
+	wchar_t* result = (wchar_t*) _arena->Alloc((length+1) * sizeof(wchar_t));
 	wcsncpy(result, start, length);
 	result[length] = 0x0;
 	
@@ -2224,50 +2671,24 @@ bool WikiMarkupParser::GetPixelUnit(wchar_t* src, int* width, int* height)
 
 inline void WikiMarkupParser::Append(wchar_t c) 
 {
-	if ( _iOutputRemain==0 ) {
-		if ( _iOutputSize==0 ) {
-			_iOutputSize = OUTPUT_GROWS;
-			_pOutput = (wchar_t*) malloc( (_iOutputSize+1)*sizeof(wchar_t) );
-			
-			_pCurrentOutput = _pOutput;
-			_iOutputRemain = _iOutputSize;
-		}
-		else {
-			_pOutput = (wchar_t*) realloc(_pOutput, (_iOutputSize+OUTPUT_GROWS+1)*sizeof(wchar_t) );
-			_pCurrentOutput = (_pOutput+_iOutputSize);
-			_iOutputSize += OUTPUT_GROWS;
-			_iOutputRemain = OUTPUT_GROWS;
-		}
-	}
-	
-	*_pCurrentOutput++ = c;
-	*_pCurrentOutput = 0x0;
-	_iOutputRemain--;
+	_output.Append(c);
 }
 
 void WikiMarkupParser::Append(const wchar_t* msg) {
-	if ( msg==NULL )
-		return;
-		
-	while(*msg!=0x0)
-		Append(*msg++);
+	_output.Append(msg);
 }
 
 void WikiMarkupParser::AppendHtml(const wchar_t* html) 
 {
-	if ( html==NULL )
-		return;
-	
-	while(*html!=0x0)
-		Append(*html++);
+	_output.Append(html);
 }
 
 void WikiMarkupParser::PushTag(wchar_t* name, bool output)
 {
-	tagType* newTag = new tagType;
-	newTag->name = (wchar_t*) malloc( (wcslen(name)+1)*sizeof(wchar_t) );
+	tagType* newTag = (tagType*) _arena->Alloc(sizeof(tagType));
+	newTag->name = (wchar_t*) _arena->Alloc( (wcslen(name)+1)*sizeof(wchar_t) );
 	wcscpy(newTag->name, name);
-	newTag->position = _pCurrentOutput - _pOutput;
+	newTag->position = _output.Length();
 	 
 	newTag->pPrevious = _pCurrentTag;
 	newTag->pNext = NULL;
@@ -2301,8 +2722,8 @@ void WikiMarkupParser::PopTag(wchar_t* name, bool output)
 	if ( _pCurrentTag!=NULL ) 
 		_pCurrentTag->pNext = NULL;
 	
-	free(oldTag->name);
-	delete(oldTag);
+	_arena->Free(oldTag->name);
+	_arena->Free(oldTag);
 	
 	if ( output )
 	{ 
@@ -2338,6 +2759,79 @@ void WikiMarkupParser::HandleParagraph()
 	Append(L"<p />");
 }
 
+wstring WikiMarkupParser::InternalLinkTarget(const wchar_t* link, int length)
+{
+	// the article an internal link points to; empty for links to other namespaces, languages
+	// or only to a section of this page
+	wstring target = wstring(link, length);
+	
+	size_t pos = target.find(L':');
+	if ( pos!=wstring::npos )
+		return wstring();
+	
+	pos = target.find(L'#');
+	if ( pos!=wstring::npos )
+		target = target.substr(0, pos);
+	
+	for (size_t i=0; i<target.length(); i++)
+		if ( target[i]==L'_' )
+			target[i] = L' ';
+	
+	return CPPStringUtils::trim(target);
+}
+
+void WikiMarkupParser::CheckInternalLinks()
+{
+	// collects the targets of all internal links of the page and looks them up at once
+	vector<wstring> targets;
+	
+	const wchar_t* pos = _pInput;
+	while ( (pos=wcsstr(pos, L"[["))!=NULL )
+	{
+		pos += 2;
+		
+		const wchar_t* end = pos;
+		while ( *end && *end!=L'|' && *end!=L']' && *end!=L'[' && *end!=L'\n' )
+			end++;
+		
+		// links inside of image descriptions are found as well, the search continues behind the "[["
+		if ( *end==L'|' || *end==L']' )
+		{
+			wstring target = InternalLinkTarget(pos, end - pos);
+			if ( !target.empty() )
+				targets.push_back(target);
+		}
+	}
+	
+	sort(targets.begin(), targets.end());
+	targets.erase(unique(targets.begin(), targets.end()), targets.end());
+	
+	vector<string> titles(targets.size());
+	for (size_t i=0; i<targets.size(); i++)
+		titles[i] = CPPStringUtils::to_utf8(targets[i]);
+	
+	vector<int> matches;
+	_titleIndex->ResolveTitles(titles, matches);
+	
+	// the order of the targets is kept, so the missing ones are sorted too
+	vector<wstring>* missingLinks = new vector<wstring>();
+	for (size_t i=0; i<targets.size(); i++)
+		if ( !matches[i] )
+			missingLinks->push_back(targets[i]);
+	
+	if ( _missingLinks && !_sharedMissingLinks )
+		delete((vector<wstring>*) _missingLinks);
+	_missingLinks = missingLinks;
+	_sharedMissingLinks = false;
+}
+
+void WikiMarkupParser::ShareMissingLinks(const WikiMarkupParser* parent)
+{
+	// parsers for parts of the page (captions, headlines etc.) use the links checked for the whole page
+	_missingLinks = parent->_missingLinks;
+	_sharedMissingLinks = true;
+}
+
 void WikiMarkupParser::HandleInternalLink(const wchar_t* linkText)
 {
 	bool valid = true;
@@ -2440,13 +2934,13 @@ void WikiMarkupParser::HandleInternalLink(const wchar_t* linkText)
 		} 
 		else if (!wcscmp(lowerSpecial, _imageNamespace) || !wcscmp(lowerSpecial, L"image") )
 		{
-			wchar_t* imageFilename = wstrdup(pos + 1);
+			wchar_t* imageFilename = _arena->Strdup(pos + 1);
 			trim(imageFilename);
 
 			// get a pointer to the last real "|" (the description):
 			wchar_t* imageDescription = L"";
 			
-			wchar_t** params = split(linkDescription, L'|');
+			wchar_t** params = _arena->Split(linkDescription, L'|');
 			
 			bool thumb = false;
 			bool frame = false;
@@ -2490,8 +2984,8 @@ void WikiMarkupParser::HandleInternalLink(const wchar_t* linkText)
 				if ( !thumb || !*imageDescription )
 				{
 					// skip image code because we don't have images or an description
-					free_split_result(params);
-					free(imageFilename);
+					_arena->Free(params);
+					_arena->Free(imageFilename);
 				
 					return;
 				}
@@ -2614,7 +3108,8 @@ void WikiMarkupParser::HandleInternalLink(const wchar_t* linkText)
 				
 				if ( *imageDescription ) 
 				{
-					WikiMarkupParser wikiMarkupParser(_languageCodeW, _pageName, false);
+					WikiMarkupParser wikiMarkupParser(_languageCodeW, _pageName, false, _arena);
+					wikiMarkupParser.ShareMissingLinks(this);
 					wikiMarkupParser.SetInput(imageDescription);
 					wikiMarkupParser.Parse();
 					
@@ -2664,8 +3159,8 @@ void WikiMarkupParser::HandleInternalLink(const wchar_t* linkText)
 					Append(L"</div>\r\n");
 			}
 			
-			free_split_result(params);
-			free(imageFilename);
+			_arena->Free(params);
+			_arena->Free(imageFilename);
 
 			return;
 		}
@@ -2685,29 +3180,20 @@ void WikiMarkupParser::HandleInternalLink(const wchar_t* linkText)
 			return;
 		}
 	}
-	else
+	else if ( _missingLinks )
 	{
-		/*
-		TitleIndex* titleIndex = __settings->GetTitleIndex(CPPStringUtils::to_string(_languageCodeW));
-		ArticleSearchResult* articleSearchResult = titleIndex->FindArticle(CPPStringUtils::to_utf8(wstring(link)), false);
-																		   
-		if ( articleSearchResult )
-			titleIndex->DeleteSearchResult(articleSearchResult);
-		else
-			valid = false; 
-		*/
+		// all links of the page were looked up before parsing
+		wstring target = InternalLinkTarget(link, wcslen(link));
 		
-		/*
-		 that takes to long, a binary search should be a lot faster
-		WikiMarkupGetter wikiMarkupGetter;
-		string name = wikiMarkupGetter.FindArticle(CPPStringUtils::to_utf8(wstring(link)));
-		valid = !name.empty();
-		 */
+		vector<wstring>* missingLinks = (vector<wstring>*) _missingLinks;
+		if ( !target.empty() && binary_search(missingLinks->begin(), missingLinks->end(), target) )
+			valid = false;
 	}
 	
 	if ( link!=linkDescription ) 
 	{		
-		WikiMarkupParser wikiMarkupParser(_languageCodeW, _pageName, false);
+		WikiMarkupParser wikiMarkupParser(_languageCodeW, _pageName, false, _arena);
+		wikiMarkupParser.ShareMissingLinks(this);
 		wikiMarkupParser.SetInput(linkDescription);
 		wikiMarkupParser.Parse();
 
@@ -2772,13 +3258,14 @@ void WikiMarkupParser::HandleExternalLink(const wchar_t* linkText)
 	if ( linkText==NULL )
 		return;
 
-	wchar_t* link = wstrdup(linkText);
+	wchar_t* link = _arena->Strdup(linkText);
 	wchar_t* linkDescription = wcsstr(link, L" ");
 	if ( linkDescription ) 
 	{
 		*linkDescription++ = 0x0;
 
-		WikiMarkupParser wikiMarkupParser(_languageCodeW, _pageName, false);
+		WikiMarkupParser wikiMarkupParser(_languageCodeW, _pageName, false, _arena);
+		wikiMarkupParser.ShareMissingLinks(this);
 		wikiMarkupParser.SetInput(linkDescription);
 		wikiMarkupParser.Parse();
 
@@ -2801,7 +3288,7 @@ void WikiMarkupParser::HandleExternalLink(const wchar_t* linkText)
 		Append(L"</a>");
 	}
 	
-	free(link);
+	_arena->Free(link);
 }
 
 void WikiMarkupParser::HandleHeadline(const wchar_t* headlineText, int level)
@@ -2809,28 +3296,24 @@ void WikiMarkupParser::HandleHeadline(const wchar_t* headlineText, int level)
 	CloseOpenWikiTags();
 
 	if ( _tocPosition<0 )
-		_tocPosition = (_pCurrentOutput - _pOutput);
+		_tocPosition = _output.Length();
 	
-	WikiMarkupParser wikiMarkupParser(_languageCodeW, _pageName, false);
+	WikiMarkupParser wikiMarkupParser(_languageCodeW, _pageName, false, _arena);
+	wikiMarkupParser.ShareMissingLinks(this);
 	wikiMarkupParser.SetInput(headlineText);
 	wikiMarkupParser.Parse();
 	
 	// create a TOC entry
-	TOC* toc = new TOC();
-	toc->name = wstrdup(headlineText);
+	TOC* toc = (TOC*) _arena->Alloc(sizeof(TOC));
+	toc->name = _arena->Strdup(headlineText);
 	toc->level = level;
 	toc->next = NULL;
 	
 	if ( _toc )
-	{
-		TOC* help = (TOC*) _toc;
-		while ( help->next ) 
-			help = help->next;
-		
-		help->next = toc;
-	}
+		((TOC*) _lastToc)->next = toc;
 	else 
 		_toc = toc;	
+	_lastToc = toc;
 	
 	wstring ancorName = wstring(headlineText);
 	size_t pos;
@@ -2839,7 +3322,7 @@ void WikiMarkupParser::HandleHeadline(const wchar_t* headlineText, int level)
 	ancorName = CPPStringUtils::url_encode(ancorName);
 	
 	int bufferSize = 128;
-	wchar_t* buffer = (wchar_t*) malloc(bufferSize * sizeof(wchar_t));	
+	wchar_t* buffer = (wchar_t*) _arena->Alloc(bufferSize * sizeof(wchar_t));	
 	
 	Append(L"<a name=\"");
 	Append(ancorName.c_str());
@@ -2856,7 +3339,7 @@ void WikiMarkupParser::HandleHeadline(const wchar_t* headlineText, int level)
 	Append(buffer);
 	Append(L">");
 	
-	free(buffer);
+	_arena->Free(buffer);
 	
 	// every headline is followed by a paragraph, so another is not necessary
 	_newLine = 2;
@@ -2897,7 +3380,7 @@ wchar_t* WikiMarkupParser::GetParams(bool stopAtExclamtionAlso)
 		count++;
 	}
 	
-	wchar_t* params = (wchar_t*) malloc( (count + 1) * sizeof(wchar_t) );
+	wchar_t* params = (wchar_t*) _arena->Alloc( (count + 1) * sizeof(wchar_t) );
 	wchar_t* dest = params;
 	while ( count-- ) 
 		*dest++ = GetNextChar();
@@ -2920,7 +3403,7 @@ void WikiMarkupParser::Parse()
 		
 		if ( newInput!=_pInput )
 		{
-			free(_pInput);
+			_arena->Free(_pInput);
 			
 			_pInput = newInput;
 			_pCurrentInput = _pInput;
@@ -2928,12 +3411,16 @@ void WikiMarkupParser::Parse()
 		}
 		
 		// wprintf(L"\r\n%S", _pInput);
+		
+		if ( _titleIndex && _titleIndex->NumberOfArticles()>0 )
+			CheckInternalLinks();
 	}
 	
 	_pCurrentInput = _pInput;
 	
-	_pCurrentOutput = _pOutput;
-	_iOutputRemain = _iOutputSize;
+	// the html is mostly the text with some markup around it
+	_output.Clear();
+	_output.Reserve(_inputLength + _inputLength/2);
 
 	_newLine = 1;
 	
@@ -3041,7 +3528,7 @@ void WikiMarkupParser::Parse()
 						trim(line);
 
 						HandleHeadline(line, level);
-						free(line);
+						_arena->Free(line);
 						handled = true;
 					}
 					break;
@@ -3215,7 +3702,7 @@ void WikiMarkupParser::Parse()
 
 					PushTag(L"table", false);
 					
-					free(line);
+					_arena->Free(line);
 
 					handled = true;
 					break;
@@ -3255,7 +3742,7 @@ void WikiMarkupParser::Parse()
 						trim(line);
 
 						// Ignorieren
-						free(line);
+						_arena->Free(line);
 
 						handled = true;
 						break;
@@ -3292,7 +3779,7 @@ void WikiMarkupParser::Parse()
 						
 						PushTag(L"tr", false);
 						
-						free(line);
+						_arena->Free(line);
 
 						handled = true;
 						break;
@@ -3318,7 +3805,7 @@ void WikiMarkupParser::Parse()
 							Append(params);
 							Append(L">");
 						
-							free(params);
+							_arena->Free(params);
 						}
 						else
 							Append(L"<td>");
@@ -3352,7 +3839,7 @@ void WikiMarkupParser::Parse()
 						Append(params);
 						Append(L">");
 						
-						free(params);
+						_arena->Free(params);
 					}
 					else
 						Append(L"<td>");
@@ -3389,7 +3876,7 @@ void WikiMarkupParser::Parse()
 						// italic, start or end?
 						if ( _italic<0 ) {
 							// start
-							_italic = (_pCurrentOutput - _pOutput);
+							_italic = _output.Length();
 							Append(L"<i>");
 						}
 						else {
@@ -3397,7 +3884,7 @@ void WikiMarkupParser::Parse()
 							if ( _bold>_italic ) {
 								// yes, close and reopen it
 								Append(L"</b></i>");
-								_bold = (_pCurrentOutput - _pOutput);
+								_bold = _output.Length();
 								Append(L"<b>");
 								_italic = -1;
 							}
@@ -3412,7 +3899,7 @@ void WikiMarkupParser::Parse()
 						// bold, start or end?
 						if ( _bold<0 ) {
 							// start
-							_bold = (_pCurrentOutput - _pOutput);
+							_bold = _output.Length();
 							Append(L"<b>");
 						}
 						else {
@@ -3420,7 +3907,7 @@ void WikiMarkupParser::Parse()
 							if ( _italic>_bold ) {
 								// yes, close and reopen it
 								Append(L"</i></b>");
-								_italic = (_pCurrentOutput - _pOutput);
+								_italic = _output.Length();
 								Append(L"<i>");
 								_bold = -1;
 							}
@@ -3519,7 +4006,7 @@ void WikiMarkupParser::Parse()
 								{
 									wchar_t* params = GetTextUntilNextTag();
 									if ( params )
-										free(params);
+										_arena->Free(params);
 								}
 								break;
 								
@@ -3543,7 +4030,7 @@ void WikiMarkupParser::Parse()
 									{
 										int count = 1;
 
-										REF* ref = new REF();
+										REF* ref = (REF*) _arena->Alloc(sizeof(REF));
 										ref->start = start;
 										ref->length = wcslen(params);
 										ref->next = NULL;
@@ -3564,7 +4051,7 @@ void WikiMarkupParser::Parse()
 										else
 											_references = ref;
 											
-										free(params);
+										_arena->Free(params);
 										wchar_t number[16];
 										swprintf(number, 16, L"%i", count);
 										Append(L"<sup><a href=\"#_note-");
@@ -3625,7 +4112,7 @@ void WikiMarkupParser::Parse()
 					
 					// cleanup
 					if ( linkText )
-						free(linkText);
+						_arena->Free(linkText);
 
 					break;
 				}
@@ -3678,7 +4165,7 @@ void WikiMarkupParser::Parse()
 					}
 					else if (!wcscmp(buffer, L"TOC") )
 					{
-						_tocPosition = (_pCurrentOutput - _pOutput);
+						_tocPosition = _output.Length();
 						_forceToc = true;
 						_noToc = false;
 					}
@@ -3720,7 +4207,7 @@ void WikiMarkupParser::Parse()
 						Append(params);
 						Append(L">");
 						
-						free(params);
+						_arena->Free(params);
 					}
 					else
 						Append(L"<td>");
@@ -3757,7 +4244,7 @@ void WikiMarkupParser::Parse()
 						Append(params);
 						Append(L">");
 						
-						free(params);
+						_arena->Free(params);
 					}
 					else
 						Append(L"<td>");
@@ -3779,8 +4266,13 @@ void WikiMarkupParser::Parse()
 				}
 		
 				default:
-					Append(c);
+				{
+					// copy the whole run of plain text at once instead of char by char
+					const wchar_t* start = _pCurrentInput - 1;
+					_pCurrentInput = EndOfPlainText(_pCurrentInput);
+					_output.Append(start, _pCurrentInput-start);
 					break;
+				}
 			} // case
 		} // not handled
 	} // Parse
@@ -3798,9 +4290,9 @@ void WikiMarkupParser::Parse()
 		_toc = toc->next;
 		
 		if ( toc->name )
-			free(toc->name);
+			_arena->Free(toc->name);
 		
-		delete(toc);
+		_arena->Free(toc);
 	}	
 	
 	// clean the references
@@ -3809,12 +4301,12 @@ void WikiMarkupParser::Parse()
 		REF* ref = (REF*) _references;
 		_references = ref->next;
 		
-		delete(ref);
+		_arena->Free(ref);
 	}	
 	
 	if ( _categories )
 	{
-		free(_categories);
+		_arena->Free(_categories);
 		_categories = NULL;
 	}	
 }
@@ -3825,7 +4317,6 @@ void WikiMarkupParser::ParseNoWikiArea(int tagType)
 {
 	wchar_t* startOfTagName = NULL;
 	wchar_t* endOfTagName = NULL;
-	wchar_t* startOfComment = NULL;
 	int state = 0;
 	int endTag = 0;
 	
@@ -3844,7 +4335,6 @@ void WikiMarkupParser::ParseNoWikiArea(int tagType)
 					if ( Peek()=='!' && Peek(1)=='-' && Peek(2)=='-' )
 					{
 						// this is a comment
-						startOfComment = _pCurrentInput - 1;
 						Eat(3);
 						
 						state = 2;
@@ -3948,12 +4438,8 @@ void WikiMarkupParser::ParseNoWikiArea(int tagType)
 				// inside a comment
 				if ( c=='-' && Peek()=='-' && Peek(1)=='>' )
 				{
-					// end of comment
+					// end of comment, it's skipped as nothing of it was written
 					Eat(2);
-					// Hmm: if ( !nowiki && !pre ) 
-					{
-						ReplaceInput(NULL, (startOfComment-_pInput), (_pCurrentInput-startOfComment));
-					}
 					
 					state = 0;
 				}
@@ -4016,7 +4502,7 @@ void WikiMarkupParser::InsertToc()
 		targetName = CPPStringUtils::url_encode(targetName);
 	
 		int bufferSize = 128;
-		wchar_t* buffer = (wchar_t*) malloc(bufferSize*sizeof(wchar_t));	
+		wchar_t* buffer = (wchar_t*) _arena->Alloc(bufferSize*sizeof(wchar_t));	
 		
 		swprintf(buffer, bufferSize, L"<li class=\"toclevel-%i\">", level);
 		
@@ -4028,7 +4514,7 @@ void WikiMarkupParser::InsertToc()
 		toc += entry->name;
 		toc += L"</span></a></li>\r\n";
 		
-		free(buffer);
+		_arena->Free(buffer);
 		
 		count++;
 		entry = entry->next;
@@ -4043,20 +4529,7 @@ void WikiMarkupParser::InsertToc()
 	if ( count<=3 && !_forceToc )
 		return;
 	
-	int length = wcslen(_pOutput) + toc.length();
-	wchar_t* dst = (wchar_t*) malloc((length+1)*sizeof(wchar_t));
-	
-	wcsncpy(dst, _pOutput, _tocPosition);
-	*(dst+_tocPosition) = 0x0;
-	wcscat(dst, toc.c_str());
-	wcscat(dst, (_pOutput+_tocPosition));
-
-	free(_pOutput);
-	_pOutput = dst;
-	_iOutputSize = wcslen(_pOutput);
-	_iOutputRemain = 0;
-	
-	_pCurrentOutput = _pOutput + _iOutputSize;
+	_output.Insert(_tocPosition, toc.c_str(), toc.length());
 }
 
 void WikiMarkupParser::InsertReferences()
@@ -4078,7 +4551,8 @@ void WikiMarkupParser::InsertReferences()
 		Append(number);
 		Append(L"\">&uarr;</a>&nbsp;");
 		
-		WikiMarkupParser wikiMarkupParser(_languageCodeW, _pageName, false);
+		WikiMarkupParser wikiMarkupParser(_languageCodeW, _pageName, false, _arena);
+		wikiMarkupParser.ShareMissingLinks(this);
 		
 		wchar_t reftext[ref->length+1];
 		wcsncpy(reftext, ref->start, ref->length);
@@ -24,6 +24,9 @@
 #define WIKIMARKUPPARSER_H
 
 #include "ConfigFile.h"
+#include "OutputBuffer.h"
+#include "ParserArena.h"
+#include "CompiledTemplate.h"
 
 struct tagType {
 	wchar_t* name;
@@ -32,14 +35,53 @@ struct tagType {
 	tagType *pNext;
 };
 
+typedef struct tagTEMPLATEPARAM
+{
+	wstring position;
+	wstring name;
+	wstring value;
+	tagTEMPLATEPARAM* next;
+} TEMPLATEPARAM;
+
+/* the values of a template call while its compiled form is filled in */
+typedef struct
+{
+	TEMPLATEPARAM** params;
+	int paramCount;
+	bool inPlace;			// the parser functions may be done in place
+	bool commentSafe;		// the template had comments, no value may start a new one
+	bool disturbed;			// a value may have changed the calls behind it, they are left as text
+	bool opened;			// a value may have opened a call which is never closed, that changes the calls in front too
+	bool failed;			// the text has to be searched again, see SubstituteTemplateParams
+} TEMPLATEEVALUATION;
+
+/* what a compiled template expands to; the results of parser functions done in place are from firstCall to lastCall, -1 if there are none */
+typedef struct
+{
+	wstring text;
+	int firstCall;
+	int lastCall;
+} TEMPLATEOUTPUT;
+
 class WikiMarkupParser {
 
 public:
-	WikiMarkupParser(const wchar_t* languageCode, const wchar_t* pageName=NULL, bool doExpandtemplates=true);
+	WikiMarkupParser(const wchar_t* languageCode, const wchar_t* pageName=NULL, bool doExpandtemplates=true, ParserArena* arena=NULL);
 	~WikiMarkupParser();
 	
 	void SetInput(const wchar_t* pInput);
+	
+	/* the input as utf-8 in pieces, instead of SetInput; lengthHint is the expected size in bytes */
+	void BeginInput(int lengthHint=0);
+	void AppendInput(const char* utf8, int length);
+	void EndInput();
+	const wchar_t* GetInput();
+	
 	const wchar_t* GetOutput();
+	
+	/* the output is kept in pieces which are never moved, GetOutputChunk hands them out */
+	void SetOutputChunked(bool chunked);
+	bool GetOutputChunk(int index, const wchar_t** text, int* length);
 	void Parse();
 		
 private:
@@ -49,12 +91,20 @@ private:
 	wchar_t*		_pInput;
 	wchar_t*		_pCurrentInput;
 	int				_inputLength;
+	
+	/* state of BeginInput/AppendInput */
+	int				_inputSize;
+	unsigned char	_utf8Pending[4];
+	int				_utf8PendingLength;
+	bool			_crPending;
+	bool			_inputEnded;
 
 	/* output buffer handling */
-	wchar_t*		_pOutput;
-	wchar_t*		_pCurrentOutput;
-	int				_iOutputSize;
-	int				_iOutputRemain;
+	OutputBuffer	_output;
+	
+	/* the scratch memory of the whole render */
+	ParserArena*	_arena;
+	bool			_ownArena;
 	
 	/* should templates be expanded, usually this is only necessary for the first start	*/
 	bool _doExpandTemplates;
@@ -79,6 +129,9 @@ private:
 	/* our current page name, can be null */
 	const wchar_t *_pageName;
 	
+	/* what the template call being expanded used, see ExpansionCache */
+	int _expansionDependencies;
+	
 	/* if set to true this stops parsing */
 	bool _stop;
 	
@@ -91,8 +144,9 @@ private:
 	/* toc forced */
 	bool _forceToc;
 	
-	/* table of contents list */
+	/* table of contents list, new entries go behind the last one */
 	void* _toc;
+	void* _lastToc;
 	
 	/* references list */
 	void* _references;
@@ -100,6 +154,10 @@ private:
 	/* simply a list of categories */
 	wchar_t* _categories;
 	
+	/* the sorted targets of internal links which don't exist, NULL if not checked */
+	void* _missingLinks;
+	bool _sharedMissingLinks;
+	
 	/* prefix of images, "image" is check everytime */
 	wchar_t* _imageNamespace;
 		
@@ -108,7 +166,7 @@ private:
 	
 	double EvaluateExpression(const wchar_t* expression);
 	
-	void ReplaceInput(const wchar_t* text, int position, int length);
+	void AppendInputChar(wchar_t c);
 	
 	wchar_t GetNextChar();
 	wchar_t Peek();
@@ -120,6 +178,13 @@ private:
 	wchar_t* RemoveComments(const wchar_t* src);
 	wchar_t* ExpandTemplates(const wchar_t* src);
 	wchar_t* ExpandTemplate(const wchar_t* templateText);
+	void SubstituteTemplateParams(wstring& wikiTemplate, TEMPLATEPARAM** listOfParams, int paramCount);
+	bool EvaluateTemplate(CompiledTemplate* compiledTemplate, TEMPLATEPARAM** listOfParams, int paramCount, TEMPLATEOUTPUT* output);
+	void EvaluateTemplateNodes(const TEMPLATENODE* node, TEMPLATEEVALUATION* evaluation, TEMPLATEOUTPUT* output);
+	wstring EvaluateTemplateText(const TEMPLATENODE* node, TEMPLATEEVALUATION* evaluation);
+	void EvaluateTemplateParam(const TEMPLATENODE* node, TEMPLATEEVALUATION* evaluation, TEMPLATEOUTPUT* output);
+	bool EvaluateParserFunction(const TEMPLATENODE* node, TEMPLATEEVALUATION* evaluation, TEMPLATEOUTPUT* output);
+	const wstring* TemplateParamValue(const wstring& name, TEMPLATEEVALUATION* evaluation);
 	wchar_t* HandleKnownTemplatesAndVariables(const wchar_t* text);
 	wchar_t* NotHandledText(const wchar_t* text);
 		
@@ -138,6 +203,9 @@ private:
 	void Append(const wchar_t* msg);
 	void AppendHtml(const wchar_t* html);
 
+	wstring InternalLinkTarget(const wchar_t* link, int length);
+	void CheckInternalLinks();
+	void ShareMissingLinks(const WikiMarkupParser* parent);
 	void HandleInternalLink(const wchar_t* linkText);
 	void HandleExternalLink(const wchar_t* linkText);
 	void HandleChar(wchar_t c);
@@ -0,0 +1,503 @@
+/*
+ *  ArchiveWriter.cpp
+ *  Wiki2Touch/wikibuild
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "ArchiveFormat.h"
+#include "CPPStringUtils.h"
+#include "DictionaryTrainer.h"
+#include "ArchiveWriter.h"
+
+// the number of blocks waiting to be written per thread, limits the memory used
+#define PENDING_BLOCKS_PER_THREAD 4
+
+// titles per task when the index keys are made
+#define KEYS_PER_TASK 65536
+
+typedef struct
+{
+	ArchiveWriter* writer;
+	const vector<ARTICLEENTRY>* articles;
+	vector<string>* keys;
+	int		indexNo;
+	int		first;
+	int		count;
+} KEYTASK;
+
+class KeyLess
+{
+public:
+	KeyLess(const vector<string>* keys) { _keys = keys; }
+	bool operator()(int a, int b) const { return (*_keys)[a]<(*_keys)[b]; }
+
+private:
+	const vector<string>* _keys;
+};
+
+ArchiveWriter::ArchiveWriter(string fileName, string languageCode, ARCHIVEOPTIONS options)
+{
+	_fileName = fileName;
+	_languageCode = languageCode;
+	_options = options;
+
+	if ( _options.blockSize100k<1 || _options.blockSize100k>9 )
+		_options.blockSize100k = DEFAULT_BLOCK_SIZE_100K;
+	if ( _options.articlesPerBlock<1 )
+		_options.articlesPerBlock = DEFAULT_ARTICLES_PER_BLOCK;
+	if ( _options.maxBlockSize<=0 )
+		_options.maxBlockSize = _options.blockSize100k*100000;
+	if ( _options.version!=1 || _options.codec!=ARCHIVE_CODEC_BZIP2 )
+		_options.version = ARCHIVE_VERSION_64;
+
+	_isChinese = _languageCode.length()>=2 && tolower(_languageCode[0])=='z' && tolower(_languageCode[1])=='h';
+
+	_error = false;
+	_block = NULL;
+	_blockArticles = 0;
+	_numberOfBlocks = 0;
+	_uncompressedSize = 0;
+	_compressedSize = 0;
+
+	pthread_mutex_init(&_mutex, NULL);
+	pthread_cond_init(&_blockDone, NULL);
+
+	_pool = new WorkPool(_options.threads);
+	
+	_codec = NULL;
+	if ( _options.codec==ARCHIVE_CODEC_BZIP2 )
+		_codec = BlockCodec::Create(ARCHIVE_CODEC_BZIP2, string(), _options.blockSize100k);
+	_heldSize = 0;
+	_dictionaryPos = 0;
+	_dictionarySize = 0;
+
+	// written under another name until it's complete
+	_f = fopen((_fileName + ".tmp").c_str(), "wb");
+	if ( !_f )
+		return;
+
+	// the header is written again at the end
+	FILEHEADER header;
+	memset(&header, 0, sizeof(header));
+	if ( fwrite(&header, sizeof(header), 1, _f)!=1 )
+		_error = true;
+}
+
+ArchiveWriter::~ArchiveWriter()
+{
+	// everything given to the pool has to be done before the blocks are gone
+	delete _pool;
+
+	while ( !_pendingBlocks.empty() )
+	{
+		ARCHIVEBLOCK* block = _pendingBlocks.front();
+		_pendingBlocks.pop_front();
+
+		if ( block->compressed )
+			free(block->compressed);
+		delete block;
+	}
+
+	for (size_t i=0; i<_heldBlocks.size(); i++)
+		delete _heldBlocks[i];
+
+	if ( _block )
+		delete _block;
+
+	if ( _codec )
+		delete _codec;
+
+	if ( _f )
+	{
+		fclose(_f);
+		unlink((_fileName + ".tmp").c_str());
+	}
+
+	pthread_cond_destroy(&_blockDone);
+	pthread_mutex_destroy(&_mutex);
+}
+
+bool ArchiveWriter::IsOpen()
+{
+	return _f!=NULL && !_error;
+}
+
+int ArchiveWriter::NumberOfArticles()
+{
+	return _articles.size();
+}
+
+int ArchiveWriter::NumberOfBlocks()
+{
+	return _numberOfBlocks;
+}
+
+long long ArchiveWriter::UncompressedSize()
+{
+	return _uncompressedSize;
+}
+
+long long ArchiveWriter::CompressedSize()
+{
+	return _compressedSize;
+}
+
+bool ArchiveWriter::AddArticle(const string& title, const string& text)
+{
+	if ( !IsOpen() )
+		return false;
+
+	// nothing in front of an article may be larger than the block size, a reader has to decompress it
+	if ( _block && _block->data.length() + text.length()>(size_t) _options.maxBlockSize )
+		CloseBlock();
+
+	if ( !_block )
+	{
+		_block = new ARCHIVEBLOCK;
+		_block->blockNo = _numberOfBlocks++;
+		_block->compressed = NULL;
+		_block->compressedSize = 0;
+		_block->error = false;
+		_block->done = false;
+		_block->writer = this;
+		_blockArticles = 0;
+
+		_blockPositions.push_back(0);
+	}
+
+	ARTICLEENTRY entry;
+	entry.title = title;
+	entry.blockNo = _block->blockNo;
+	entry.articlePos = _block->data.length();
+	entry.articleLength = text.length();
+	_articles.push_back(entry);
+
+	_block->data += text;
+	_blockArticles++;
+	_uncompressedSize += text.length();
+
+	// smaller blocks make reading an article faster, larger ones the archive smaller
+	if ( _blockArticles>=_options.articlesPerBlock || _block->data.length()>=(size_t) _options.maxBlockSize )
+		CloseBlock();
+
+	return !_error;
+}
+
+void ArchiveWriter::CloseBlock()
+{
+	if ( !_block )
+		return;
+
+	ARCHIVEBLOCK* block = _block;
+	_block = NULL;
+
+	if ( _codec )
+	{
+		SubmitBlock(block);
+		return;
+	}
+
+	_heldBlocks.push_back(block);
+	_heldSize += block->data.length();
+
+	if ( _heldSize>=DEFAULT_DICTIONARY_SAMPLE_SIZE )
+		MakeDictionary();
+}
+
+void ArchiveWriter::SubmitBlock(ARCHIVEBLOCK* block)
+{
+	pthread_mutex_lock(&_mutex);
+	_pendingBlocks.push_back(block);
+	pthread_mutex_unlock(&_mutex);
+
+	_pool->Submit(CompressBlock, block);
+
+	WriteBlocks(_pool->NumberOfThreads()*PENDING_BLOCKS_PER_THREAD);
+}
+
+void ArchiveWriter::MakeDictionary()
+{
+	DictionaryTrainer trainer;
+	for (size_t i=0; i<_heldBlocks.size(); i++)
+		trainer.AddSample(_heldBlocks[i]->data);
+
+	string dictionary = trainer.Train();
+
+	// no block is written yet, the dictionary is in front of them
+	_dictionaryPos = ftello(_f);
+	_dictionarySize = dictionary.length();
+	if ( fwrite(dictionary.data(), 1, dictionary.length(), _f)!=dictionary.length() )
+		_error = true;
+
+	_codec = BlockCodec::Create(_options.codec, dictionary);
+
+	vector<ARCHIVEBLOCK*> heldBlocks;
+	heldBlocks.swap(_heldBlocks);
+	for (size_t i=0; i<heldBlocks.size(); i++)
+		SubmitBlock(heldBlocks[i]);
+}
+
+void ArchiveWriter::CompressBlock(void* argument)
+{
+	ARCHIVEBLOCK* block = (ARCHIVEBLOCK*) argument;
+	ArchiveWriter* writer = (ArchiveWriter*) block->writer;
+
+	block->error = !writer->_codec->Compress(block->data.data(), block->data.length(), &block->compressed, &block->compressedSize);
+
+	// not needed anymore
+	string().swap(block->data);
+
+	pthread_mutex_lock(&writer->_mutex);
+	block->done = true;
+	pthread_cond_broadcast(&writer->_blockDone);
+	pthread_mutex_unlock(&writer->_mutex);
+}
+
+bool ArchiveWriter::WriteBlocks(size_t maxPending)
+{
+	// writes the compressed blocks in order; waits if more than maxPending are left
+	pthread_mutex_lock(&_mutex);
+	while ( !_pendingBlocks.empty() )
+	{
+		ARCHIVEBLOCK* block = _pendingBlocks.front();
+		if ( !block->done )
+		{
+			if ( _pendingBlocks.size()<=maxPending )
+				break;
+
+			pthread_cond_wait(&_blockDone, &_mutex);
+			continue;
+		}
+
+		_pendingBlocks.pop_front();
+		pthread_mutex_unlock(&_mutex);
+
+		if ( block->error )
+		{
+			fprintf(stderr, "compression of block %i failed\n", block->blockNo);
+			_error = true;
+		}
+		else if ( !_error )
+		{
+			_blockPositions[block->blockNo] = ftello(_f);
+			if ( fwrite(block->compressed, 1, block->compressedSize, _f)!=block->compressedSize )
+				_error = true;
+
+			_compressedSize += block->compressedSize;
+		}
+
+		if ( block->compressed )
+			free(block->compressed);
+		delete block;
+
+		pthread_mutex_lock(&_mutex);
+	}
+	pthread_mutex_unlock(&_mutex);
+
+	return !_error;
+}
+
+bool ArchiveWriter::Align()
+{
+	// version 2 starts the titles and the indexes at page boundaries
+	if ( _options.version<ARCHIVE_VERSION_64 )
+		return true;
+
+	off_t pos = ftello(_f);
+	if ( pos<0 )
+		return false;
+
+	static const char padding[ARCHIVE_PAGE_SIZE] = { 0 };
+	size_t size = (ARCHIVE_PAGE_SIZE - pos % ARCHIVE_PAGE_SIZE) % ARCHIVE_PAGE_SIZE;
+
+	return fwrite(padding, 1, size, _f)==size;
+}
+
+bool ArchiveWriter::Finish(string imageNamespace, string templateNamespace)
+{
+	if ( !IsOpen() )
+		return false;
+
+	CloseBlock();
+	if ( !_codec )
+		MakeDictionary();
+	if ( !WriteBlocks(0) )
+		return false;
+
+	FILEHEADER header;
+	memset(&header, 0, sizeof(header));
+
+	memcpy(header.languageCode, _languageCode.c_str(), min(_languageCode.length(), sizeof(header.languageCode)));
+	header.numberOfArticles = _articles.size();
+	header.version = _options.version;
+	if ( _options.version>=ARCHIVE_VERSION_64 )
+	{
+		header.maxBlockSize = _options.maxBlockSize;
+		header.codec = _options.codec;
+		header.dictionaryPos = _dictionaryPos;
+		header.dictionarySize = _dictionarySize;
+	}
+	strncpy(header.imageNamespace, imageNamespace.c_str(), sizeof(header.imageNamespace) - 1);
+	strncpy(header.templateNamespace, templateNamespace.c_str(), sizeof(header.templateNamespace) - 1);
+
+	vector<long long> titlePositions;
+
+	if ( !Align() )
+		return false;
+	header.titlesPos = ftello(_f);
+	if ( !WriteTitles(titlePositions) )
+		return false;
+
+	if ( !Align() )
+		return false;
+	if ( !WriteIndex(0, titlePositions, &header.indexPos_0) )
+		return false;
+
+	if ( !Align() )
+		return false;
+	if ( !WriteIndex(1, titlePositions, &header.indexPos_1) )
+		return false;
+
+	if ( fseeko(_f, 0, SEEK_SET) || fwrite(&header, sizeof(header), 1, _f)!=1 )
+		return false;
+
+	int error = fclose(_f);
+	_f = NULL;
+
+	if ( error || rename((_fileName + ".tmp").c_str(), _fileName.c_str()) )
+	{
+		unlink((_fileName + ".tmp").c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool ArchiveWriter::WriteTitles(vector<long long>& titlePositions)
+{
+	off_t titlesPos = ftello(_f);
+
+	titlePositions.resize(_articles.size());
+	long long pos = 0;
+
+	for (size_t i=0; i<_articles.size(); i++)
+	{
+		ARTICLEENTRY* entry = &_articles[i];
+
+		// version 1 slots are 32 bit (and used to be signed)
+		if ( _options.version<ARCHIVE_VERSION_64 && pos>0x7fffffffLL )
+		{
+			fprintf(stderr, "the titles don't fit into a version 1 archive\n");
+			return false;
+		}
+		titlePositions[i] = pos;
+
+		char position[SIZEOF_POSITION_INFORMATION];
+		long long blockPos = _blockPositions[entry->blockNo];
+		memcpy(position, &blockPos, sizeof(blockPos));
+		memcpy(position + sizeof(blockPos), &entry->articlePos, sizeof(entry->articlePos));
+		memcpy(position + sizeof(blockPos) + sizeof(entry->articlePos), &entry->articleLength, sizeof(entry->articleLength));
+
+		if ( fwrite(position, 1, sizeof(position), _f)!=sizeof(position) || fwrite(entry->title.c_str(), 1, entry->title.length() + 1, _f)!=entry->title.length() + 1 )
+			return false;
+
+		pos += sizeof(position) + entry->title.length() + 1;
+	}
+
+	return ftello(_f)==titlesPos + pos;
+}
+
+string ArchiveWriter::IndexKey(const string& title, int indexNo)
+{
+	// the same as TitleIndex::NormalizedTitle
+	string key = CPPStringUtils::to_lower_utf8(title);
+	if ( indexNo==0 )
+		return key;
+
+	if ( _isChinese )
+		return CPPStringUtils::tc2sc_utf8(key);
+
+	return CPPStringUtils::exchange_diacritic_chars_utf8(key);
+}
+
+void ArchiveWriter::MakeKeys(void* argument)
+{
+	KEYTASK* task = (KEYTASK*) argument;
+
+	for (int i=task->first; i<task->first + task->count; i++)
+		(*task->keys)[i] = task->writer->IndexKey((*task->articles)[i].title, task->indexNo);
+
+	delete task;
+}
+
+bool ArchiveWriter::WriteIndex(int indexNo, const vector<long long>& titlePositions, long long* indexPos)
+{
+	*indexPos = ftello(_f);
+
+	// the keys are made by the pool, sorting is done here
+	int numberOfArticles = _articles.size();
+	vector<string> keys(numberOfArticles);
+
+	for (int first=0; first<numberOfArticles; first+=KEYS_PER_TASK)
+	{
+		KEYTASK* task = new KEYTASK;
+		task->writer = this;
+		task->articles = &_articles;
+		task->keys = &keys;
+		task->indexNo = indexNo;
+		task->first = first;
+		task->count = min(KEYS_PER_TASK, numberOfArticles - first);
+
+		_pool->Submit(MakeKeys, task);
+	}
+	_pool->Wait();
+
+	// titles with the same key keep the order of the dump
+	vector<int> order(numberOfArticles);
+	for (int i=0; i<numberOfArticles; i++)
+		order[i] = i;
+	stable_sort(order.begin(), order.end(), KeyLess(&keys));
+
+	for (int i=0; i<numberOfArticles; i++)
+	{
+		size_t written;
+		if ( _options.version>=ARCHIVE_VERSION_64 )
+		{
+			long long slot = titlePositions[order[i]];
+			written = fwrite(&slot, sizeof(slot), 1, _f);
+		}
+		else
+		{
+			unsigned int slot = (unsigned int) titlePositions[order[i]];
+			written = fwrite(&slot, sizeof(slot), 1, _f);
+		}
+
+		if ( written!=1 )
+			return false;
+	}
+
+	return true;
+}
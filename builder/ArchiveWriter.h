@@ -0,0 +1,137 @@
+/*
+ *  ArchiveWriter.h
+ *  Wiki2Touch/wikibuild
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARCHIVEWRITER_H
+#define ARCHIVEWRITER_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include <deque>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "WorkPool.h"
+#include "BlockCodec.h"
+
+#define DEFAULT_BLOCK_SIZE_100K 9
+#define DEFAULT_ARTICLES_PER_BLOCK 64
+
+typedef struct
+{
+	int		blockSize100k;		// the bzip2 block size, 1..9
+	int		articlesPerBlock;	// a block is closed when it has this many articles ...
+	int		maxBlockSize;		// ... or would get more uncompressed bytes (0: one bzip2 block)
+	int		threads;			// 0: one per processor
+	int		version;			// of the archive format, 1 or 2
+	int		codec;				// ARCHIVE_CODEC_..., anything but bzip2 needs version 2
+} ARCHIVEOPTIONS;
+
+typedef struct
+{
+	string	title;
+	int		blockNo;
+	unsigned int articlePos;	// in the uncompressed block
+	unsigned int articleLength;
+} ARTICLEENTRY;
+
+typedef struct
+{
+	int		blockNo;
+	string	data;				// the uncompressed articles
+	char*	compressed;
+	size_t	compressedSize;
+	bool	error;
+	bool	done;
+	void*	writer;
+} ARCHIVEBLOCK;
+
+/*
+ Writes articles.bin: the articles are collected in blocks which are compressed by the threads of
+ a work pool and written in order; the titles and both indexes follow when all articles are in.
+ With deflate the first blocks are held back until a dictionary is made from them.
+ */
+class ArchiveWriter
+{
+public:
+	ArchiveWriter(string fileName, string languageCode, ARCHIVEOPTIONS options);
+	~ArchiveWriter();
+
+	bool IsOpen();
+
+	// the text has to be utf-8
+	bool AddArticle(const string& title, const string& text);
+
+	// writes the rest and the header; the archive is complete only if this returns true
+	bool Finish(string imageNamespace, string templateNamespace);
+
+	int NumberOfArticles();
+	int NumberOfBlocks();
+	long long UncompressedSize();
+	long long CompressedSize();
+
+private:
+	string	_fileName;
+	string	_languageCode;
+	ARCHIVEOPTIONS _options;
+	bool	_isChinese;
+
+	FILE*	_f;
+	bool	_error;
+
+	WorkPool* _pool;
+	
+	// NULL until the dictionary is made from the first blocks, these are held back until then
+	BlockCodec* _codec;
+	vector<ARCHIVEBLOCK*> _heldBlocks;
+	size_t	_heldSize;
+	long long _dictionaryPos;
+	unsigned int _dictionarySize;
+
+	vector<ARTICLEENTRY> _articles;
+	vector<long long> _blockPositions;
+
+	ARCHIVEBLOCK* _block;		// the one articles are added to
+	int		_blockArticles;
+	int		_numberOfBlocks;
+	long long _uncompressedSize;
+	long long _compressedSize;
+
+	// the blocks given to the pool, in order
+	pthread_mutex_t _mutex;
+	pthread_cond_t _blockDone;
+	deque<ARCHIVEBLOCK*> _pendingBlocks;
+
+	void CloseBlock();
+	void SubmitBlock(ARCHIVEBLOCK* block);
+	void MakeDictionary();
+	bool WriteBlocks(size_t maxPending);
+	static void CompressBlock(void* argument);
+
+	bool Align();
+	bool WriteTitles(vector<long long>& titlePositions);
+	bool WriteIndex(int indexNo, const vector<long long>& titlePositions, long long* indexPos);
+	string IndexKey(const string& title, int indexNo);
+	static void MakeKeys(void* argument);
+};
+
+#endif
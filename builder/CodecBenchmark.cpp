@@ -0,0 +1,219 @@
+/*
+ *  CodecBenchmark.cpp
+ *  Wiki2Touch/wikibuild
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <set>
+
+#include "ArchiveFormat.h"
+#include "DictionaryTrainer.h"
+#include "CodecBenchmark.h"
+
+static double Seconds()
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+
+	return now.tv_sec + now.tv_usec/1000000.0;
+}
+
+CodecBenchmark::CodecBenchmark(string pathToDataFile, int blockSize100k)
+{
+	_dataFileName = pathToDataFile + "/articles.bin";
+	_blockSize100k = blockSize100k;
+}
+
+bool CodecBenchmark::Run()
+{
+	if ( !LoadBlocks() )
+		return false;
+
+	// the dictionary is made the same way the builder does it
+	DictionaryTrainer trainer;
+	for (size_t i=0; i<_blocks.size() && trainer.SampleSize()<DEFAULT_DICTIONARY_SAMPLE_SIZE; i++)
+		trainer.AddSample(_blocks[i]);
+	string dictionary = trainer.Train();
+
+	BlockCodec* codecs[3];
+	codecs[0] = BlockCodec::Create(ARCHIVE_CODEC_BZIP2, string(), _blockSize100k);
+	codecs[1] = BlockCodec::Create(ARCHIVE_CODEC_DEFLATE);
+	codecs[2] = BlockCodec::Create(ARCHIVE_CODEC_DEFLATE, dictionary);
+
+	printf("%-20s %10s %7s %10s %12s %10s %10s\n", "codec", "MB", "ratio", "compress", "decompress", "ms/block", "max ms");
+
+	bool ok = true;
+	for (int i=0; i<3; i++)
+	{
+		if ( !Measure(codecs[i]) )
+			ok = false;
+		delete codecs[i];
+	}
+
+	return ok;
+}
+
+bool CodecBenchmark::LoadBlocks()
+{
+	int fd = open(_dataFileName.c_str(), O_RDONLY);
+	if ( fd<0 )
+	{
+		printf("can't open %s\n", _dataFileName.c_str());
+		return false;
+	}
+
+	FILEHEADER header;
+	BlockCodec* codec = NULL;
+	if ( pread(fd, &header, sizeof(header), 0)==sizeof(header) && header.version<=ARCHIVE_VERSION_64 )
+		codec = BlockCodec::ForArchive(fd, &header);
+	close(fd);
+
+	FILE* f = codec ? fopen(_dataFileName.c_str(), "rb") : NULL;
+	if ( !f )
+	{
+		printf("can't read %s\n", _dataFileName.c_str());
+		if ( codec )
+			delete codec;
+		return false;
+	}
+
+	// the blocks are found through the title table
+	set<long long> blockPositions;
+	bool error = fseeko(f, header.titlesPos, SEEK_SET)!=0;
+	for (unsigned int i=0; !error && i<header.numberOfArticles; i++)
+	{
+		char position[SIZEOF_POSITION_INFORMATION];
+		if ( fread(position, 1, sizeof(position), f)!=sizeof(position) )
+			error = true;
+
+		long long blockPos;
+		memcpy(&blockPos, position, sizeof(blockPos));
+		blockPositions.insert(blockPos);
+
+		int c;
+		while ( (c=getc(f))!=EOF && c )
+			;
+		if ( c==EOF )
+			error = true;
+	}
+
+	size_t size = 0;
+	for (set<long long>::iterator i=blockPositions.begin(); !error && i!=blockPositions.end() && size<BENCHMARK_MAX_SIZE; i++)
+	{
+		char* data;
+		size_t length;
+		if ( fseeko(f, *i, SEEK_SET) || !codec->Decompress(f, 0, &data, &length) )
+		{
+			error = true;
+			break;
+		}
+
+		_blocks.push_back(string(data, length));
+		size += length;
+		free(data);
+	}
+
+	fclose(f);
+	delete codec;
+
+	if ( error )
+		printf("can't read the blocks of %s\n", _dataFileName.c_str());
+	else
+		printf("%s: %i blocks, %.1f MB\n", _dataFileName.c_str(), (int) _blocks.size(), size/1048576.0);
+
+	return !error && !_blocks.empty();
+}
+
+bool CodecBenchmark::Measure(BlockCodec* codec)
+{
+	FILE* f = tmpfile();
+	if ( !f )
+		return false;
+
+	size_t uncompressedSize = 0;
+	vector<long long> positions;
+	bool error = false;
+
+	double start = Seconds();
+	for (size_t i=0; !error && i<_blocks.size(); i++)
+	{
+		char* compressed;
+		size_t compressedSize;
+		if ( !codec->Compress(_blocks[i].data(), _blocks[i].length(), &compressed, &compressedSize) )
+		{
+			error = true;
+			break;
+		}
+
+		positions.push_back(ftello(f));
+		if ( fwrite(compressed, 1, compressedSize, f)!=compressedSize )
+			error = true;
+		free(compressed);
+
+		uncompressedSize += _blocks[i].length();
+	}
+	double compressTime = Seconds() - start;
+	long long compressedSize = ftello(f);
+	fflush(f);
+
+	// every block on its own, like a request for one article does it
+	double decompressTime = 0;
+	double maxTime = 0;
+	for (size_t i=0; !error && i<_blocks.size(); i++)
+	{
+		start = Seconds();
+
+		char* data;
+		size_t size;
+		if ( fseeko(f, positions[i], SEEK_SET) || !codec->Decompress(f, _blocks[i].length(), &data, &size) )
+		{
+			error = true;
+			break;
+		}
+
+		double time = Seconds() - start;
+		decompressTime += time;
+		if ( time>maxTime )
+			maxTime = time;
+
+		if ( size!=_blocks[i].length() || memcmp(data, _blocks[i].data(), size) )
+			error = true;
+		free(data);
+	}
+
+	fclose(f);
+
+	if ( error )
+	{
+		printf("%-20s failed\n", codec->Name());
+		return false;
+	}
+
+	printf("%-20s %10.1f %6.1f%% %9.2fs %9.1fMB/s %10.3f %10.3f\n", codec->Name(), compressedSize/1048576.0, 100.0*compressedSize/uncompressedSize, compressTime,
+		   uncompressedSize/1048576.0/decompressTime, 1000*decompressTime/_blocks.size(), 1000*maxTime);
+
+	return true;
+}
@@ -0,0 +1,55 @@
+/*
+ *  CodecBenchmark.h
+ *  Wiki2Touch/wikibuild
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CODECBENCHMARK_H
+#define CODECBENCHMARK_H
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "BlockCodec.h"
+
+// the uncompressed blocks taken from the archive at most
+#define BENCHMARK_MAX_SIZE (256*1024*1024)
+
+/*
+ Compresses the blocks of an existing archive with every codec and reads them back one by one,
+ which is what the server does for an article. Prints the size and the times of each codec.
+ */
+class CodecBenchmark
+{
+public:
+	CodecBenchmark(string pathToDataFile, int blockSize100k);
+
+	bool Run();
+
+private:
+	string	_dataFileName;
+	int		_blockSize100k;
+	vector<string> _blocks;
+
+	bool LoadBlocks();
+	bool Measure(BlockCodec* codec);
+};
+
+#endif
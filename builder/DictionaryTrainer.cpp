@@ -0,0 +1,127 @@
+/*
+ *  DictionaryTrainer.cpp
+ *  Wiki2Touch/wikibuild
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "DictionaryTrainer.h"
+
+// the substrings which are counted
+#define KMER_LENGTH 8
+
+// the pieces the dictionary is made of
+#define SEGMENT_LENGTH 64
+
+// the counts are kept in a table of 2^HASH_BITS entries, collisions only make a count too high
+#define HASH_BITS 22
+
+static unsigned int KmerHash(const char* kmer)
+{
+	unsigned long long value;
+	memcpy(&value, kmer, sizeof(value));
+
+	return (unsigned int) ((value * 0x9e3779b97f4a7c15ULL) >> (64 - HASH_BITS));
+}
+
+DictionaryTrainer::DictionaryTrainer()
+{
+}
+
+void DictionaryTrainer::AddSample(const string& sample)
+{
+	_samples += sample;
+}
+
+size_t DictionaryTrainer::SampleSize()
+{
+	return _samples.length();
+}
+
+string DictionaryTrainer::Train(size_t size)
+{
+	size_t length = _samples.length();
+	if ( length<=size )
+		return _samples;
+
+	size_t numberOfKmers = length - KMER_LENGTH + 1;
+	const char* samples = _samples.data();
+
+	vector<unsigned int> hashes(numberOfKmers);
+	vector<unsigned int> counts(1 << HASH_BITS, 0);
+	for (size_t i=0; i<numberOfKmers; i++)
+	{
+		hashes[i] = KmerHash(samples + i);
+		counts[hashes[i]]++;
+	}
+
+	// one segment per epoch, the score of a segment is the sum of the counts of its kmers
+	size_t numberOfSegments = size / SEGMENT_LENGTH;
+	size_t epochLength = length / numberOfSegments;
+	size_t window = SEGMENT_LENGTH - KMER_LENGTH + 1;
+
+	vector<pair<unsigned long long, size_t> > segments;
+	for (size_t epoch=0; epoch<numberOfSegments; epoch++)
+	{
+		size_t begin = epoch * epochLength;
+		size_t end = min(begin + epochLength, numberOfKmers);
+		if ( end<begin + window )
+			continue;
+
+		unsigned long long score = 0;
+		for (size_t i=begin; i<begin + window; i++)
+			score += counts[hashes[i]];
+
+		unsigned long long bestScore = score;
+		size_t best = begin;
+		for (size_t start=begin + 1; start + window<=end; start++)
+		{
+			score += counts[hashes[start + window - 1]];
+			score -= counts[hashes[start - 1]];
+
+			if ( score>bestScore )
+			{
+				bestScore = score;
+				best = start;
+			}
+		}
+
+		if ( !bestScore )
+			continue;
+
+		segments.push_back(pair<unsigned long long, size_t>(bestScore, best));
+
+		// what the segment covers doesn't make other segments better
+		for (size_t i=best; i<best + window; i++)
+			counts[hashes[i]] = 0;
+	}
+
+	// the most valuable segments go to the end, next to the data (short distances are cheaper)
+	stable_sort(segments.begin(), segments.end());
+
+	string dictionary;
+	for (size_t i=0; i<segments.size(); i++)
+		dictionary.append(_samples, segments[i].second, SEGMENT_LENGTH);
+
+	return dictionary;
+}
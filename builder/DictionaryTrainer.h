@@ -0,0 +1,54 @@
+/*
+ *  DictionaryTrainer.h
+ *  Wiki2Touch/wikibuild
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DICTIONARYTRAINER_H
+#define DICTIONARYTRAINER_H
+
+#include <string>
+using namespace std;
+
+// the size of a zlib window, a larger dictionary can't be used
+#define DEFAULT_DICTIONARY_SIZE 32768
+
+// the article text a dictionary is made from
+#define DEFAULT_DICTIONARY_SAMPLE_SIZE (16*1024*1024)
+
+/*
+ Makes a preset dictionary for deflate from samples of the articles: the samples are cut into
+ epochs, and from every epoch the segment is taken whose substrings are most frequent in all
+ samples (and not yet covered by the segments taken before).
+ */
+class DictionaryTrainer
+{
+public:
+	DictionaryTrainer();
+
+	void AddSample(const string& sample);
+	size_t SampleSize();
+
+	string Train(size_t size=DEFAULT_DICTIONARY_SIZE);
+
+private:
+	string	_samples;
+};
+
+#endif
@@ -0,0 +1,406 @@
+/*
+ *  DumpReader.cpp
+ *  Wiki2Touch/wikibuild
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "DumpReader.h"
+
+#define BUFFER_SIZE (1024*1024)
+
+DumpReader::DumpReader(string fileName)
+{
+	_f = NULL;
+	_bzf = NULL;
+	_eof = true;
+	_bytesRead = 0;
+
+	_buffer = (char*) malloc(BUFFER_SIZE);
+	_pos = 0;
+	_end = 0;
+
+	if ( fileName=="-" )
+		_f = stdin;
+	else
+		_f = fopen(fileName.c_str(), "rb");
+
+	if ( !_f || !_buffer )
+		return;
+
+	_eof = false;
+
+	// compressed or not is told by the first bytes
+	char magic[3];
+	size_t read = fread(magic, 1, sizeof(magic), _f);
+	if ( read==sizeof(magic) && !memcmp(magic, "BZh", 3) )
+	{
+		int bzerror;
+		_bzf = BZ2_bzReadOpen(&bzerror, _f, 0, 0, magic, read);
+		if ( bzerror!=BZ_OK )
+		{
+			BZ2_bzReadClose(&bzerror, _bzf);
+			_bzf = NULL;
+			_eof = true;
+		}
+	}
+	else
+	{
+		memcpy(_buffer, magic, read);
+		_end = read;
+	}
+}
+
+DumpReader::~DumpReader()
+{
+	if ( _bzf )
+	{
+		int bzerror;
+		BZ2_bzReadClose(&bzerror, _bzf);
+	}
+
+	if ( _f && _f!=stdin )
+		fclose(_f);
+
+	if ( _buffer )
+		free(_buffer);
+}
+
+bool DumpReader::IsOpen()
+{
+	return _f!=NULL && _buffer!=NULL;
+}
+
+string DumpReader::LanguageCode()
+{
+	return _languageCode;
+}
+
+string DumpReader::ImageNamespace()
+{
+	return _imageNamespace;
+}
+
+string DumpReader::TemplateNamespace()
+{
+	return _templateNamespace;
+}
+
+long long DumpReader::BytesRead()
+{
+	return _bytesRead;
+}
+
+bool DumpReader::Fill()
+{
+	// keeps the unread part and appends as much as fits
+	if ( _pos )
+	{
+		memmove(_buffer, _buffer + _pos, _end - _pos);
+		_end -= _pos;
+		_pos = 0;
+	}
+
+	if ( _eof || _end==BUFFER_SIZE )
+		return false;
+
+	int read = 0;
+	if ( _bzf )
+	{
+		int bzerror;
+		read = BZ2_bzRead(&bzerror, _bzf, _buffer + _end, BUFFER_SIZE - _end);
+
+		if ( bzerror==BZ_STREAM_END )
+		{
+			// multistream dumps are many streams one after another
+			void* unused;
+			int numberOfUnused;
+			char unusedCopy[BZ_MAX_UNUSED];
+
+			BZ2_bzReadGetUnused(&bzerror, _bzf, &unused, &numberOfUnused);
+			memcpy(unusedCopy, unused, numberOfUnused);
+			BZ2_bzReadClose(&bzerror, _bzf);
+			_bzf = NULL;
+
+			if ( numberOfUnused || !feof(_f) )
+			{
+				_bzf = BZ2_bzReadOpen(&bzerror, _f, 0, 0, unusedCopy, numberOfUnused);
+				if ( bzerror!=BZ_OK )
+				{
+					BZ2_bzReadClose(&bzerror, _bzf);
+					_bzf = NULL;
+				}
+			}
+
+			if ( !_bzf )
+				_eof = true;
+		}
+		else if ( bzerror!=BZ_OK )
+		{
+			fprintf(stderr, "error in the compressed dump (%i)\n", bzerror);
+			_eof = true;
+			read = 0;
+		}
+	}
+	else
+	{
+		read = fread(_buffer + _end, 1, BUFFER_SIZE - _end, _f);
+		if ( read<=0 )
+			_eof = true;
+	}
+
+	if ( read<=0 )
+		return !_eof;
+
+	_end += read;
+	_bytesRead += read;
+
+	return true;
+}
+
+bool DumpReader::ReadUntil(const char* delimiter, string* text)
+{
+	// consumes everything up to and including the delimiter, the part in front of it is appended to text
+	size_t length = strlen(delimiter);
+
+	while ( true )
+	{
+		const char* start = _buffer + _pos;
+		const char* end = _buffer + _end;
+
+		const char* p = start;
+		while ( (size_t) (end - p)>=length )
+		{
+			p = (const char*) memchr(p, delimiter[0], (end - p) - length + 1);
+			if ( !p )
+				break;
+
+			if ( !memcmp(p, delimiter, length) )
+			{
+				if ( text )
+					text->append(start, p - start);
+				_pos = (p - _buffer) + length;
+
+				return true;
+			}
+
+			p++;
+		}
+
+		// the last bytes may be the beginning of the delimiter
+		size_t keep = length - 1;
+		if ( keep>(size_t) (end - start) )
+			keep = end - start;
+
+		if ( text )
+			text->append(start, (end - start) - keep);
+		_pos = _end - keep;
+
+		if ( !Fill() )
+			return false;
+	}
+}
+
+bool DumpReader::ReadTag(string& tag)
+{
+	tag.clear();
+
+	return ReadUntil("<", NULL) && ReadUntil(">", &tag);
+}
+
+string DumpReader::Attribute(const string& tag, const char* name)
+{
+	string search = string(" ") + name + "=\"";
+
+	size_t pos = tag.find(search);
+	if ( pos==string::npos )
+		return string();
+
+	pos += search.length();
+	size_t end = tag.find('"', pos);
+	if ( end==string::npos )
+		return string();
+
+	return tag.substr(pos, end - pos);
+}
+
+bool DumpReader::NextPage(DUMPPAGE& page)
+{
+	page.title.clear();
+	page.ns = -1;
+	page.text.clear();
+
+	bool inPage = false;
+
+	string tag;
+	string content;
+	while ( ReadTag(tag) )
+	{
+		bool empty = !tag.empty() && tag[tag.length()-1]=='/';
+
+		if ( tag=="page" )
+		{
+			inPage = true;
+			page.title.clear();
+			page.ns = -1;
+			page.text.clear();
+		}
+		else if ( tag=="/page" )
+		{
+			if ( inPage )
+				return true;
+		}
+		else if ( tag=="title" )
+		{
+			content.clear();
+			if ( !ReadUntil("</title>", &content) )
+				break;
+
+			page.title = DecodeEntities(content);
+		}
+		else if ( tag=="ns" )
+		{
+			content.clear();
+			if ( !ReadUntil("</ns>", &content) )
+				break;
+
+			page.ns = atoi(content.c_str());
+		}
+		else if ( !tag.compare(0, 4, "text") && (tag.length()==4 || isspace((unsigned char) tag[4])) )
+		{
+			page.text.clear();
+			if ( empty )
+				continue;
+
+			content.clear();
+			if ( !ReadUntil("</text>", &content) )
+				break;
+
+			page.text = DecodeEntities(content);
+		}
+		else if ( tag=="dbname" )
+		{
+			content.clear();
+			if ( !ReadUntil("</dbname>", &content) )
+				break;
+
+			// "enwiki" -> "en"
+			size_t pos = content.find("wiki");
+			_languageCode = content.substr(0, pos);
+		}
+		else if ( !tag.compare(0, 10, "namespace ") && !empty )
+		{
+			string key = Attribute(tag, "key");
+
+			content.clear();
+			if ( !ReadUntil("</namespace>", &content) )
+				break;
+
+			if ( key=="6" )
+				_imageNamespace = DecodeEntities(content);
+			else if ( key=="10" )
+				_templateNamespace = DecodeEntities(content);
+		}
+	}
+
+	return false;
+}
+
+string DumpReader::DecodeEntities(const string& text)
+{
+	if ( text.find('&')==string::npos )
+		return text;
+
+	string result;
+	result.reserve(text.length());
+
+	size_t length = text.length();
+	for (size_t i=0; i<length; i++)
+	{
+		char c = text[i];
+		if ( c!='&' )
+		{
+			result += c;
+			continue;
+		}
+
+		size_t end = text.find(';', i);
+		if ( end==string::npos || end - i>10 )
+		{
+			result += c;
+			continue;
+		}
+
+		string entity = text.substr(i + 1, end - i - 1);
+		unsigned int code = 0;
+
+		if ( entity=="lt" )
+			code = '<';
+		else if ( entity=="gt" )
+			code = '>';
+		else if ( entity=="amp" )
+			code = '&';
+		else if ( entity=="quot" )
+			code = '"';
+		else if ( entity=="apos" )
+			code = '\'';
+		else if ( entity.length()>1 && entity[0]=='#' )
+		{
+			if ( entity[1]=='x' || entity[1]=='X' )
+				code = strtoul(entity.c_str() + 2, NULL, 16);
+			else
+				code = strtoul(entity.c_str() + 1, NULL, 10);
+		}
+
+		if ( !code || code>0x10ffff )
+		{
+			result += c;
+			continue;
+		}
+
+		// to utf-8
+		if ( code<0x80 )
+			result += (char) code;
+		else if ( code<0x800 )
+		{
+			result += (char) (0xc0 | (code >> 6));
+			result += (char) (0x80 | (code & 0x3f));
+		}
+		else if ( code<0x10000 )
+		{
+			result += (char) (0xe0 | (code >> 12));
+			result += (char) (0x80 | ((code >> 6) & 0x3f));
+			result += (char) (0x80 | (code & 0x3f));
+		}
+		else
+		{
+			result += (char) (0xf0 | (code >> 18));
+			result += (char) (0x80 | ((code >> 12) & 0x3f));
+			result += (char) (0x80 | ((code >> 6) & 0x3f));
+			result += (char) (0x80 | (code & 0x3f));
+		}
+
+		i = end;
+	}
+
+	return result;
+}
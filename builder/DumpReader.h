@@ -0,0 +1,80 @@
+/*
+ *  DumpReader.h
+ *  Wiki2Touch/wikibuild
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DUMPREADER_H
+#define DUMPREADER_H
+
+#include <stdio.h>
+#include <bzlib.h>
+#include <string>
+using namespace std;
+
+typedef struct
+{
+	string	title;
+	int		ns;					// -1 if the dump has no namespace numbers
+	string	text;				// utf-8, entities decoded
+} DUMPPAGE;
+
+/*
+ Reads the pages of a MediaWiki XML dump (pages-articles.xml, plain or bzip2 compressed, also
+ multistream) one after another without keeping more than the current page in memory.
+ */
+class DumpReader
+{
+public:
+	// "-" reads stdin
+	DumpReader(string fileName);
+	~DumpReader();
+
+	bool IsOpen();
+	bool NextPage(DUMPPAGE& page);
+
+	// taken from the siteinfo, valid after the first page was read
+	string LanguageCode();
+	string ImageNamespace();
+	string TemplateNamespace();
+
+	long long BytesRead();
+
+private:
+	FILE*	_f;
+	BZFILE*	_bzf;
+	bool	_eof;
+	long long _bytesRead;
+
+	char*	_buffer;
+	size_t	_pos;
+	size_t	_end;
+
+	string	_languageCode;
+	string	_imageNamespace;
+	string	_templateNamespace;
+
+	bool Fill();
+	bool ReadUntil(const char* delimiter, string* text);
+	bool ReadTag(string& tag);
+	string Attribute(const string& tag, const char* name);
+	static string DecodeEntities(const string& text);
+};
+
+#endif
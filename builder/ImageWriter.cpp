@@ -0,0 +1,190 @@
+/*
+ *  ImageWriter.cpp
+ *  Wiki2Touch/wikibuild
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "ArchiveFormat.h"
+#include "CPPStringUtils.h"
+#include "ImageWriter.h"
+
+#define COPY_BUFFER_SIZE 65536
+
+typedef struct
+{
+	string	name;				// lowercase
+	string	path;
+	long long pos;
+	unsigned int length;
+	unsigned int titlePos;
+} IMAGEENTRY;
+
+static bool ImageLess(const IMAGEENTRY& a, const IMAGEENTRY& b)
+{
+	return a.name<b.name;
+}
+
+ImageWriter::ImageWriter(string fileName, string languageCode)
+{
+	_fileName = fileName;
+	_languageCode = languageCode;
+	_numberOfImages = 0;
+}
+
+int ImageWriter::NumberOfImages()
+{
+	return _numberOfImages;
+}
+
+bool ImageWriter::Write(string directory)
+{
+	DIR* dir = opendir(directory.c_str());
+	if ( !dir )
+		return false;
+
+	vector<IMAGEENTRY> images;
+
+	struct dirent* dirEntry;
+	while ( (dirEntry=readdir(dir)) )
+	{
+		if ( dirEntry->d_name[0]=='.' )
+			continue;
+
+		IMAGEENTRY image;
+		image.path = directory + "/" + dirEntry->d_name;
+
+		struct stat statbuf;
+		if ( stat(image.path.c_str(), &statbuf) || !S_ISREG(statbuf.st_mode) || statbuf.st_size>0xffffffffLL )
+			continue;
+
+		image.name = CPPStringUtils::to_lower_utf8(dirEntry->d_name);
+		image.pos = 0;
+		image.length = statbuf.st_size;
+		image.titlePos = 0;
+
+		images.push_back(image);
+	}
+	closedir(dir);
+
+	// ImageIndex searches the names byte by byte
+	sort(images.begin(), images.end(), ImageLess);
+
+	string tempFileName = _fileName + ".tmp";
+	FILE* f = fopen(tempFileName.c_str(), "wb");
+	if ( !f )
+		return false;
+
+	IMAGEFILEHEADER header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.languageCode, _languageCode.c_str(), min(_languageCode.length(), sizeof(header.languageCode)));
+	header.numberOfImages = images.size();
+
+	bool error = fwrite(&header, sizeof(header), 1, f)!=1;
+
+	char* buffer = (char*) malloc(COPY_BUFFER_SIZE);
+	for (size_t i=0; !error && i<images.size(); i++)
+	{
+		IMAGEENTRY* image = &images[i];
+
+		FILE* imageFile = fopen(image->path.c_str(), "rb");
+		if ( !imageFile )
+		{
+			error = true;
+			break;
+		}
+
+		image->pos = ftello(f);
+
+		size_t read;
+		long long length = 0;
+		while ( (read=fread(buffer, 1, COPY_BUFFER_SIZE, imageFile))>0 )
+		{
+			if ( fwrite(buffer, 1, read, f)!=read )
+			{
+				error = true;
+				break;
+			}
+			length += read;
+		}
+		fclose(imageFile);
+
+		// changed while it was copied
+		if ( length!=image->length )
+			error = true;
+	}
+	free(buffer);
+
+	// the filenames and their index
+	header.titlesPos = ftello(f);
+	long long pos = 0;
+	for (size_t i=0; !error && i<images.size(); i++)
+	{
+		IMAGEENTRY* image = &images[i];
+
+		if ( pos>0x7fffffffLL )
+		{
+			error = true;
+			break;
+		}
+		image->titlePos = pos;
+
+		char position[SIZEOF_IMAGE_POSITION_INFORMATION];
+		memcpy(position, &image->pos, sizeof(image->pos));
+		memcpy(position + sizeof(image->pos), &image->length, sizeof(image->length));
+
+		if ( fwrite(position, 1, sizeof(position), f)!=sizeof(position) || fwrite(image->name.c_str(), 1, image->name.length() + 1, f)!=image->name.length() + 1 )
+			error = true;
+
+		pos += sizeof(position) + image->name.length() + 1;
+	}
+
+	header.indexPos = ftello(f);
+	for (size_t i=0; !error && i<images.size(); i++)
+	{
+		if ( fwrite(&images[i].titlePos, sizeof(images[i].titlePos), 1, f)!=1 )
+			error = true;
+	}
+
+	if ( !error )
+		error = fseeko(f, 0, SEEK_SET) || fwrite(&header, sizeof(header), 1, f)!=1;
+
+	if ( fclose(f) )
+		error = true;
+
+	if ( error || rename(tempFileName.c_str(), _fileName.c_str()) )
+	{
+		unlink(tempFileName.c_str());
+		return false;
+	}
+
+	_numberOfImages = images.size();
+
+	return true;
+}
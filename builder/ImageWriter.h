@@ -0,0 +1,48 @@
+/*
+ *  ImageWriter.h
+ *  Wiki2Touch/wikibuild
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IMAGEWRITER_H
+#define IMAGEWRITER_H
+
+#include <string>
+using namespace std;
+
+/*
+ Writes images.bin from the files of a directory. The filenames are stored in lowercase; images
+ which were converted from svg have to be named like the original plus ".png" ("map.svg.png").
+ */
+class ImageWriter
+{
+public:
+	ImageWriter(string fileName, string languageCode);
+
+	bool Write(string directory);
+
+	int NumberOfImages();
+
+private:
+	string	_fileName;
+	string	_languageCode;
+	int		_numberOfImages;
+};
+
+#endif
@@ -0,0 +1,217 @@
+/*
+ *  WorkPool.cpp
+ *  Wiki2Touch/wikibuild
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+
+#include "WorkPool.h"
+
+typedef struct
+{
+	WorkPool* pool;
+	int		queueNo;
+} THREADSTART;
+
+WorkPool::WorkPool(int numberOfThreads)
+{
+	if ( numberOfThreads<=0 )
+		numberOfThreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	if ( numberOfThreads<=0 )
+		numberOfThreads = 1;
+
+	pthread_mutex_init(&_mutex, NULL);
+	pthread_cond_init(&_workAvailable, NULL);
+	pthread_cond_init(&_workDone, NULL);
+	_queued = 0;
+	_unfinished = 0;
+	_stop = false;
+	_nextQueue = 0;
+
+	for (int i=0; i<numberOfThreads; i++)
+	{
+		WORKQUEUE* queue = new WORKQUEUE;
+		pthread_mutex_init(&queue->mutex, NULL);
+		_queues.push_back(queue);
+	}
+
+	for (int i=0; i<numberOfThreads; i++)
+	{
+		THREADSTART* start = new THREADSTART;
+		start->pool = this;
+		start->queueNo = i;
+
+		pthread_t thread;
+		if ( pthread_create(&thread, NULL, ThreadMain, start) )
+		{
+			delete start;
+			continue;
+		}
+
+		_threads.push_back(thread);
+	}
+}
+
+WorkPool::~WorkPool()
+{
+	Wait();
+
+	pthread_mutex_lock(&_mutex);
+	_stop = true;
+	pthread_cond_broadcast(&_workAvailable);
+	pthread_mutex_unlock(&_mutex);
+
+	for (size_t i=0; i<_threads.size(); i++)
+		pthread_join(_threads[i], NULL);
+
+	for (size_t i=0; i<_queues.size(); i++)
+	{
+		pthread_mutex_destroy(&_queues[i]->mutex);
+		delete _queues[i];
+	}
+
+	pthread_cond_destroy(&_workDone);
+	pthread_cond_destroy(&_workAvailable);
+	pthread_mutex_destroy(&_mutex);
+}
+
+int WorkPool::NumberOfThreads()
+{
+	return _threads.size();
+}
+
+void WorkPool::Submit(WORKFUNCTION function, void* argument)
+{
+	WORKITEM item;
+	item.function = function;
+	item.argument = argument;
+
+	if ( _threads.empty() )
+	{
+		// no threads at all, do it right here
+		function(argument);
+		return;
+	}
+
+	pthread_mutex_lock(&_mutex);
+	WORKQUEUE* queue = _queues[_nextQueue];
+	_nextQueue = (_nextQueue + 1) % _queues.size();
+	_unfinished++;
+	pthread_mutex_unlock(&_mutex);
+
+	pthread_mutex_lock(&queue->mutex);
+	queue->items.push_back(item);
+	pthread_mutex_unlock(&queue->mutex);
+
+	// counted after the item is in a queue, so a thread woken up always finds it
+	pthread_mutex_lock(&_mutex);
+	_queued++;
+	pthread_cond_signal(&_workAvailable);
+	pthread_mutex_unlock(&_mutex);
+}
+
+void WorkPool::Wait()
+{
+	pthread_mutex_lock(&_mutex);
+	while ( _unfinished )
+		pthread_cond_wait(&_workDone, &_mutex);
+	pthread_mutex_unlock(&_mutex);
+}
+
+void* WorkPool::ThreadMain(void* argument)
+{
+	THREADSTART* start = (THREADSTART*) argument;
+
+	WorkPool* pool = start->pool;
+	int queueNo = start->queueNo;
+	delete start;
+
+	pool->Run(queueNo);
+
+	return NULL;
+}
+
+void WorkPool::Run(int queueNo)
+{
+	while ( true )
+	{
+		pthread_mutex_lock(&_mutex);
+		while ( !_queued && !_stop )
+			pthread_cond_wait(&_workAvailable, &_mutex);
+
+		if ( !_queued && _stop )
+		{
+			pthread_mutex_unlock(&_mutex);
+			break;
+		}
+		pthread_mutex_unlock(&_mutex);
+
+		WORKITEM item;
+		if ( !TakeItem(queueNo, &item) )
+			continue;
+
+		item.function(item.argument);
+
+		pthread_mutex_lock(&_mutex);
+		if ( !--_unfinished )
+			pthread_cond_broadcast(&_workDone);
+		pthread_mutex_unlock(&_mutex);
+	}
+}
+
+bool WorkPool::TakeItem(int queueNo, WORKITEM* item)
+{
+	bool found = false;
+
+	// the own queue first, oldest item first
+	WORKQUEUE* queue = _queues[queueNo];
+	pthread_mutex_lock(&queue->mutex);
+	if ( !queue->items.empty() )
+	{
+		*item = queue->items.front();
+		queue->items.pop_front();
+		found = true;
+	}
+	pthread_mutex_unlock(&queue->mutex);
+
+	// then steal from the others, newest item first
+	for (size_t i=1; !found && i<_queues.size(); i++)
+	{
+		queue = _queues[(queueNo + i) % _queues.size()];
+
+		pthread_mutex_lock(&queue->mutex);
+		if ( !queue->items.empty() )
+		{
+			*item = queue->items.back();
+			queue->items.pop_back();
+			found = true;
+		}
+		pthread_mutex_unlock(&queue->mutex);
+	}
+
+	if ( found )
+	{
+		pthread_mutex_lock(&_mutex);
+		_queued--;
+		pthread_mutex_unlock(&_mutex);
+	}
+
+	return found;
+}
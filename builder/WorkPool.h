@@ -0,0 +1,81 @@
+/*
+ *  WorkPool.h
+ *  Wiki2Touch/wikibuild
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#include <pthread.h>
+#include <deque>
+#include <vector>
+using namespace std;
+
+typedef void (*WORKFUNCTION)(void* argument);
+
+typedef struct
+{
+	WORKFUNCTION function;
+	void*	argument;
+} WORKITEM;
+
+typedef struct
+{
+	pthread_mutex_t mutex;
+	deque<WORKITEM> items;
+} WORKQUEUE;
+
+/*
+ A fixed number of threads, each with its own queue. New work is spread over the queues; a thread
+ takes the oldest item of its own queue and steals the newest one of another queue if its own
+ is empty, so a few slow items don't keep the other threads idle.
+ */
+class WorkPool
+{
+public:
+	// 0 threads: one per processor
+	WorkPool(int numberOfThreads=0);
+	~WorkPool();
+
+	void Submit(WORKFUNCTION function, void* argument);
+
+	// returns when all submitted work is done
+	void Wait();
+
+	int NumberOfThreads();
+
+private:
+	vector<pthread_t> _threads;
+	vector<WORKQUEUE*> _queues;
+	int		_nextQueue;
+
+	pthread_mutex_t _mutex;
+	pthread_cond_t _workAvailable;
+	pthread_cond_t _workDone;
+	int		_queued;				// items in the queues
+	int		_unfinished;			// items submitted but not done yet
+	bool	_stop;
+
+	static void* ThreadMain(void* argument);
+	void Run(int queueNo);
+	bool TakeItem(int queueNo, WORKITEM* item);
+};
+
+#endif
@@ -0,0 +1,301 @@
+/*
+ *  main.cpp
+ *  Wiki2Touch/wikibuild
+ *
+ *  Copyright (c) 2008 by Tom Haukap.
+ *
+ *  This file is part of Wiki2Touch.
+ *
+ *  Wiki2Touch is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Wiki2Touch is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Wiki2Touch. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <set>
+
+#include "ArchiveFormat.h"
+#include "TitleIndex.h"
+#include "DumpReader.h"
+#include "ArchiveWriter.h"
+#include "ImageWriter.h"
+#include "CodecBenchmark.h"
+#include "TemplatePack.h"
+
+// the namespaces taken from the dump if nothing else is given: articles and templates
+#define DEFAULT_NAMESPACES "0,10"
+
+static void Usage()
+{
+	printf("usage: wikibuild [options] <pages-articles.xml[.bz2] | ->\n");
+	printf("       wikibuild -B <dir>  compares the codecs on the blocks of dir/articles.bin\n");
+	printf("       wikibuild -T <file> compacts a template pack (%s), not while wikisrvd uses it\n", TEMPLATE_PACK_FILE_NAME);
+	printf("  -o <dir>     where articles.bin (and images.bin) are written, default .\n");
+	printf("  -l <code>    language code, default taken from the dump\n");
+	printf("  -n <list>    namespaces to take, default %s\n", DEFAULT_NAMESPACES);
+	printf("  -b <1..9>    bzip2 block size in 100 kb, default %i\n", DEFAULT_BLOCK_SIZE_100K);
+	printf("  -a <n>       articles per compressed block, default %i\n", DEFAULT_ARTICLES_PER_BLOCK);
+	printf("  -s <kb>      uncompressed size of a block at most, bounds what is decompressed to read\n");
+	printf("               an article (unless it is larger itself), default one bzip2 block\n");
+	printf("  -j <n>       compression threads, default one per processor\n");
+	printf("  -v <1|2>     archive version, default %i\n", ARCHIVE_VERSION_64);
+	printf("  -c <codec>   bzip2 or deflate (with a dictionary made from the articles, version 2\n");
+	printf("               only; decompresses much faster), default bzip2\n");
+	printf("  -x           also write the index file (articles.idx)\n");
+	printf("  -i <dir>     also write images.bin from the files in dir\n");
+}
+
+static bool ParseNamespaces(const char* list, set<int>& namespaces)
+{
+	namespaces.clear();
+
+	while ( *list )
+	{
+		char* end;
+		long ns = strtol(list, &end, 10);
+		if ( end==list )
+			return false;
+
+		namespaces.insert((int) ns);
+
+		list = end;
+		if ( *list==',' )
+			list++;
+	}
+
+	return !namespaces.empty();
+}
+
+int main(int argc, char* argv[])
+{
+	string outputPath = ".";
+	string languageCode;
+	string imagePath;
+	string dumpFileName;
+	string benchmarkPath;
+	string templatePackFileName;
+	bool writeIndexFile = false;
+
+	set<int> namespaces;
+	ParseNamespaces(DEFAULT_NAMESPACES, namespaces);
+
+	ARCHIVEOPTIONS options;
+	options.blockSize100k = DEFAULT_BLOCK_SIZE_100K;
+	options.articlesPerBlock = DEFAULT_ARTICLES_PER_BLOCK;
+	options.maxBlockSize = 0;
+	options.threads = 0;
+	options.version = ARCHIVE_VERSION_64;
+	options.codec = ARCHIVE_CODEC_BZIP2;
+
+	for (int i=1; i<argc; i++)
+	{
+		bool hasValue = i<argc-1;
+
+		if ( !strcmp(argv[i], "-o") && hasValue )
+			outputPath = argv[++i];
+		else if ( !strcmp(argv[i], "-l") && hasValue )
+			languageCode = argv[++i];
+		else if ( !strcmp(argv[i], "-i") && hasValue )
+			imagePath = argv[++i];
+		else if ( !strcmp(argv[i], "-n") && hasValue )
+		{
+			if ( !ParseNamespaces(argv[++i], namespaces) )
+			{
+				printf("illegal namespace list: %s\n", argv[i]);
+				return 1;
+			}
+		}
+		else if ( !strcmp(argv[i], "-b") && hasValue )
+		{
+			options.blockSize100k = atoi(argv[++i]);
+			if ( options.blockSize100k<1 || options.blockSize100k>9 )
+			{
+				printf("illegal block size: %s\n", argv[i]);
+				return 1;
+			}
+		}
+		else if ( !strcmp(argv[i], "-a") && hasValue )
+		{
+			options.articlesPerBlock = atoi(argv[++i]);
+			if ( options.articlesPerBlock<1 )
+			{
+				printf("illegal number of articles per block: %s\n", argv[i]);
+				return 1;
+			}
+		}
+		else if ( !strcmp(argv[i], "-s") && hasValue )
+		{
+			int kilobytes = atoi(argv[++i]);
+			if ( kilobytes<1 || kilobytes>1024*1024 )
+			{
+				printf("illegal block size: %s\n", argv[i]);
+				return 1;
+			}
+			options.maxBlockSize = kilobytes*1024;
+		}
+		else if ( !strcmp(argv[i], "-j") && hasValue )
+			options.threads = atoi(argv[++i]);
+		else if ( !strcmp(argv[i], "-v") && hasValue )
+		{
+			options.version = atoi(argv[++i]);
+			if ( options.version!=1 && options.version!=ARCHIVE_VERSION_64 )
+			{
+				printf("illegal archive version: %s\n", argv[i]);
+				return 1;
+			}
+		}
+		else if ( !strcmp(argv[i], "-c") && hasValue )
+		{
+			i++;
+			if ( !strcmp(argv[i], "bzip2") )
+				options.codec = ARCHIVE_CODEC_BZIP2;
+			else if ( !strcmp(argv[i], "deflate") )
+				options.codec = ARCHIVE_CODEC_DEFLATE;
+			else
+			{
+				printf("unknown codec: %s\n", argv[i]);
+				return 1;
+			}
+		}
+		else if ( !strcmp(argv[i], "-B") && hasValue )
+			benchmarkPath = argv[++i];
+		else if ( !strcmp(argv[i], "-T") && hasValue )
+			templatePackFileName = argv[++i];
+		else if ( !strcmp(argv[i], "-x") )
+			writeIndexFile = true;
+		else if ( argv[i][0]!='-' || !strcmp(argv[i], "-") )
+			dumpFileName = argv[i];
+		else
+		{
+			Usage();
+			return 1;
+		}
+	}
+
+	if ( !benchmarkPath.empty() )
+	{
+		CodecBenchmark benchmark(benchmarkPath, options.blockSize100k);
+		return benchmark.Run() ? 0 : 1;
+	}
+
+	if ( !templatePackFileName.empty() )
+	{
+		int templates;
+		if ( !TemplatePack::Compact(templatePackFileName, &templates) )
+		{
+			printf("can't compact %s\n", templatePackFileName.c_str());
+			return 1;
+		}
+
+		printf("%s: %i templates\n", templatePackFileName.c_str(), templates);
+		return 0;
+	}
+
+	if ( options.codec!=ARCHIVE_CODEC_BZIP2 && options.version!=ARCHIVE_VERSION_64 )
+	{
+		printf("only version %i archives can use another codec than bzip2\n", ARCHIVE_VERSION_64);
+		return 1;
+	}
+
+	if ( dumpFileName.empty() )
+	{
+		Usage();
+		return 1;
+	}
+
+	DumpReader dumpReader(dumpFileName);
+	if ( !dumpReader.IsOpen() )
+	{
+		printf("can't open %s\n", dumpFileName.c_str());
+		return 1;
+	}
+
+	time_t start = time(NULL);
+
+	// the language is known when the siteinfo was read, that is with the first page
+	DUMPPAGE page;
+	bool hasPage = dumpReader.NextPage(page);
+
+	if ( languageCode.empty() )
+		languageCode = dumpReader.LanguageCode();
+
+	string fileName = outputPath + "/articles.bin";
+	ArchiveWriter writer(fileName, languageCode, options);
+	if ( !writer.IsOpen() )
+	{
+		printf("can't create %s\n", fileName.c_str());
+		return 1;
+	}
+
+	int pages = 0;
+	while ( hasPage )
+	{
+		pages++;
+
+		if ( (page.ns<0 || namespaces.count(page.ns)) && !page.title.empty() )
+		{
+			if ( !writer.AddArticle(page.title, page.text) )
+			{
+				printf("can't write %s\n", fileName.c_str());
+				return 1;
+			}
+		}
+
+		if ( !(pages % 10000) )
+		{
+			fprintf(stderr, "\r%i pages, %i articles, %lld MB read", pages, writer.NumberOfArticles(), dumpReader.BytesRead() >> 20);
+			fflush(stderr);
+		}
+
+		hasPage = dumpReader.NextPage(page);
+	}
+	fprintf(stderr, "\n");
+
+	if ( !writer.Finish(dumpReader.ImageNamespace(), dumpReader.TemplateNamespace()) )
+	{
+		printf("can't write %s\n", fileName.c_str());
+		return 1;
+	}
+
+	printf("%s: %i articles in %i blocks, %lld MB -> %lld MB, %i seconds\n", fileName.c_str(), writer.NumberOfArticles(), writer.NumberOfBlocks(),
+		   writer.UncompressedSize() >> 20, writer.CompressedSize() >> 20, (int) (time(NULL) - start));
+
+	if ( writeIndexFile )
+	{
+		TitleIndex titleIndex(outputPath);
+		if ( !titleIndex.WriteIndexFile() )
+		{
+			printf("can't write the index file\n");
+			return 1;
+		}
+	}
+
+	if ( !imagePath.empty() )
+	{
+		string imageFileName = outputPath + "/images.bin";
+
+		ImageWriter imageWriter(imageFileName, languageCode);
+		if ( !imageWriter.Write(imagePath) )
+		{
+			printf("can't write %s\n", imageFileName.c_str());
+			return 1;
+		}
+
+		printf("%s: %i images\n", imageFileName.c_str(), imageWriter.NumberOfImages());
+	}
+
+	return 0;
+}
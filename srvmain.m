@@ -195,14 +195,16 @@ void send_article(FILE *f, char* name)
                        
                         WikiMarkupParser wikiMarkupParser(CPPStringUtils::to_wstring(languageCode).c_str(), L"Testpage");
                        
-                        wstring article = CPPStringUtils::from_utf8w(string(contents));
+                        wikiMarkupParser.BeginInput(length);
+                        wikiMarkupParser.AppendInput(contents, length);
+                        wikiMarkupParser.EndInput();
                         free(contents);
                        
-                        wikiMarkupParser.SetInput(article.c_str());
                         wikiMarkupParser.Parse();
                        
                         string data = "<html><body>\r\n";
-                        data += CPPStringUtils::to_utf8(wikiMarkupParser.GetOutput());
+                        const wchar_t* output = wikiMarkupParser.GetOutput();
+                        CPPStringUtils::append_utf8(data, output, wcslen(output));
                         data += "</html></body>";
                         length = data.length();
                        
@@ -232,11 +234,10 @@ void send_article(FILE *f, char* name)
                                 redirect_to(f, (string("/wiki/") + string(languageCode) + string(":") + articleSearchResult->TitleInArchive()).c_str());
                         else
                         {
-                                std::wstring article = wikiArticle->GetArticle(articleSearchResult);    
-                                if ( !article.empty() )
+                                // already utf-8, goes out as it is
+                                string data = wikiArticle->GetArticle(articleSearchResult);    
+                                if ( !data.empty() )
                                 {
-                                        string data = CPPStringUtils::to_utf8(article);
-                               
                                         int length = data.length();
                                         send_headers(f, 200, "OK", NULL, "text/html; charset=utf-8", length, -1);
 
@@ -464,6 +465,36 @@ settings.WebContentPath().c_str());
                         string redirectUrl = "/wiki/" + string(languageCode) + ":" + CPPStringUtils::url_encode(articleTitle);
                         redirect_to(f, redirectUrl.c_str());
                 }
+                else if ( strcasestr(url, "GetStatistics") )
+                {
+                        // lookup counters of the title index, the caches and the parser memory, one "name:value" pair per line
+                        url += 13;
+                       
+                        char languageCode[3];
+                        if ( strlen(url)>=2 )
+                        {
+                                languageCode[0] = *url++;
+                                languageCode[1] = *url++;
+                                languageCode[2] = 0x0;
+                        }
+                        else
+                        {
+                                // no language code in the url, use the default one
+                                strcpy(languageCode, __settings->DefaultLanguageCode().c_str());
+                        }
+                       
+                        TitleIndex* titleIndex = __settings->GetTitleIndex(languageCode);
+                        if ( !titleIndex )
+                        {
+                                send_error(f, 404, "No language code not installed", NULL, "");
+                                return 0;
+                        }
+                       
+                        string statistics = titleIndex->GetStatistics() + "\n" + __settings->GetBlockCache()->GetStatistics() + "\n" + __settings->GetTemplateCache()->GetStatistics() + "\n" + __settings->GetExpansionCache()->GetStatistics() + "\n" + ParserArena::GetStatistics();
+                       
+                        send_headers(f, 200, "OK", NULL, "text/plain; charset=utf-8", statistics.length(), -1);
+                        fwrite(statistics.c_str(), 1, statistics.length(), f);
+                }
                 else if ( strcasestr(url, "GetInstalledLanguages") )
                 {
                         // returns a list of installed languages, the default one is the first entry, the xx one is ignored
@@ -663,6 +694,12 @@ void sigterm(int sig)
 	NSLog(@"Wikisrvd:srvmain.m:startSrvThread\n");
 	signal(SIGPIPE,SIG_IGN);
 	signal(SIGTERM,sigterm);
+
+	// the missing title index files (-x) are written and the crowded template packs compacted
+	// before the first request
+	__settings->WriteIndexFiles();
+	__settings->OpenTemplatePacks();
+
 	struct sockaddr_in sin;
 	_sock = socket(AF_INET, SOCK_STREAM, 0);
 